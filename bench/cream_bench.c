@@ -0,0 +1,644 @@
+#include "cream.h"
+#include "stats.h"
+#include "chan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// requests an open loop thread may have in flight before it stalls
+#define BENCH_WINDOW (1 << 16)
+
+#define BENCH_USAGE();                                                          \
+fprintf(stderr, "USAGE: %s\n",                                                  \
+"./cream_bench [-h] [-H HOST] [-t THREADS] [-d SECONDS] [-r RATE] [-n KEYS]"    \
+" [-z THETA] [-m GET:PUT:EVICT] [-k MIN:MAX] [-v MIN:MAX] [-D BUDGET_US] [-P]"  \
+" [-U SOCKET] [-X] PORT\n"                                                        \
+"-h                 Displays this help menu and returns EXIT_SUCCESS.\n"          \
+"-H HOST            Server to load. Defaults to 127.0.0.1.\n"                   \
+"-t THREADS         Client threads, each with its own connection. Defaults"     \
+" to 4.\n"                                                                        \
+"-d SECONDS         How long to measure for. Defaults to 10.\n"                 \
+"-r RATE            Requests per second across all threads. Requests are sent"  \
+" on schedule whether or not earlier ones were answered (open loop), and their" \
+" latency counts from when they were due. Without -r each thread waits for a"  \
+" response before sending again (closed loop).\n"                               \
+"-n KEYS            Size of the key space. Defaults to 100000.\n"               \
+"-z THETA           Pick keys from a Zipfian distribution with skew THETA,"    \
+" such as 0.99, instead of uniformly.\n"                                          \
+"-m GET:PUT:EVICT   Relative weights of the request types. Defaults to"        \
+" 90:10:0.\n"                                                                     \
+"-k MIN:MAX         Key size range in bytes. Defaults to 16:16.\n"              \
+"-v MIN:MAX         Value size range in bytes. Defaults to 32:512.\n"           \
+"-D BUDGET_US       Give every request a deadline of BUDGET_US microseconds.\n" \
+"-P                 PUT every key once before measuring.\n"                     \
+"-U SOCKET          Connect to the server's UNIX socket SOCKET instead of PORT," \
+" which may be left out.\n"                                                      \
+"-X                 Send requests over a shared memory channel per thread, asked" \
+" for on SOCKET. Not with -D.\n"                                                 \
+"PORT               Port the server listens on.\n");                             \
+exit(EXIT_FAILURE);
+
+typedef struct bench_opts_t {
+    char *host;
+    int port;
+    int num_threads;
+    double duration;
+    double rate;
+    uint64_t num_keys;
+    double theta;
+    uint32_t mix[3];
+    uint32_t key_min, key_max;
+    uint32_t val_min, val_max;
+    uint32_t budget_us;
+    int preload;
+    char *unix_path;
+    int channel;
+} bench_opts_t;
+
+// precomputed constants of the Zipfian generator from YCSB (Gray et al.)
+typedef struct bench_zipf_t {
+    double theta, alpha, zetan, eta;
+} bench_zipf_t;
+
+typedef struct bench_thread_t {
+    pthread_t thread;
+    int index;
+    int fd;
+    // with -X, requests go over chan and are answered in order, so the id
+    // of a response is the number received before it
+    chan_t *chan;
+    uint64_t received;
+    volatile bool stopping;
+    uint64_t rng;
+    stats_block_t *stats;
+    uint64_t sent, done, errors, busy, expired;
+    // when each in-flight request was due and what it was, by request id
+    uint64_t *due;
+    uint8_t *kind;
+} bench_thread_t;
+
+bench_opts_t opts;
+bench_zipf_t zipf;
+stats_t *stats;
+char *value_pattern;
+pthread_barrier_t start_line;
+uint64_t start_ns, stop_ns;
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// xorshift64*, one state per thread
+static uint64_t next_rand(uint64_t *state){
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double next_unit(uint64_t *state){
+    return (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void zipf_init(bench_zipf_t *self, uint64_t n, double theta){
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    self->theta = theta;
+    self->zetan = 0;
+    for(uint64_t i = 1; i <= n; i++){
+        self->zetan += 1.0 / pow((double)i, theta);
+    }
+    self->alpha = 1.0 / (1.0 - theta);
+    self->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / self->zetan);
+}
+
+// the rank of the next key; rank 0 is the most popular
+static uint64_t zipf_next(bench_zipf_t *self, uint64_t n, uint64_t *state){
+    double u = next_unit(state), uz = u * self->zetan;
+
+    if(uz < 1.0){
+        return 0;
+    }
+    if(uz < 1.0 + pow(0.5, self->theta)){
+        return 1;
+    }
+    return (uint64_t)(n * pow(self->eta * u - self->eta + 1.0, self->alpha)) % n;
+}
+
+// spreads ranks over the key space, so hot keys don't share a neighbourhood
+static uint64_t scramble(uint64_t x){
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t next_key(uint64_t *state){
+    if(opts.theta > 0){
+        return scramble(zipf_next(&zipf, opts.num_keys, state)) % opts.num_keys;
+    }
+    return next_rand(state) % opts.num_keys;
+}
+
+// a key is its number padded to a size that depends only on the number
+static uint32_t make_key(uint64_t id, char *buf){
+    uint32_t len = opts.key_min + scramble(id) % (opts.key_max - opts.key_min + 1);
+
+    memset(buf, 'k', len);
+    memcpy(buf, &id, len < sizeof(id) ? len : sizeof(id));
+    return len;
+}
+
+static uint32_t make_value_size(uint64_t *state){
+    return opts.val_min + next_rand(state) % (opts.val_max - opts.val_min + 1);
+}
+
+static uint8_t next_op(uint64_t *state){
+    uint32_t total = opts.mix[0] + opts.mix[1] + opts.mix[2], pick = next_rand(state) % total;
+
+    if(pick < opts.mix[0]){
+        return GET;
+    }
+    return pick < opts.mix[0] + opts.mix[1] ? PUT : EVICT;
+}
+
+static stats_op_t stats_kind(uint8_t op){
+    return op == GET ? STATS_GET : op == PUT ? STATS_PUT : STATS_EVICT;
+}
+
+static bool readn(int fd, void *buf, size_t len){
+    ssize_t n;
+
+    while(len > 0){
+        if((n = read(fd, buf, len)) <= 0){
+            if(n < 0 && errno == EINTR){ continue; }
+            return false;
+        }
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool writen(int fd, struct iovec *iov, int iovcnt){
+    ssize_t n;
+
+    while(iovcnt > 0){
+        if((n = writev(fd, iov, iovcnt)) < 0){
+            if(errno == EINTR){ continue; }
+            return false;
+        }
+        while(iovcnt > 0 && n >= (ssize_t)iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static int bench_connect(void){
+    struct sockaddr_un local = {.sun_family = AF_UNIX};
+    struct addrinfo hints, *res;
+    char port[16];
+    int fd, one = 1;
+
+    if(opts.unix_path != NULL){
+        strncpy(local.sun_path, opts.unix_path, sizeof(local.sun_path) - 1);
+        if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&local, sizeof(local)) < 0){
+            if(fd >= 0){
+                close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", opts.port);
+    if(getaddrinfo(opts.host, port, &hints, &res) != 0){
+        return -1;
+    }
+    if((fd = socket(res->ai_family, res->ai_socktype, 0)) < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0){
+        if(fd >= 0){
+            close(fd);
+        }
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// asks for a channel on a UNIX socket connection and maps the fd it comes with
+static chan_t *bench_channel(int fd){
+    request_header_t request = {.request_code = CHANNEL};
+    response_header_t response;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {.iov_base = &response, .iov_len = sizeof(response)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    struct cmsghdr *cmsg;
+    int chanfd;
+
+    iov.iov_base = &request;
+    iov.iov_len = sizeof(request);
+    if(!writen(fd, &iov, 1)){
+        return NULL;
+    }
+    iov = (struct iovec) {.iov_base = &response, .iov_len = sizeof(response)};
+    if(recvmsg(fd, &msg, MSG_WAITALL) != sizeof(response) || response.response_code != OK ||
+        (cmsg = CMSG_FIRSTHDR(&msg)) == NULL || cmsg->cmsg_type != SCM_RIGHTS){
+        errno = EPROTO;
+        return NULL;
+    }
+    memcpy(&chanfd, CMSG_DATA(cmsg), sizeof(int));
+    return attach_chan(chanfd);
+}
+
+// sends a request as one record on the thread's channel
+static bool send_record(bench_thread_t *self, uint8_t op, uint64_t key){
+    request_header_t header = {.request_code = op};
+    char *record;
+
+    header.value_size = op == PUT ? make_value_size(&self->rng) : 0;
+    while((record = chan_reserve(self->chan, CHAN_REQUESTS, sizeof(header) + MAX_KEY_SIZE + header.value_size)) == NULL){
+        if(errno != EAGAIN){
+            return false;
+        }
+        chan_wait(self->chan, CHAN_REQUESTS, true, 100);
+    }
+    header.key_size = make_key(key, record + sizeof(header));
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header) + header.key_size, value_pattern, header.value_size);
+    chan_commit(self->chan, CHAN_REQUESTS, sizeof(header) + header.key_size + header.value_size);
+    return true;
+}
+
+// reads one response record, until the thread is stopped
+static bool read_record(bench_thread_t *self, uint32_t *id, uint32_t *code){
+    response_header_t header;
+    uint32_t len;
+    char *record;
+
+    while((record = chan_peek(self->chan, CHAN_RESPONSES, &len)) == NULL){
+        if(errno != EAGAIN || (!chan_wait(self->chan, CHAN_RESPONSES, false, 100) && self->stopping)){
+            return false;
+        }
+    }
+    memcpy(&header, record, sizeof(header));
+    chan_consume(self->chan, CHAN_RESPONSES);
+    *id = self->received++;
+    *code = header.response_code;
+    return true;
+}
+
+static bool send_request(bench_thread_t *self, uint32_t id, uint8_t op, uint64_t key){
+    char keybuf[MAX_KEY_SIZE];
+    request_header_v2_t header = {.magic = PROTOCOL_V2, .request_code = op, .request_id = id};
+    struct iovec iov[4];
+
+    if(self->chan != NULL){
+        return send_record(self, op, key);
+    }
+    header.key_size = make_key(key, keybuf);
+    header.value_size = op == PUT ? make_value_size(&self->rng) : 0;
+    header.flags = opts.budget_us != 0 ? FLAG_DEADLINE : 0;
+    iov[0] = (struct iovec) {.iov_base = &header, .iov_len = sizeof(header)};
+    iov[1] = (struct iovec) {.iov_base = &opts.budget_us, .iov_len = opts.budget_us != 0 ? sizeof(uint32_t) : 0};
+    iov[2] = (struct iovec) {.iov_base = keybuf, .iov_len = header.key_size};
+    iov[3] = (struct iovec) {.iov_base = value_pattern, .iov_len = header.value_size};
+    return writen(self->fd, iov, 4);
+}
+
+// reads one response, discarding its body, and returns its id and code
+static bool read_response(bench_thread_t *self, uint32_t *id, uint32_t *code){
+    response_header_v2_t header;
+    char sink[4096];
+    uint32_t left, n;
+
+    if(self->chan != NULL){
+        return read_record(self, id, code);
+    }
+    if(!readn(self->fd, &header, sizeof(header))){
+        return false;
+    }
+    for(left = header.value_size; left > 0; left -= n){
+        n = left < sizeof(sink) ? left : sizeof(sink);
+        if(!readn(self->fd, sink, n)){
+            return false;
+        }
+    }
+    *id = header.request_id;
+    *code = header.response_code;
+    return true;
+}
+
+static void record(bench_thread_t *self, uint8_t op, uint32_t code, uint64_t latency){
+    stats_op_t kind = stats_kind(op);
+
+    self->stats->ops[kind]++;
+    stats_record(&self->stats->latency[kind], latency);
+    if(op == GET && code == OK){
+        self->stats->hits++;
+    } else if(op == GET && code == NOT_FOUND){
+        self->stats->misses++;
+    } else if(code == BUSY){
+        self->busy++;
+    } else if(code == TIMEOUT){
+        self->expired++;
+    } else if(code != OK && !(op == EVICT && code == NOT_FOUND)){
+        self->errors++;
+    }
+}
+
+// fills this thread's share of the key space, one request at a time
+static void preload(bench_thread_t *self){
+    uint32_t id, code;
+
+    for(uint64_t key = self->index; key < opts.num_keys; key += opts.num_threads){
+        if(!send_request(self, 0, PUT, key) || !read_response(self, &id, &code)){
+            perror("preload");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void *closed_loop(void *arg){
+    bench_thread_t *self = arg;
+    uint64_t sent_at;
+    uint32_t id, code;
+    uint8_t op;
+
+    if(opts.preload){
+        preload(self);
+    }
+    pthread_barrier_wait(&start_line);
+    pthread_barrier_wait(&start_line);
+
+    while((sent_at = now_ns()) < stop_ns){
+        op = next_op(&self->rng);
+        if(!send_request(self, self->sent, op, next_key(&self->rng)) || !read_response(self, &id, &code)){
+            perror("request");
+            break;
+        }
+        self->sent++;
+        self->done++;
+        record(self, op, code, now_ns() - sent_at);
+    }
+    return NULL;
+}
+
+// collects an open loop thread's responses
+static void *receiver(void *arg){
+    bench_thread_t *self = arg;
+    uint32_t id, code;
+
+    while(read_response(self, &id, &code)){
+        record(self, self->kind[id % BENCH_WINDOW], code, now_ns() - self->due[id % BENCH_WINDOW]);
+        __atomic_add_fetch(&self->done, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *open_loop(void *arg){
+    bench_thread_t *self = arg;
+    pthread_t reader;
+    struct timespec wake;
+    uint64_t due, interval = (uint64_t)(1e9 * opts.num_threads / opts.rate);
+    uint8_t op;
+
+    if(opts.preload){
+        preload(self);
+    }
+    pthread_create(&reader, NULL, receiver, self);
+    pthread_barrier_wait(&start_line);
+    pthread_barrier_wait(&start_line);
+
+    // stagger the threads so their schedules interleave
+    for(due = start_ns + interval * self->index / opts.num_threads; due < stop_ns; due += interval){
+        wake = (struct timespec) {.tv_sec = due / 1000000000, .tv_nsec = due % 1000000000};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+
+        // a full window is the server falling behind; the wait is measured
+        while(self->sent - __atomic_load_n(&self->done, __ATOMIC_ACQUIRE) >= BENCH_WINDOW){
+            sched_yield();
+        }
+        op = next_op(&self->rng);
+        self->due[self->sent % BENCH_WINDOW] = due;
+        self->kind[self->sent % BENCH_WINDOW] = op;
+        if(!send_request(self, self->sent, op, next_key(&self->rng))){
+            perror("request");
+            break;
+        }
+        self->sent++;
+    }
+
+    // give stragglers a second, then stop the receiver
+    while(__atomic_load_n(&self->done, __ATOMIC_ACQUIRE) < self->sent && now_ns() < stop_ns + 1000000000){
+        usleep(1000);
+    }
+    self->stopping = true;
+    shutdown(self->fd, SHUT_RDWR);
+    pthread_join(reader, NULL);
+    return NULL;
+}
+
+static bool parse_range(char *arg, uint32_t *min, uint32_t *max){
+    return sscanf(arg, "%" SCNu32 ":%" SCNu32, min, max) == 2 && *min <= *max;
+}
+
+static void parse_bench_args(int argc, char *argv[]){
+    int opt;
+
+    opts = (bench_opts_t) {.host = "127.0.0.1", .num_threads = 4, .duration = 10, .num_keys = 100000,
+        .mix = {90, 10, 0}, .key_min = 16, .key_max = 16, .val_min = 32, .val_max = 512};
+    while((opt = getopt(argc, argv, "hH:t:d:r:n:z:m:k:v:D:PU:X")) != -1){
+        switch(opt){
+            case 'h':
+                BENCH_USAGE();
+            case 'H':
+                opts.host = optarg;
+                break;
+            case 't':
+                opts.num_threads = atoi(optarg);
+                break;
+            case 'd':
+                opts.duration = atof(optarg);
+                break;
+            case 'r':
+                opts.rate = atof(optarg);
+                break;
+            case 'n':
+                opts.num_keys = strtoull(optarg, NULL, 10);
+                break;
+            case 'z':
+                opts.theta = atof(optarg);
+                break;
+            case 'm':
+                if(sscanf(optarg, "%" SCNu32 ":%" SCNu32 ":%" SCNu32, &opts.mix[0], &opts.mix[1], &opts.mix[2]) != 3){
+                    BENCH_USAGE();
+                }
+                break;
+            case 'k':
+                if(!parse_range(optarg, &opts.key_min, &opts.key_max)){
+                    BENCH_USAGE();
+                }
+                break;
+            case 'v':
+                if(!parse_range(optarg, &opts.val_min, &opts.val_max)){
+                    BENCH_USAGE();
+                }
+                break;
+            case 'D':
+                opts.budget_us = strtoul(optarg, NULL, 10);
+                break;
+            case 'P':
+                opts.preload = 1;
+                break;
+            case 'U':
+                opts.unix_path = optarg;
+                break;
+            case 'X':
+                opts.channel = 1;
+                break;
+            default:
+                BENCH_USAGE();
+        }
+    }
+    // the port is only needed without -U
+    if(opts.unix_path != NULL && optind == argc){
+        opts.port = 1;
+    } else if(optind != argc - 1 || (opts.port = atoi(argv[optind])) <= 0){
+        BENCH_USAGE();
+    }
+    if(opts.num_threads < 1 || (opts.channel && (opts.unix_path == NULL || opts.budget_us != 0)) ||
+        opts.duration <= 0 || opts.rate < 0 || opts.num_keys < 1 || opts.theta < 0 || opts.theta == 1 ||
+        opts.mix[0] + opts.mix[1] + opts.mix[2] == 0 || opts.key_min < MIN_KEY_SIZE ||
+        opts.key_max > MAX_KEY_SIZE || opts.val_min < MIN_VALUE_SIZE){
+        BENCH_USAGE();
+    }
+}
+
+static void report(bench_thread_t *threads){
+    static const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *labels[] = {"p50", "p90", "p99", "p999"};
+    static const stats_op_t kinds[] = {STATS_GET, STATS_PUT, STATS_EVICT};
+    stats_block_t *total = aligned_alloc(STATS_LINE, sizeof(stats_block_t));
+    uint64_t sent = 0, done = 0, errors = 0, busy = 0, expired = 0;
+    double seconds = (stop_ns - start_ns) / 1e9;
+
+    stats_merge(stats, total);
+    for(int i = 0; i < opts.num_threads; i++){
+        sent += threads[i].sent;
+        done += threads[i].done;
+        errors += threads[i].errors;
+        busy += threads[i].busy;
+        expired += threads[i].expired;
+    }
+
+    // "name value" lines, like STATS, so runs can be diffed and parsed
+    printf("mode %s\nthreads %d\nduration_s %.2f\n", opts.rate > 0 ? "open" : "closed", opts.num_threads, seconds);
+    if(opts.rate > 0){
+        printf("target_ops_s %.0f\n", opts.rate);
+    }
+    // requests the server shed are completed, but only the rest is goodput
+    printf("sent %" PRIu64 "\ncompleted %" PRIu64 "\nerrors %" PRIu64 "\nbusy %" PRIu64 "\nexpired %" PRIu64 "\n"
+        "throughput_ops_s %.0f\ngoodput_ops_s %.0f\n", sent, done, errors, busy, expired, done / seconds,
+        (done - busy - expired) / seconds);
+    printf("hits %" PRIu64 "\nmisses %" PRIu64 "\n", total->hits, total->misses);
+    for(int k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++){
+        if(total->latency[kinds[k]].count == 0){
+            continue;
+        }
+        printf("ops_%s %" PRIu64 "\n", stats_op_names[kinds[k]], total->ops[kinds[k]]);
+        for(int i = 0; i < sizeof(fractions) / sizeof(fractions[0]); i++){
+            printf("latency_%s_%s_us %.1f\n", stats_op_names[kinds[k]], labels[i],
+                stats_percentile(&total->latency[kinds[k]], fractions[i]) / 1e3);
+        }
+        printf("latency_%s_max_us %.1f\n", stats_op_names[kinds[k]], total->latency[kinds[k]].max / 1e3);
+    }
+    free(total);
+}
+
+int main(int argc, char *argv[]) {
+    bench_thread_t *threads;
+    uint32_t val_limit;
+
+    parse_bench_args(argc, argv);
+    if(opts.theta > 0){
+        zipf_init(&zipf, opts.num_keys, opts.theta);
+    }
+
+    // every value is a prefix of one pattern
+    val_limit = opts.val_max > MAX_VALUE_SIZE ? opts.val_max : MAX_VALUE_SIZE;
+    if((value_pattern = malloc(val_limit)) == NULL || (stats = create_stats(opts.num_threads)) == NULL ||
+        (threads = calloc(opts.num_threads, sizeof(bench_thread_t))) == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(value_pattern, 'v', val_limit);
+    pthread_barrier_init(&start_line, NULL, opts.num_threads + 1);
+
+    for(int i = 0; i < opts.num_threads; i++){
+        threads[i].index = i;
+        threads[i].rng = scramble(i + 1) | 1;
+        threads[i].stats = stats_block(stats, i);
+        if((threads[i].fd = bench_connect()) < 0){
+            perror("connect");
+            exit(EXIT_FAILURE);
+        }
+        if(opts.channel && (threads[i].chan = bench_channel(threads[i].fd)) == NULL){
+            perror("channel");
+            exit(EXIT_FAILURE);
+        }
+        if(opts.rate > 0){
+            threads[i].due = calloc(BENCH_WINDOW, sizeof(uint64_t));
+            threads[i].kind = calloc(BENCH_WINDOW, sizeof(uint8_t));
+            if(threads[i].due == NULL || threads[i].kind == NULL){
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    for(int i = 0; i < opts.num_threads; i++){
+        pthread_create(&threads[i].thread, NULL, opts.rate > 0 ? open_loop : closed_loop, &threads[i]);
+    }
+
+    // the clock starts once every thread is connected and preloaded
+    pthread_barrier_wait(&start_line);
+    start_ns = now_ns();
+    stop_ns = start_ns + (uint64_t)(opts.duration * 1e9);
+    pthread_barrier_wait(&start_line);
+
+    for(int i = 0; i < opts.num_threads; i++){
+        pthread_join(threads[i].thread, NULL);
+        close(threads[i].fd);
+    }
+    report(threads);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,285 @@
+#include "utils.h"
+#include "queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef EXT
+#define MICRO_IMPL "ext"
+#else
+#define MICRO_IMPL "hashmap"
+#endif
+
+#define MICRO_KEY_SIZE 16
+#define MICRO_MAX_THREADS 64
+
+#define MICRO_USAGE();                                                          \
+fprintf(stderr, "USAGE: %s\n",                                                  \
+"./cream_micro [-h] [-n CAPACITY] [-o OPS] [-t THREADS]\n"                      \
+"-h                 Displays this help menu and returns EXIT_SUCCESS.\n"          \
+"-n CAPACITY        Slots in the maps under test. Defaults to 65536.\n"         \
+"-o OPS             Operations per thread in each run. Defaults to 200000.\n"   \
+"-t THREADS         Most threads to run with; runs double from 1. Defaults to"  \
+" 4.\n");                                                                         \
+exit(EXIT_FAILURE);
+
+typedef struct micro_opts_t {
+    uint32_t capacity;
+    uint64_t ops;
+    int max_threads;
+} micro_opts_t;
+
+typedef enum micro_op_t { MICRO_GET_HIT, MICRO_GET_MISS, MICRO_OVERWRITE, MICRO_CHURN } micro_op_t;
+
+typedef struct micro_run_t {
+    hashmap_t *map;
+    queue_t *queue;
+    micro_op_t op;
+    int index;
+    uint64_t seed;
+    // keys [0, live) are in the map when a run starts
+    uint64_t live, ops;
+} micro_run_t;
+
+micro_opts_t opts;
+// every key the runs use, so the map never owns or frees one
+char *keys;
+uint64_t num_keys;
+char value[MICRO_KEY_SIZE] = "value";
+pthread_barrier_t start_line;
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t next_rand(uint64_t *state){
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static map_key_t key_at(uint64_t i){
+    return MAP_KEY(keys + (i % num_keys) * MICRO_KEY_SIZE, MICRO_KEY_SIZE);
+}
+
+// the map only borrows the runs' keys and values
+static void keep_node(map_key_t key, map_val_t val){
+}
+
+static void emit(const char *name, double value){
+    printf("%s %.1f\n", name, value);
+    fflush(stdout);
+}
+
+static hashmap_t *fill_map(uint64_t count, uint64_t *elapsed){
+    hashmap_t *map = create_map(opts.capacity, jenkins_one_at_a_time_hash, keep_node);
+    uint64_t start = now_ns();
+
+    for(uint64_t i = 0; i < count; i++){
+        put(map, key_at(i), MAP_VAL(value, sizeof(value)), false);
+    }
+    *elapsed = now_ns() - start;
+    return map;
+}
+
+static void *map_worker(void *arg){
+    micro_run_t *run = arg;
+    map_val_t val;
+    uint64_t pick;
+
+    pthread_barrier_wait(&start_line);
+    for(uint64_t i = 0; i < run->ops; i++){
+        pick = next_rand(&run->seed) % run->live;
+        switch(run->op){
+            case MICRO_GET_HIT:
+                val = get(run->map, key_at(pick));
+                free(val.val_base);
+                break;
+            case MICRO_GET_MISS:
+                // keys past the live window were never put
+                val = get(run->map, key_at(run->live + pick));
+                free(val.val_base);
+                break;
+            case MICRO_OVERWRITE:
+                put(run->map, key_at(pick), MAP_VAL(value, sizeof(value)), false);
+                break;
+            case MICRO_CHURN:
+                // retire the oldest key and add a new one, leaving a tombstone
+                delete(run->map, key_at(i));
+                put(run->map, key_at(run->live + i), MAP_VAL(value, sizeof(value)), false);
+                break;
+        }
+    }
+    pthread_barrier_wait(&start_line);
+    return NULL;
+}
+
+// runs op on threads threads and returns the mean nanoseconds per op
+static double run_threads(micro_run_t *proto, int threads, void *(*worker)(void *)){
+    micro_run_t runs[MICRO_MAX_THREADS];
+    pthread_t tids[MICRO_MAX_THREADS];
+    uint64_t start, elapsed;
+
+    pthread_barrier_init(&start_line, NULL, threads + 1);
+    for(int t = 0; t < threads; t++){
+        runs[t] = *proto;
+        runs[t].index = t;
+        runs[t].seed = (t + 1) * 0x9E3779B97F4A7C15ULL;
+        pthread_create(&tids[t], NULL, worker, &runs[t]);
+    }
+    pthread_barrier_wait(&start_line);
+    start = now_ns();
+    pthread_barrier_wait(&start_line);
+    elapsed = now_ns() - start;
+    for(int t = 0; t < threads; t++){
+        pthread_join(tids[t], NULL);
+    }
+    pthread_barrier_destroy(&start_line);
+
+    return (double)elapsed / (proto->ops * threads);
+}
+
+static void bench_map(int load){
+    static const char *names[] = {"get_hit", "get_miss", "overwrite", "churn"};
+    micro_run_t run;
+    uint64_t count = (uint64_t)opts.capacity * load / 100, elapsed;
+    char name[128];
+
+    // each run gets a fresh map, so churn's tombstones don't leak into the next
+    for(int op = MICRO_GET_HIT; op <= MICRO_CHURN; op++){
+        for(int threads = 1; threads <= opts.max_threads; threads *= 2){
+            run = (micro_run_t) {.map = fill_map(count, &elapsed), .op = op, .live = count, .ops = opts.ops};
+            // churn runs until tombstones have taken every free slot, and
+            // is slow enough past that point that a longer run shows nothing
+            if(op == MICRO_CHURN && run.ops > opts.capacity / 4){
+                run.ops = opts.capacity / 4;
+            }
+            if(op == MICRO_GET_HIT && threads == 1){
+                snprintf(name, sizeof(name), "map_%s_fill_load%d_ns", MICRO_IMPL, load);
+                emit(name, count > 0 ? (double)elapsed / count : 0);
+            }
+            // churn writes serialize on the map, so one thread is enough
+            if(op == MICRO_CHURN && threads > 1){
+                invalidate_map(run.map);
+                free(run.map);
+                break;
+            }
+            snprintf(name, sizeof(name), "map_%s_%s_load%d_t%d_ns", MICRO_IMPL, names[op], load, threads);
+            emit(name, run_threads(&run, threads, map_worker));
+            invalidate_map(run.map);
+            free(run.map);
+        }
+    }
+}
+
+static void *producer(void *arg){
+    micro_run_t *run = arg;
+
+    pthread_barrier_wait(&start_line);
+    for(uint64_t i = 0; i < run->ops; i++){
+        enqueue(run->queue, run);
+    }
+    pthread_barrier_wait(&start_line);
+    return NULL;
+}
+
+static void *consumer(void *arg){
+    micro_run_t *run = arg;
+
+    pthread_barrier_wait(&start_line);
+    for(uint64_t i = 0; i < run->ops; i++){
+        dequeue(run->queue);
+    }
+    pthread_barrier_wait(&start_line);
+    return NULL;
+}
+
+static void *queue_pair(void *arg){
+    micro_run_t *run = arg;
+
+    // threads alternate between producing and consuming, so the queue drains
+    return run->index % 2 == 0 ? producer(arg) : consumer(arg);
+}
+
+static void bench_queue(void){
+    micro_run_t run = {.queue = create_queue(), .ops = opts.ops};
+    char name[128];
+
+    for(int threads = 2; threads <= opts.max_threads * 2 && threads <= MICRO_MAX_THREADS; threads *= 2){
+        snprintf(name, sizeof(name), "queue_pairs%d_ns", threads / 2);
+        emit(name, run_threads(&run, threads, queue_pair) * 2);
+    }
+}
+
+static void bench_hash(void){
+    static const uint32_t lengths[] = {8, 16, 64, 256, 1024};
+    char buf[1024], name[128];
+    uint64_t start, rounds = opts.ops;
+    volatile uint32_t sink = 0;
+
+    memset(buf, 'h', sizeof(buf));
+    for(int i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++){
+        start = now_ns();
+        for(uint64_t r = 0; r < rounds; r++){
+            buf[0] = r;
+            sink += jenkins_one_at_a_time_hash(MAP_KEY(buf, lengths[i]));
+        }
+        snprintf(name, sizeof(name), "hash_len%u_ns", lengths[i]);
+        emit(name, (double)(now_ns() - start) / rounds);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static const int loads[] = {50, 75, 90};
+    char name[32];
+    int opt;
+
+    opts = (micro_opts_t) {.capacity = 65536, .ops = 200000, .max_threads = 4};
+    while((opt = getopt(argc, argv, "hn:o:t:")) != -1){
+        switch(opt){
+            case 'n':
+                opts.capacity = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                opts.ops = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                opts.max_threads = atoi(optarg);
+                break;
+            default:
+                MICRO_USAGE();
+        }
+    }
+    if(opts.capacity < 16 || opts.ops < 1 || opts.max_threads < 1 || opts.max_threads > MICRO_MAX_THREADS / 2){
+        MICRO_USAGE();
+    }
+
+    // distinct keys: the live ones, the ones that miss, and churn's supply
+    num_keys = (uint64_t)opts.capacity * 2 + opts.ops;
+    if((keys = malloc(num_keys * MICRO_KEY_SIZE)) == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for(uint64_t i = 0; i < num_keys; i++){
+        snprintf(name, sizeof(name), "key%013lu", i);
+        memcpy(keys + i * MICRO_KEY_SIZE, name, MICRO_KEY_SIZE);
+    }
+
+    // "name value" lines, so runs on two commits can be joined and compared
+    printf("impl %s\ncapacity %u\nops %lu\n", MICRO_IMPL, opts.capacity, opts.ops);
+    for(int i = 0; i < sizeof(loads) / sizeof(loads[0]); i++){
+        bench_map(loads[i]);
+    }
+    bench_queue();
+    bench_hash();
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,207 @@
+#include "trace.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#define TRACE_USAGE();                                                          \
+fprintf(stderr, "USAGE: %s\n",                                                  \
+"./cream_trace [-h] [-r] [-l] TRACE_FILE\n"                                     \
+"-h                 Displays this help menu and returns EXIT_SUCCESS.\n"          \
+"-r                 Print every record in time order instead.\n"                \
+"-l                 Print a line per request with the time spent in each"      \
+" stage instead.\n"                                                               \
+"TRACE_FILE         A file written by cream -R.\n"                              \
+"By default prints percentiles of the time requests spent in each stage.\n");   \
+exit(EXIT_FAILURE);
+
+// the time between two events of a request
+typedef struct trace_stage_t {
+    const char *name;
+    trace_event_t from, to;
+} trace_stage_t;
+
+static const trace_stage_t stages[] = {
+    {"queue", TRACE_ENQUEUE, TRACE_DEQUEUE},
+    {"read", TRACE_DEQUEUE, TRACE_PARSED},
+    {"op", TRACE_PARSED, TRACE_DONE},
+    {"send", TRACE_DONE, TRACE_SENT},
+    {"total", TRACE_ENQUEUE, TRACE_SENT},
+};
+#define NUM_STAGES (sizeof(stages) / sizeof(stages[0]))
+
+static const char *event_names[TRACE_EVENTS] = {"accept", "enqueue", "dequeue", "parsed", "done", "sent", "lost"};
+
+static int by_time(const void *a, const void *b){
+    const trace_record_t *x = a, *y = b;
+
+    return x->ns < y->ns ? -1 : x->ns > y->ns;
+}
+
+static int by_request(const void *a, const void *b){
+    const trace_record_t *x = a, *y = b;
+
+    if(x->conn != y->conn){
+        return x->conn < y->conn ? -1 : 1;
+    }
+    if(x->seq != y->seq){
+        return x->seq < y->seq ? -1 : 1;
+    }
+    return by_time(a, b);
+}
+
+static trace_record_t *load(const char *path, size_t *count){
+    trace_file_header_t header;
+    trace_record_t *records = NULL;
+    size_t cap = 0, n = 0, got;
+    FILE *file;
+
+    if((file = fopen(path, "r")) == NULL){
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)){
+        fprintf(stderr, "%s: not a version %d trace file\n", path, TRACE_VERSION);
+        exit(EXIT_FAILURE);
+    }
+
+    // a trace still being streamed may end in part of a record
+    do {
+        if(n == cap){
+            cap = cap == 0 ? 4096 : cap * 2;
+            if((records = realloc(records, cap * sizeof(trace_record_t))) == NULL){
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        got = fread(records + n, sizeof(trace_record_t), cap - n, file);
+        n += got;
+    } while(n == cap);
+    fclose(file);
+
+    *count = n;
+    return records;
+}
+
+static void print_raw(trace_record_t *records, size_t count){
+    qsort(records, count, sizeof(trace_record_t), by_time);
+    for(size_t i = 0; i < count; i++){
+        printf("%" PRIu64 " %u %s %u %u 0x%02x %u\n", records[i].ns, records[i].thread,
+            records[i].event < TRACE_EVENTS ? event_names[records[i].event] : "?", records[i].conn,
+            records[i].seq, records[i].op, records[i].status);
+    }
+}
+
+static void decode(trace_record_t *records, size_t count, bool lines){
+    static const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *labels[] = {"p50", "p90", "p99", "p999"};
+    stats_hist_t *hists = calloc(NUM_STAGES, sizeof(stats_hist_t));
+    uint64_t at[TRACE_EVENTS], lost = 0, conns = 0, requests = 0, partial = 0;
+    uint8_t op = 0;
+    uint32_t status = 0;
+    size_t start, end;
+    bool complete;
+
+    if(hists == NULL){
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    qsort(records, count, sizeof(trace_record_t), by_request);
+    for(start = 0; start < count; start = end){
+        memset(at, 0, sizeof(at));
+        for(end = start; end < count && records[end].conn == records[start].conn &&
+            records[end].seq == records[start].seq; end++){
+            if(records[end].event == TRACE_LOST){
+                lost += records[end].seq;
+            } else if(records[end].event < TRACE_EVENTS && at[records[end].event] == 0){
+                at[records[end].event] = records[end].ns;
+                if(records[end].event == TRACE_PARSED){
+                    op = records[end].op;
+                } else if(records[end].event == TRACE_DONE){
+                    status = records[end].status;
+                }
+            }
+        }
+        // lost records share the connection 0 group; real ids start at 1
+        if(records[start].conn == 0){
+            continue;
+        }
+        if(records[start].seq == 0){
+            conns += at[TRACE_ACCEPT] != 0;
+            continue;
+        }
+
+        // a request cut off by a lapped ring or the end of the trace only
+        // counts as partial
+        complete = true;
+        for(int e = TRACE_ENQUEUE; e <= TRACE_SENT; e++){
+            complete = complete && at[e] != 0;
+        }
+        if(!complete){
+            partial++;
+            continue;
+        }
+        requests++;
+        if(lines){
+            printf("%u %u 0x%02x %u", records[start].conn, records[start].seq, op, status);
+        }
+        for(int s = 0; s < NUM_STAGES; s++){
+            stats_record(&hists[s], at[stages[s].to] - at[stages[s].from]);
+            if(lines){
+                printf(" %s_ns=%" PRIu64, stages[s].name, at[stages[s].to] - at[stages[s].from]);
+            }
+        }
+        if(lines){
+            printf("\n");
+        }
+    }
+
+    if(!lines){
+        printf("records %zu\nconnections %" PRIu64 "\nrequests %" PRIu64 "\npartial %" PRIu64 "\nlost %" PRIu64 "\n",
+            count, conns, requests, partial, lost);
+        for(int s = 0; s < NUM_STAGES && requests > 0; s++){
+            for(int i = 0; i < sizeof(fractions) / sizeof(fractions[0]); i++){
+                printf("%s_%s_us %.1f\n", stages[s].name, labels[i], stats_percentile(&hists[s], fractions[i]) / 1e3);
+            }
+            printf("%s_max_us %.1f\n", stages[s].name, hists[s].max / 1e3);
+        }
+    }
+    free(hists);
+}
+
+int main(int argc, char *argv[]) {
+    trace_record_t *records;
+    size_t count;
+    bool raw = false, lines = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "hrl")) != -1){
+        switch(opt){
+            case 'r':
+                raw = true;
+                break;
+            case 'l':
+                lines = true;
+                break;
+            default:
+                TRACE_USAGE();
+        }
+    }
+    if(argc - optind != 1){
+        TRACE_USAGE();
+    }
+
+    records = load(argv[optind], &count);
+    if(raw){
+        print_raw(records, count);
+    } else {
+        decode(records, count, lines);
+    }
+    free(records);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,126 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_MAGIC 0x435245414d415245ULL
+#define ARENA_MIN_SHIFT 4
+#define ARENA_CLASSES 40
+#define ARENA_ALIGN 64
+
+// arena flags
+#define ARENA_SHARED 0x01
+#define ARENA_HUGE 0x02
+
+// huge arenas are sized and aligned to this
+#define ARENA_HUGE_PAGE ((size_t)2 << 20)
+
+// what a mapping ended up backed by
+typedef enum arena_pages_t {
+    ARENA_PAGES_SMALL,
+    ARENA_PAGES_HUGETLB,
+    ARENA_PAGES_THP
+} arena_pages_t;
+
+/*
+ * Lives at offset 0 of the segment. Everything in it is an offset from the
+ * start of the segment, so the segment can be mapped at any address.
+ */
+typedef struct arena_header_t {
+    uint64_t magic;
+    uint64_t size;
+    uint64_t used;
+    uint64_t base;
+    uint64_t nodes;
+    uint32_t capacity;
+    uint64_t free_lists[ARENA_CLASSES];
+} arena_header_t;
+
+typedef struct arena_t {
+    char *base;
+    size_t size;
+    int fd;
+    ptrdiff_t delta;
+    arena_pages_t pages;
+    arena_header_t *header;
+    pthread_mutex_t lock;
+    bool detached;
+} arena_t;
+
+/*
+ * Creates a size class allocator over a fresh mapping.
+ *
+ * @param size The size of the mapping in bytes
+ * @param flags ARENA_SHARED backs the arena with a memfd that can be passed
+ *              to another process. ARENA_HUGE rounds the size up to a huge
+ *              page and maps it from the hugetlb pool, falling back to
+ *              transparent huge pages when the pool is empty.
+ * @return A pointer to the new arena_t instance, or NULL on error
+ */
+arena_t *create_arena(size_t size, int flags);
+
+/*
+ * Maps a shared arena handed over by another process. The difference
+ * between the new and the old mapping address is left in delta so that
+ * pointers stored in the segment can be rebased.
+ *
+ * @param fd The memfd of the arena
+ * @return A pointer to the attached arena_t instance, or NULL on error
+ */
+arena_t *attach_arena(int fd);
+
+/*
+ * Faults in every page of the arena with several threads, each writing one
+ * byte per page of its slice back to itself, so later accesses take no page
+ * faults. Nothing else may write the arena meanwhile.
+ *
+ * @param self The arena to prefault
+ * @param threads The number of threads to split the mapping between
+ * @return true if every page was touched, false otherwise
+ */
+bool arena_prefault(arena_t *self, int threads);
+
+/*
+ * Allocates len bytes from the arena.
+ *
+ * @return A pointer to the allocation, or NULL if the arena is full or detached
+ */
+void *arena_alloc(arena_t *self, size_t len);
+
+/*
+ * Allocates len zeroed bytes from the arena.
+ */
+void *arena_calloc(arena_t *self, size_t len);
+
+/*
+ * Returns an allocation to its size class. A no-op once the arena is detached.
+ */
+void arena_free(arena_t *self, void *ptr);
+
+/*
+ * Converts between pointers into the arena and segment offsets.
+ */
+uint64_t arena_offset(arena_t *self, void *ptr);
+void *arena_ptr(arena_t *self, uint64_t offset);
+
+/*
+ * Records the current mapping address in the segment and stops this process
+ * from allocating or freeing, so the segment can be handed to another process.
+ *
+ * @param self The arena to detach
+ * @return true if the arena was successfully detached, false otherwise
+ */
+bool detach_arena(arena_t *self);
+
+/*
+ * Unmaps the arena and frees it.
+ *
+ * @param self The arena to invalidate
+ * @return true if the arena was successfully invalidated, false otherwise
+ */
+bool invalidate_arena(arena_t *self);
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef CHAN_H
+#define CHAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CHAN_MAGIC 0x4e414843
+// the client produces requests and the server responses
+#define CHAN_REQUESTS 0
+#define CHAN_RESPONSES 1
+// checks of a ring before a waiter sleeps on its doorbell
+#define CHAN_SPINS 256
+
+/*
+ * One direction of a channel: a single-producer single-consumer ring of
+ * variable length records, each a uint32_t length, 4 bytes of padding and
+ * the record, rounded up to 8 bytes. A record never wraps; one that doesn't
+ * fit before the end is preceded by a CHAN_WRAP length that skips there.
+ * head and tail count bytes and only grow.
+ *
+ * Each side that runs out of records, or of room, sleeps on a futex: it
+ * sets its waiting flag and sleeps while the bell still holds the value it
+ * read before, and the other side rings the bell when it finds the flag set.
+ */
+typedef struct chan_ring_t {
+    // written by the consumer
+    uint64_t head __attribute__((aligned(64)));
+    uint32_t consumer_waiting;
+    uint32_t space_bell;
+    // written by the producer
+    uint64_t tail __attribute__((aligned(64)));
+    uint32_t producer_waiting;
+    uint32_t data_bell;
+} chan_ring_t;
+
+#define CHAN_WRAP UINT32_MAX
+
+// the start of the shared memory, followed by each ring's data
+typedef struct chan_shm_t {
+    uint32_t magic;
+    uint32_t ring_size;
+    chan_ring_t rings[2];
+} chan_shm_t;
+
+/*
+ * A channel as mapped by one side. The shared memory is a memfd, so the
+ * server can pass the other side its fd over a UNIX socket. Either side
+ * may be hostile to the other, so a record's length is checked against the
+ * ring before it is read.
+ */
+typedef struct chan_t {
+    int fd;
+    chan_shm_t *shm;
+    size_t len;
+    char *data[2];
+    uint64_t mask;
+    // where the record being written goes, the head when there was no room
+    // for it, and the length of the record read
+    uint64_t reserved[2];
+    uint64_t full_head[2];
+    uint32_t peeked[2];
+} chan_t;
+
+/*
+ * Creates a channel in a new memfd.
+ *
+ * @param ring_size Bytes of records each direction holds; a power of two, at
+ *                  least 4096
+ * @return A pointer to the new chan_t instance, or NULL on error
+ */
+chan_t *create_chan(uint32_t ring_size);
+
+/*
+ * Maps a channel another process created.
+ *
+ * @param fd The channel's memfd, which the chan_t takes over
+ * @return A pointer to the new chan_t instance, or NULL on error
+ */
+chan_t *attach_chan(int fd);
+
+/*
+ * Unmaps the channel and closes its fd.
+ *
+ * @param self The channel to invalidate
+ * @return true if successful, false otherwise
+ */
+bool invalidate_chan(chan_t *self);
+
+/*
+ * Finds room for a record at the tail of a ring. Only its producer may call
+ * this, and nothing is sent until chan_commit.
+ *
+ * @param self The channel
+ * @param ring CHAN_REQUESTS or CHAN_RESPONSES
+ * @param len The most bytes the record will hold
+ * @return Where to write the record, or NULL with errno EAGAIN if the ring
+ *         is too full for now, or EMSGSIZE if it never holds len bytes
+ */
+void *chan_reserve(chan_t *self, int ring, uint32_t len);
+
+/*
+ * Sends the reserved record, waking the consumer if it sleeps.
+ *
+ * @param self The channel
+ * @param ring The ring reserved on
+ * @param len The bytes written, up to the length reserved
+ */
+void chan_commit(chan_t *self, int ring, uint32_t len);
+
+/*
+ * Returns the record at the head of a ring without removing it. Only its
+ * consumer may call this.
+ *
+ * @param self The channel
+ * @param ring CHAN_REQUESTS or CHAN_RESPONSES
+ * @param len Where to store the record's length
+ * @return The record, or NULL with errno EAGAIN if the ring is empty or
+ *         EPROTO if the other side wrote a record that doesn't fit
+ */
+void *chan_peek(chan_t *self, int ring, uint32_t *len);
+
+/*
+ * Removes the record chan_peek returned, waking the producer if it sleeps
+ * for room.
+ *
+ * @param self The channel
+ * @param ring The ring peeked at
+ */
+void chan_consume(chan_t *self, int ring);
+
+/*
+ * Waits until a ring has a record for its consumer, or, for its producer,
+ * until the consumer has made room since the last chan_reserve failed.
+ *
+ * @param self The channel
+ * @param ring CHAN_REQUESTS or CHAN_RESPONSES
+ * @param producer true to wait for room, false for a record
+ * @param timeout_ms How long to sleep; -1 waits forever
+ * @return true if there is what was waited for, false on timeout
+ */
+bool chan_wait(chan_t *self, int ring, bool producer, int timeout_ms);
+
+#endif
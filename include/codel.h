@@ -0,0 +1,46 @@
+#ifndef CODEL_H
+#define CODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * CoDel queue delay control, after Nichols and Jacobson. A queue is only
+ * considered overloaded once every item leaving it for a whole interval has
+ * waited longer than target; a short burst that drains on its own is left
+ * alone. While overloaded one item is dropped, then the next after
+ * interval / sqrt(drops so far), so shedding speeds up until the delay
+ * falls back under target.
+ */
+typedef struct codel_t {
+    uint64_t target;
+    uint64_t interval;
+    // when the delay will have been above target for a whole interval
+    uint64_t first_above;
+    uint64_t drop_next;
+    uint32_t count;
+    uint32_t last_count;
+    bool dropping;
+} codel_t;
+
+/*
+ * Resets the controller.
+ *
+ * @param self The controller to initialize
+ * @param target Nanoseconds of queueing delay that are acceptable
+ * @param interval Nanoseconds the delay must stay above target before
+ *                 anything is dropped; about a round trip
+ */
+void codel_init(codel_t *self, uint64_t target, uint64_t interval);
+
+/*
+ * Decides whether an item just taken off the queue should be dropped.
+ *
+ * @param self The controller
+ * @param sojourn Nanoseconds the item waited in the queue
+ * @param now The current CLOCK_MONOTONIC time in nanoseconds
+ * @return true if the item should be dropped, false if it should be served
+ */
+bool codel_drop(codel_t *self, uint64_t sojourn, uint64_t now);
+
+#endif
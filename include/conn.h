@@ -0,0 +1,186 @@
+#ifndef CONN_H
+#define CONN_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "peers.h"
+#include "wheel.h"
+
+// the first size of a connection's input and output buffers
+#define CONN_BUFSIZE 4096
+
+// what a connection is doing, for the timer that closes stalled ones
+typedef enum conn_state_t {
+    // watched for its next frame
+    CONN_IDLE,
+    // queued, or with a worker reading its frame
+    CONN_BUSY
+} conn_state_t;
+
+/*
+ * A client connection shared by the event loop and the workers serving its
+ * requests. Every holder keeps a reference; the socket is closed when the
+ * last one is released. Responses are written under write_lock, so frames
+ * from concurrent workers never interleave.
+ */
+typedef struct conn_t {
+    int fd;
+    int refs;
+    // names the connection's requests in traces; frames counts those queued
+    uint32_t id;
+    uint32_t frames;
+    // accepted on the UNIX socket, so fds can be passed over it
+    bool local;
+    pthread_mutex_t write_lock;
+    // the rest is only used when the server times connections out. the
+    // timer and dropped are guarded by the server's lock; state, idle_since
+    // and the deadlines are stored by whichever thread is serving the
+    // connection and only read by the timer, which rechecks them at least
+    // every io_ms, so they never have to move it
+    wheel_timer_t timer;
+    bool dropped;
+    int state;
+    uint32_t io_ms;
+    uint64_t idle_since;
+    uint64_t read_deadline;
+    uint64_t write_deadline;
+    uint8_t peer[PEERS_ADDR_LEN];
+    // shard mode serves the socket without blocking: the bytes of frames
+    // not yet whole wait in in, and responses the socket hasn't taken in
+    // out. awaiting is set while a version 1 frame is answered, which holds
+    // back the frames after it, and events is what epoll watches for
+    char *in;
+    char *out;
+    size_t in_len, in_cap;
+    size_t out_len, out_cap;
+    bool awaiting;
+    uint32_t events;
+} conn_t;
+
+/*
+ * The clock connection deadlines are kept on, in milliseconds. The coarse
+ * clock is read without a system call and is good to a few milliseconds.
+ *
+ * @return Milliseconds since an arbitrary point
+ */
+static inline uint64_t conn_clock(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Starts or clears one of the connection's deadlines, io_ms from now.
+ *
+ * @param self The connection
+ * @param deadline &self->read_deadline or &self->write_deadline
+ * @param start true to start it, false to clear it
+ */
+static inline void conn_deadline(conn_t *self, uint64_t *deadline, bool start) {
+    if(self->io_ms != 0){
+        __atomic_store_n(deadline, start ? conn_clock() + self->io_ms : 0, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Wraps a connected socket. The caller holds the only reference.
+ *
+ * @param fd The socket
+ * @return A pointer to the new conn_t instance, or NULL on error
+ */
+conn_t *create_conn(int fd);
+
+/*
+ * Takes another reference to the connection.
+ *
+ * @param self The connection
+ */
+void conn_hold(conn_t *self);
+
+/*
+ * Drops a reference, closing the socket and freeing the connection when it
+ * was the last one.
+ *
+ * @param self The connection
+ */
+void conn_release(conn_t *self);
+
+/*
+ * Reads exactly len bytes, retrying on EINTR and short reads.
+ *
+ * @param self The connection to read from
+ * @param buf Where to store the bytes
+ * @param len The number of bytes to read
+ * @return true if len bytes were read, false on EOF or error
+ */
+bool conn_read(conn_t *self, void *buf, size_t len);
+
+/*
+ * Reads whatever the socket holds into the input buffer without blocking,
+ * growing the buffer up to max bytes. What doesn't fit is left unread.
+ *
+ * @param self The connection to read from
+ * @param max The most the input buffer may hold
+ * @return false on EOF or error, true otherwise
+ */
+bool conn_fill(conn_t *self, size_t max);
+
+/*
+ * Discards the first len bytes of the input buffer.
+ *
+ * @param self The connection
+ * @param len The number of bytes parsed
+ */
+void conn_consume(conn_t *self, size_t len);
+
+/*
+ * Appends a frame to the output buffer for conn_flush to write.
+ *
+ * @param self The connection
+ * @param iov The buffers to queue
+ * @param iovcnt The number of buffers
+ * @return true if the frame was queued, false if out of memory
+ */
+bool conn_queue(conn_t *self, struct iovec *iov, int iovcnt);
+
+/*
+ * Writes as much of the output buffer as the socket takes without
+ * blocking. The write deadline runs while bytes are left and restarts
+ * whenever some are written.
+ *
+ * @param self The connection to write to
+ * @return false on error, true otherwise
+ */
+bool conn_flush(conn_t *self);
+
+/*
+ * Writes every byte described by iov as one frame, resuming after short
+ * writes. iov is modified. The write deadline runs while the frame is
+ * being written.
+ *
+ * @param self The connection to write to
+ * @param iov The buffers to send
+ * @param iovcnt The number of buffers
+ * @return true if the frame was sent, false otherwise
+ */
+bool conn_send(conn_t *self, struct iovec *iov, int iovcnt);
+
+/*
+ * Writes a frame like conn_send, passing a duplicate of fd along with its
+ * first byte. Only a UNIX socket carries fds.
+ *
+ * @param self The connection to write to
+ * @param iov The buffers to send
+ * @param iovcnt The number of buffers
+ * @param fd The fd to pass, or -1 for none
+ * @return true if the frame was sent, false otherwise
+ */
+bool conn_sendfd(conn_t *self, struct iovec *iov, int iovcnt, int fd);
+
+#endif
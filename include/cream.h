@@ -5,22 +5,143 @@
 #define MIN_KEY_SIZE 1
 #define MAX_KEY_SIZE  2048
 
+// the default limit of a PUT value, raised with -V. batch values must fit
+// in one message and stay bound by it
 #define MIN_VALUE_SIZE 1
 #define MAX_VALUE_SIZE 4096
 
+#define MAX_BATCH_KEYS 256
+
 typedef struct request_header_t {
     uint8_t request_code;
     uint32_t key_size;
     uint32_t value_size;
 } __attribute__((packed)) request_header_t;
 
-typedef enum request_codes { PUT = 0x01, GET = 0x02, EVICT = 0x04, CLEAR = 0x08 } request_codes;
+typedef enum request_codes { PUT = 0x01, GET = 0x02, EVICT = 0x04, CLEAR = 0x08,
+    MGET = 0x10, MPUT = 0x11, MDEL = 0x12,
+    INCR = 0x20, DECR = 0x21, APPEND = 0x22, PREPEND = 0x23,
+    GETS = 0x30, CAS = 0x31, LGET = 0x40, LPUT = 0x41, STATS = 0x50, CHANNEL = 0x60 } request_codes;
+
+/*
+ * INCR and DECR carry a uint64_t delta as their value and apply it to a value
+ * stored as a decimal number. DECR stops at 0 and INCR wraps at 2^64. The
+ * response carries the new number as a uint64_t. APPEND and PREPEND add their
+ * value to the end or start of the stored value. All four apply atomically,
+ * and answer NOT_FOUND if the key is not in the store.
+ */
+#define COUNTER_DIGITS 20
+
+/*
+ * Every write gives an entry a new uint64_t version. GETS answers with the
+ * version followed by the value. CAS carries the expected version followed by
+ * the new value, and only stores it if the entry still has that version. It
+ * answers with the new version, or CONFLICT and the current one.
+ */
+
+/*
+ * Batch requests (MGET, MPUT, MDEL) carry the number of entries in key_size
+ * and the length of the body in value_size. Each entry in the body is a
+ * batch_entry_t followed by its key and, for MPUT, its value. The response
+ * body holds a response_header_t per entry, followed by the value for MGET.
+ */
+typedef struct batch_entry_t {
+    uint32_t key_size;
+    uint32_t value_size;
+} __attribute__((packed)) batch_entry_t;
+
+/*
+ * LGET answers a hit like GET. The first miss on a key answers NOT_FOUND with
+ * a uint64_t lease token, and further misses answer RETRY until the lease is
+ * released or expires. LPUT carries the token followed by the value, and is
+ * only stored while the token still holds the lease and the key is still
+ * missing. It answers CONFLICT otherwise. Every other write of a key, and
+ * CLEAR, revokes its lease.
+ */
+
+/*
+ * STATS answers with the server's counters as text, one "name value" line
+ * each: requests per type, hits and misses, connections, the number and size
+ * of entries, evictions and expirations, map probe lengths and per-type
+ * latency percentiles in nanoseconds.
+ */
+
+/*
+ * CHANNEL, sent on a connection to the server's UNIX socket, answers OK with
+ * the fd of a new shared memory channel (chan.h) passed alongside as
+ * SCM_RIGHTS, or BUSY if the server has as many as it serves. The client
+ * maps it with attach_chan and produces on CHAN_REQUESTS one request per
+ * record, a request_header_t followed by its body as on a socket. Each is
+ * answered in order on CHAN_RESPONSES by a response_header_t and its body.
+ * GET, PUT, EVICT, CLEAR, MGET, MPUT, MDEL and STATS are served. The channel
+ * is torn down when the connection is closed, and nothing else is read from
+ * the connection.
+ */
 
 typedef struct response_header_t {
     uint32_t response_code;
     uint32_t value_size;
 } __attribute__((packed)) response_header_t;
 
-typedef enum response_codes { OK = 200, UNSUPPORTED = 220, BAD_REQUEST = 400, NOT_FOUND = 404 } response_codes;
+/*
+ * Version 2 frames start with PROTOCOL_V2 where a version 1 frame has its
+ * request code, so both can be served on the same port. request_id is opaque
+ * to the server and echoed in the response, which lets a client keep many
+ * requests in flight on one connection and match responses that come back
+ * out of order. A version 1 connection gets its responses in request order.
+ */
+#define PROTOCOL_V2 0xC2
+
+typedef struct request_header_v2_t {
+    uint8_t magic;
+    uint8_t request_code;
+    uint16_t flags;
+    uint32_t request_id;
+    uint32_t key_size;
+    uint32_t value_size;
+} __attribute__((packed)) request_header_v2_t;
+
+typedef struct response_header_v2_t {
+    uint8_t magic;
+    uint8_t reserved;
+    uint16_t flags;
+    uint32_t request_id;
+    uint32_t response_code;
+    uint32_t value_size;
+} __attribute__((packed)) response_header_v2_t;
+
+/*
+ * Request flags. NOREPLY suppresses the response unless the request fails.
+ * DEADLINE means the header is followed by a uint32_t budget in
+ * microseconds, before the key, counted from when the server sees the frame
+ * arrive. A request still waiting for a worker when its budget runs out is
+ * answered TIMEOUT without touching the store; 0 is no deadline.
+ */
+typedef enum request_flags { FLAG_NOREPLY = 0x0001, FLAG_DEADLINE = 0x0002 } request_flags;
+
+/*
+ * A server started with -u also takes GET and MGET in UDP datagrams on its
+ * port. Each datagram holds one version 2 frame without flags, and is
+ * answered by one datagram holding the version 2 response, or TOO_LARGE with
+ * no body if the request or the response doesn't fit in UDP_DATAGRAM_MAX
+ * bytes, or the response is more than UDP_AMPLIFY times the size of the
+ * request; those are asked again over TCP. Bytes after a GET's key or an
+ * MGET's entries are padding, ignored but counted in the request's size, so
+ * a client expecting a large value pads its request to be allowed it. The
+ * cap keeps a forged source address from turning the server into an
+ * amplifier, but UDP is still unauthenticated, so the port belongs on
+ * trusted networks only. Nothing is resent, so a client that hears nothing
+ * back treats the request as a miss.
+ */
+#define UDP_DATAGRAM_MAX 1472
+#define UDP_AMPLIFY 4
+
+/*
+ * BUSY answers a request the server shed without running it, because its
+ * request queue was full or requests had waited in it too long, or a UDP
+ * request that came in as the server handed its store over. The request can
+ * be sent again after backing off.
+ */
+typedef enum response_codes { OK = 200, UNSUPPORTED = 220, BAD_REQUEST = 400, NOT_FOUND = 404, CONFLICT = 409, TOO_LARGE = 413, RETRY = 425, SERVER_ERROR = 500, BUSY = 503, TIMEOUT = 504 } response_codes;
 
 #endif
@@ -2,6 +2,7 @@
 #define CREAM_ADD_H
 
 #define LISTENQ 40
+#define CREAM_EVENTS 64
 #define CMSGSIZE MAX_KEY_SIZE + MAX_VALUE_SIZE + sizeof(request_header_t)
 #define DBGON 0
 #define DBGPRINT(x); if(DBGON){ printf(x); }
@@ -12,7 +13,55 @@
 #include "cream.h"
 #include "queue.h"
 #include "utils.h"
+#include "conn.h"
+#include "stats.h"
+#include "lockstat.h"
+#include "trace.h"
+#include "ring.h"
+#include "lanes.h"
+#include "wheel.h"
+#include "peers.h"
+#include "chan.h"
+#include "tier.h"
 #include <sys/time.h>
+#include <sys/uio.h>
+
+#define STORE_DEFAULT_MB 256
+#define TIER_DEFAULT_MB 1024
+#define LEASE_DEFAULT_MS 2000
+#define LEASE_SLOTS 4096
+// the worker pool grows by one worker per tick while the oldest queued
+// connection has waited WAIT_MS, and a worker idle for IDLE_MS retires
+#define POOL_TICK_MS 5
+#define POOL_WAIT_DEFAULT_MS 10
+#define POOL_IDLE_DEFAULT_MS 10000
+// how long the queueing delay must stay above -C TARGET_MS before requests
+// are shed
+#define CODEL_INTERVAL_MS 100
+
+// with -P or -K, frames are queued for a worker on a lane by request type
+typedef enum cream_lane_t { LANE_READ, LANE_WRITE, LANE_ADMIN, CREAM_LANES } cream_lane_t;
+#define LANE_WEIGHTS_DEFAULT {8, 2, 1}
+// connections are timed on a wheel of 10 ms ticks that turns every ~10 s. a
+// frame, or a response, that takes over IO_MS to cross the socket gets its
+// connection shut down
+#define CONN_WHEEL_SLOTS 1024
+#define CONN_WHEEL_TICK_MS 10
+#define CONN_IO_DEFAULT_MS 5000
+// distinct client addresses -m can count at once, over 3/4
+#define CONN_PEERS_SLOTS (1 << 16)
+// shared memory channels served at once over -U, each by its own thread,
+// and how often an idle one checks that its client is still connected
+#define CHAN_MAX 8
+#define CHAN_POLL_MS 100
+// bytes of records each way; an MGET of MAX_BATCH_KEYS 4 KB values fits
+#define CHAN_RING_SIZE (4 << 20)
+// datagrams -u takes in, and answers, per recvmmsg and sendmmsg
+#define UDP_BATCH 32
+// the largest STATS response
+#define STATS_BUFSIZE (64 * 1024)
+// PUT values are read into their final allocation, so only this bounds them
+#define MAX_VALUE_LIMIT_KB (1024 * 1024)
 
 #define CREAMTTL (struct timeval) {.tv_sec = 2, .tv_usec = 500}
 
@@ -31,6 +80,134 @@ struct cmsg{
 
 typedef struct cmsg cmsg;
 
+// the state an INCR, DECR, APPEND or PREPEND carries into the map's updater
+typedef struct cream_update_t {
+    uint8_t op;
+    map_val_t operand;
+    uint64_t counter;
+    uint64_t lsn;
+    uint32_t code;
+} cream_update_t;
+
+// an entry a forced put pushed out, with room reserved for it in the tier,
+// written there once the map is unlocked
+typedef struct cream_spill_t {
+    map_key_t key;
+    map_val_t val;
+    tier_stub_t stub;
+} cream_spill_t;
+
+typedef struct cream_opts_t {
+    int num_workers;
+    int port;
+    int hash_size;
+    char *journal_path;
+    int sync_interval;
+    char *restart_path;
+    int store_size;
+    char *tier_path;
+    int tier_size;
+    int max_value_kb;
+    int lease_ms;
+    char *trace_path;
+    int trace_interval;
+    bool sharded;
+    bool huge;
+    // -W, -Q, -I: the pool runs NUM_WORKERS to max_workers workers
+    int max_workers;
+    int pool_wait_ms;
+    int pool_idle_ms;
+    // -B, -C: shed requests when the queue is full or stays slow
+    int queue_max;
+    int codel_target_ms;
+    // -P, -K: lanes, and the first reserved_workers only serve LANE_READ
+    bool lanes;
+    int lane_weights[CREAM_LANES];
+    int reserved_workers;
+    // -i, -o, -m: close idle and stalled connections, and cap those per
+    // address. conn_io_ms is -1 until it is set or defaulted
+    int conn_idle_ms;
+    int conn_io_ms;
+    int conn_per_ip;
+    // -U: also listen on a UNIX socket, which can hand out channels
+    char *unix_path;
+    // -u: also answer GET and MGET over UDP on the port
+    bool udp;
+    // -A: worker i runs on cpus[i % num_cpus]
+    int *cpus;
+    int num_cpus;
+} cream_opts_t;
+
+// a shared memory channel and the connection it was asked for on, served by
+// the thread in channel slot slot
+typedef struct cream_chan_t {
+    chan_t *chan;
+    conn_t *conn;
+    int slot;
+    // the request being served, copied out of the ring except a PUT value
+    char body[CMSGSIZE];
+} cream_chan_t;
+
+// requests a shard can have in flight to each other shard before they back up
+#define SHARD_RING_SIZE 4096
+// unsent responses a shard buffers for one connection before it stops
+// reading that connection's frames
+#define SHARD_OUT_MAX (1 << 20)
+
+/*
+ * A request passed between shards in shared-nothing mode (-S). The shard that
+ * read it sends it to the shard owning the key, which runs it against its
+ * partition and sends it back to be answered. The request body is kept in
+ * body; a CLEAR sends a child message to every other shard.
+ */
+typedef struct cream_shard_msg_t {
+    conn_t *conn;
+    int origin;
+    bool v2;
+    uint32_t request_id;
+    uint16_t flags;
+    uint8_t code;
+    uint32_t key_size;
+    map_val_t val;
+    uint32_t response_code;
+    struct timespec started;
+    // the deadline, counted from started; 0 for none
+    uint32_t budget_us;
+    // a CLEAR counts the shards yet to reply, and its children point back
+    int pending;
+    struct cream_shard_msg_t *parent;
+    // the next message waiting for room in the same ring
+    struct cream_shard_msg_t *next;
+    char body[];
+} cream_shard_msg_t;
+
+/*
+ * A thread that owns a partition of the store, the connections it accepts
+ * on its own listening socket, and the receiving end of a ring from every
+ * other shard. Nothing in it is touched by another thread.
+ */
+typedef struct cream_shard_t {
+    int index;
+    int epoll_fd;
+    int listen_fd;
+    // other shards write to it after filling one of this shard's rings
+    int wake_fd;
+    hashmap_t *map;
+    // per destination: messages that found its ring full, and whether it has
+    // been sent anything since it was last woken
+    cream_shard_msg_t **backlog;
+    cream_shard_msg_t **backlog_tail;
+    bool *wake;
+    // times this shard's connections out under -i or -o; NULL otherwise
+    wheel_t *wheel;
+} cream_shard_t;
+
+// the calling thread's trace ring, NULL unless tracing, so an untraced
+// server pays one branch per event
+extern __thread trace_ring_t *trace_local;
+#define TRACE(event, conn, seq, op, status)                                     \
+    do { if(trace_local != NULL){ trace_record(trace_local, event, conn, seq, op, status); } } while(0)
+
 // hashmap helper methods
 bool nullcheck_map(hashmap_t *self);
 bool keycmp(map_key_t keyA, map_key_t keyB);
@@ -40,15 +217,150 @@ void remfromputlist(hashmap_t *self, int index);
 int addtoputlist(hashmap_t *self, int index);
 
 // cream server helper methods
-void parseargs(int argc, char *argv[], int *num_workers, int *port, int *hash_size);
-void creamsockinit(int *sockfd, int port);
+void parseargs(int argc, char *argv[], cream_opts_t *opts);
+void creamsockinit(int *sockfd, int port, bool shared);
 void creamworker(void *arg);
+bool creamspawn(long index);
+bool creamretire(long index);
+void creampool(void *arg);
+void creamshed(void *arg);
+int creamlane(conn_t *conn);
+bool creamparsecpus(const char *list, cream_opts_t *opts);
+void creamplace(long index, hashmap_t *map, long share, long shares);
+void creamprefault(void *base, size_t len);
+void creamshardinit(cream_opts_t *opts);
+void creamshard(void *arg);
+void creamshardaccept(cream_shard_t *self);
+void creamsharddrop(cream_shard_t *self, conn_t *conn);
+bool creamshardread(cream_shard_t *self, conn_t *conn);
+bool creamsharddispatch(cream_shard_t *self, conn_t *conn);
+void creamshardwatch(cream_shard_t *self, conn_t *conn);
+void creamshardanswer(cream_shard_t *self, cream_shard_msg_t *msg);
+void creamshardtimeouts(cream_shard_t *self);
+void creamshardroute(cream_shard_t *self, cream_shard_msg_t *msg, int dest);
+void creamshardpoll(cream_shard_t *self);
+void creamshardexec(cream_shard_t *self, cream_shard_msg_t *msg);
+void creamshardreply(cream_shard_t *self, cream_shard_msg_t *msg);
+int creamshardof(map_key_t key);
 void destroymapnode(map_key_t key, map_val_t val);
+void creamaccept(int fd, bool local);
+void creamunixinit(int *sockfd, const char *path);
+void creamudpinit(int *sockfd, int port);
+void creamudp(void *arg);
+uint32_t creamudpserve(char *datagram, uint32_t len, bool truncated, char *out);
+uint32_t creamudpshed(char *datagram, uint32_t len, char *out);
+uint32_t creamget(map_key_t key, map_val_t *val);
+uint32_t creamchannelopen(conn_t *conn, int *chanfd);
+void creamchannel(void *arg);
+bool creamchannelserve(cream_chan_t *self, char *record, uint32_t len);
+uint32_t creamchannelexec(cream_chan_t *self, request_header_t *header, char *body, uint32_t bodylen,
+    char **outbody, uint32_t *outlen);
+void creamchannelclose(cream_chan_t *self);
+bool creamconnected(conn_t *conn);
+bool creamwatch(conn_t *conn, int op);
+void creamdrop(conn_t *conn);
+void creamclose(conn_t *conn);
+bool creamadmit(conn_t *conn, struct sockaddr *addr);
+uint64_t creamnextcheck(conn_t *conn, uint64_t now);
+void creamtimeouts(void);
+bool creamreadvalue(conn_t *conn, uint32_t len, map_val_t *val);
+bool creamreadheader(conn_t *conn, request_header_t *header, bool *v2, uint32_t *request_id, uint16_t *flags,
+    uint32_t *budget_us);
+size_t creamparseheader(char *buf, size_t len, request_header_t *header, bool *v2, uint32_t *request_id,
+    uint16_t *flags, uint32_t *budget_us);
+bool creamexpired(struct timespec *since, uint32_t budget_us);
+uint32_t creambatch(request_header_t *header, char *body, char **outbody, uint32_t *outlen);
+uint32_t creamput(map_key_t key, map_val_t val);
+void creamputmany(map_key_t *keys, map_val_t *vals, uint32_t *codes, int count);
+uint32_t creamevict(map_key_t key);
+uint32_t creamevictmany(map_key_t *keys, int count);
+uint32_t creamcas(map_key_t key, map_val_t val, uint64_t *version);
+uint32_t creamlput(map_key_t key, map_val_t val, uint64_t token);
+bool creamleased(map_key_t key, void *arg);
+uint32_t creamupdate(uint8_t op, map_key_t key, map_val_t operand, uint64_t *counter);
+bool creamapply(map_key_t key, map_val_t *val, void *arg);
+uint32_t creamclear(void);
+stats_op_t creamstatsop(uint8_t request_code);
+uint32_t creamstats(char **outbody, uint32_t *outlen);
+void creamdump(void);
+void creamreplay(uint8_t op, map_key_t key, map_val_t val);
+void *creamalloc(size_t len);
+void creamfree(void *ptr);
+void creamspill(map_key_t key, map_val_t val);
+bool creampromote(map_key_t key);
+bool creamspilled(map_key_t key, void *arg);
+void creamspillflush(void);
+void creamforget(map_key_t key);
+bool creamstoreinit(cream_opts_t *opts);
+void creamhugeinit(cream_opts_t *opts);
+void creamstoreprefault(int threads);
+void creamhandover(void *arg);
 
 #define USAGE();                                                                \
 fprintf(stderr, "USAGE: %s\n",                                                  \
-"./cream [-h] NUM_WORKERS PORT_NUMBER MAX_ENTRIES\n"                            \
+"./cream [-h] [-j JOURNAL] [-s SYNC_MS] [-r CONTROL] [-M STORE_MB]"            \
+" [-t TIER_FILE] [-T TIER_MB] [-V VALUE_KB] [-L LEASE_MS] [-R TRACE_FILE]"   \
+" [-F FLUSH_MS] [-S] [-A CPUS] [-H] [-W MAX_WORKERS] [-Q WAIT_MS] [-I IDLE_MS]"  \
+" [-B QUEUE_MAX] [-C TARGET_MS] [-P READ:WRITE:ADMIN] [-K RESERVED]"          \
+" [-i CONN_IDLE_MS] [-o IO_MS] [-m PER_IP] [-U SOCKET] [-u] NUM_WORKERS"          \
+" PORT_NUMBER MAX_ENTRIES\n"                                                      \
 "-h                 Displays this help menu and returns EXIT_SUCCESS.\n"          \
+"-j JOURNAL         Log PUT/EVICT/CLEAR requests to JOURNAL and replay it on"   \
+" startup.\n"                                                                     \
+"-s SYNC_MS         Milliseconds the journal batches requests before each"      \
+" fdatasync. Defaults to 0.\n"                                                    \
+"-r CONTROL         Keep the store in shared memory and hand it, with the"     \
+" listening socket, to the next server started with the same CONTROL socket.\n" \
+"-M STORE_MB        Size of the shared memory store. Defaults to 256.\n"        \
+"-t TIER_FILE       Spill evicted values to TIER_FILE and serve them from"      \
+" there until they are overwritten.\n"                                            \
+"-T TIER_MB         Size the tier file is preallocated to. Defaults to 1024.\n"  \
+"-V VALUE_KB        Largest value a PUT may carry. Defaults to 4.\n"           \
+"-L LEASE_MS        How long a miss lease from LGET lasts. Defaults to 2000.\n"  \
+"-R TRACE_FILE      Timestamp every request at each stage into per-thread"     \
+" rings, written to TRACE_FILE on SIGUSR1.\n"                                    \
+"-F FLUSH_MS        Stream the rings to TRACE_FILE every FLUSH_MS instead."      \
+" Defaults to 0, only on SIGUSR1.\n"                                             \
+"-S                 Shared-nothing: each worker owns a partition of the store"  \
+" and the connections it accepts, and forwards requests for other partitions"  \
+" to their owner. Serves GET, PUT, EVICT, CLEAR and STATS, without -j, -r, -t" \
+" or -R.\n"                                                                      \
+"-A CPUS            Pin worker i to the i-th CPU of CPUS, a list such as"      \
+" 0-3,8-11, wrapping around. Each worker first touches its share of the node"  \
+" table, or its shard's whole partition, so the pages land on its NUMA node.\n" \
+"-H                 Keep the node table and values in a STORE_MB store of huge"  \
+" pages, faulted in by NUM_WORKERS threads before serving. Not with -S.\n"      \
+"-W MAX_WORKERS     Add workers, up to MAX_WORKERS, while connections wait for"  \
+" one, and retire idle ones down to NUM_WORKERS. Defaults to NUM_WORKERS. Not"   \
+" with -S.\n"                                                                    \
+"-Q WAIT_MS         How long the oldest queued connection waits before a worker" \
+" is added. Defaults to 10.\n"                                                   \
+"-I IDLE_MS         How long a worker above NUM_WORKERS waits for work before it" \
+" retires. Defaults to 10000.\n"                                                 \
+"-B QUEUE_MAX       Queue at most QUEUE_MAX connections for a worker, and"     \
+" answer frames that find the queue full with BUSY. Not with -S.\n"             \
+"-C TARGET_MS       Answer requests BUSY, at a rising rate, while every request" \
+" for 100 ms has waited over TARGET_MS in the queue. Not with -S.\n"            \
+"-P READ:WRITE:ADMIN Queue GETs, writes, and CLEAR and STATS on separate lanes," \
+" and have workers take up to this many frames from each lane in turn. Defaults" \
+" to 8:2:1 with -K. -B then bounds each lane. Not with -S.\n"                    \
+"-K RESERVED        Keep RESERVED of the NUM_WORKERS workers for the GET lane"   \
+" only. Not with -S.\n"                                                         \
+"-i CONN_IDLE_MS    Close connections that send nothing for CONN_IDLE_MS."      \
+" Defaults to 0, never.\n"                                                       \
+"-o IO_MS           Shut down connections that take over IO_MS to send a"       \
+" frame, once it has started, or to take in a response. Defaults to 5000; 0"     \
+" waits forever.\n"                                                              \
+"-m PER_IP          Refuse connections from an address that already has PER_IP" \
+" open. Not with -S.\n"                                                          \
+"-U SOCKET          Also listen on the UNIX socket SOCKET, where up to 8"     \
+" clients at a time can ask for a shared memory channel with CHANNEL. Not with" \
+" -S.\n"                                                                         \
+"-u                 Also answer GET and MGET sent in UDP datagrams to"           \
+" PORT_NUMBER, taking in and answering up to 32 at a time. Not with -S."          \
+" Responses over 4 times the size of their request are refused; a client pads"  \
+" its request after the key to be allowed a larger one. UDP"                      \
+" sources are unchecked: do not expose the port beyond trusted networks.\n"      \
 "NUM_WORKERS        The number of worker threads used to service requests.\n"     \
 "PORT_NUMBER        Port number to listen on for incoming connections.\n"         \
 "MAX_ENTRIES        The maximum number of entries that can be stored in"        \
@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "lockstat.h"
 #include <sys/time.h>
 #include "const.h"
 
@@ -22,12 +23,17 @@ typedef struct map_val_t {
 
 typedef uint32_t (*hash_func_f)(map_key_t);
 typedef void (*destructor_f)(map_key_t, map_val_t);
+typedef void (*iterator_f)(map_key_t, map_val_t, void *);
+typedef bool (*updater_f)(map_key_t, map_val_t *, void *);
+typedef void (*forget_f)(map_key_t);
+typedef bool (*check_f)(map_key_t, void *);
 
 typedef struct map_node_t {
     map_key_t key;
     map_val_t val;
     int prev, next;
     bool tombstone;
+    uint64_t version;
 } map_node_t;
 
 typedef struct hashmap_t {
@@ -37,12 +43,35 @@ typedef struct hashmap_t {
     int oldest, newest;
     hash_func_f hash_function;
     destructor_f destroy_function;
+    destructor_f evict_function;
+    // told, with the write lock held, of each key a put or delete is about to
+    // change, and of a clear with an empty key, so copies of entries kept
+    // outside the map change with them
+    forget_f forget_function;
     int num_readers;
-    pthread_mutex_t write_lock;
+    // a semaphore rather than a mutex: the last reader out releases the
+    // lock the first reader in took, usually from another thread
+    sem_t write_lock;
     pthread_mutex_t fields_lock;
+    lockstat_t write_stat;
+    lockstat_t fields_stat;
+    // the version given to the latest write
+    uint64_t version;
+    // key and value bytes held by live entries, and entries pushed out
+    // by forced puts or by expiring
+    uint64_t bytes;
+    uint64_t evictions;
+    uint64_t expirations;
+    bool shared_nodes;
     bool invalid;
 } hashmap_t;
 
+/*
+ * Slots the calling thread examined in its last lookup or insert; read by
+ * the server's statistics.
+ */
+extern __thread uint32_t map_probes;
+
 /* 
  * Create a new hash map.
  *
@@ -54,12 +83,27 @@ typedef struct hashmap_t {
  */
 hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function);
 
+/*
+ * Create a hash map over a node array owned by the caller, such as one in a
+ * shared memory segment. Live entries already in the array are kept.
+ *
+ * @param capacity The number of nodes in the array.
+ * @param nodes The node array.
+ * @param hash_function The function to be used to hash keys.
+ * @param destroy_function The function to be used to destroy elements.
+ * @return A pointer to the new hashmap_t instance.
+ */
+hashmap_t *create_map_over(uint32_t capacity, map_node_t *nodes, hash_func_f hash_function, destructor_f destroy_function);
+
 /*
  * Insert a new key/value pair into the map.
  * If the key already exists, the corresponding value is overwritten.
  * If the map is full and force is false, nothing is inserted.
  * If the map is full and force is true, the entry at the index computed by
  * get_index() is overwritten.
+ * An overwritten entry is passed to evict_function when one is set, which
+ * then owns it, and to destroy_function otherwise. Both run with the write
+ * lock held.
  *
  * @param self The hash map to use
  * @param key The key to insert
@@ -69,6 +113,20 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
  */
 bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force);
 
+/*
+ * Insert several key/value pairs under a single acquisition of the write
+ * lock. Each pair is inserted as put() would insert it.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to insert
+ * @param vals The values to insert
+ * @param added Set to whether each pair was inserted
+ * @param count The number of pairs
+ * @param force Whether or not entries should be overwritten if the map is full.
+ * @return true if the batch was attempted, false if the map is invalid.
+ */
+bool put_many(hashmap_t *self, map_key_t *keys, map_val_t *vals, bool *added, int count, bool force);
+
 /*
  * Retrieve the value associated with a key.
  *
@@ -80,14 +138,93 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force);
 map_val_t get(hashmap_t *self, map_key_t key);
 
 /*
- * Remove the entry associated with a key.
+ * Retrieve the value associated with a key and its version. Every write of a
+ * key gives it a new version, larger than any given before.
+ *
+ * @param self The hash map to use
+ * @param key The key to search for
+ * @param version Set to the version of the entry, or 0 if it is not found
+ * @return The corresponding value, as get() would return it
+ */
+map_val_t get_versioned(hashmap_t *self, map_key_t key, uint64_t *version);
+
+/*
+ * Retrieve the values of several keys while registered as a reader once.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to search for
+ * @param vals Set to each value, as get() would return it
+ * @param count The number of keys
+ * @return true if the batch was attempted, false if the map is invalid.
+ */
+bool get_many(hashmap_t *self, map_key_t *keys, map_val_t *vals, int count);
+
+/*
+ * Modify the value of a key in place. updater runs with the write lock held,
+ * so nothing else reads or writes the map between its read of the value and
+ * its write. It may replace *val, and then owns the old value.
+ *
+ * @param self The hash map to use
+ * @param key The key whose value is modified
+ * @param updater Called with the key and a pointer to its value
+ * @param arg Passed through to updater
+ * @return true if the key was found and updater returned true. errno is set
+ *         to ENOENT if the key was not found.
+ */
+bool update(hashmap_t *self, map_key_t key, updater_f updater, void *arg);
+
+/*
+ * Insert a key/value pair only if the key is in the map and its version is
+ * still *version. The entry is overwritten as put() would overwrite it.
+ *
+ * @param self The hash map to use
+ * @param key The key to insert
+ * @param val The value to insert
+ * @param version The version the entry must have. Set to the new version on
+ *                success, and to the current one on a mismatch.
+ * @return true if the pair was inserted. errno is set to ENOENT if the key
+ *         was not found and to ESTALE if its version did not match.
+ */
+bool cas(hashmap_t *self, map_key_t key, map_val_t val, uint64_t *version);
+
+/*
+ * Insert a key/value pair only if the key is not in the map and check,
+ * called with the write lock held, still allows it. A full map is handled
+ * as put() handles it.
+ *
+ * @param self The hash map to use
+ * @param key The key to insert
+ * @param val The value to insert
+ * @param force Whether or not entries should be overwritten if the map is full.
+ * @param check Called with the key and arg just before the insert
+ * @param arg Passed through to check
+ * @return true if the pair was inserted. errno is set to EEXIST if the key
+ *         was found and to ESTALE if check returned false.
+ */
+bool put_absent(hashmap_t *self, map_key_t key, map_val_t val, bool force, check_f check, void *arg);
+
+/*
+ * Remove the entry associated with a key. Its key and value are passed to
+ * destroy_function before this returns.
  *
  * @param self The hash map to use
  * @param key The key to remove.
- * @return true if the deletion was successful
+ * @return The removed map_node_t instance, whose key_base is NULL if the key
+ *         was not found. Its pointers must not be dereferenced.
  */
 map_node_t delete(hashmap_t *self, map_key_t key);
 
+/*
+ * Remove the entries of several keys under a single acquisition of the
+ * write lock.
+ *
+ * @param self The hash map to use
+ * @param keys The keys to remove
+ * @param count The number of keys
+ * @return true if the batch was attempted, false if the map is invalid.
+ */
+bool delete_many(hashmap_t *self, map_key_t *keys, int count);
+
 /*
  * Clears and destroys all entries in the map.
  *
@@ -96,6 +233,26 @@ map_node_t delete(hashmap_t *self, map_key_t key);
  */
 bool clear_map(hashmap_t *self);
 
+/*
+ * Calls iterator on every live entry in the map. The map is write locked for
+ * the duration of the walk, so iterator must not call back into the map.
+ *
+ * @param self The hash map to walk.
+ * @param iterator The function to call on each key/value pair.
+ * @param arg An argument passed through to iterator.
+ * @return true if the walk was successful, false otherwise
+ */
+bool iterate_map(hashmap_t *self, iterator_f iterator, void *arg);
+
+/*
+ * Invalidate a hash map without destroying its elements, leaving the node
+ * array intact for another process to take over.
+ *
+ * @param self The hash map to detach.
+ * @return true if the operation was successful.
+ */
+bool detach_map(hashmap_t *self);
+
 /*
  * Invalidate a hash map and its elements using the destructor function in the
  * map.
@@ -0,0 +1,45 @@
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+#include <stdbool.h>
+
+#define HANDOVER_FDS 2
+#define HANDOVER_DRAIN_MS 1000
+
+/*
+ * Binds a UNIX socket at path for a successor process to connect to.
+ * A stale socket file at path is replaced.
+ *
+ * @param path The filesystem path of the control socket
+ * @return The listening socket, or -1 on error
+ */
+int handover_listen(const char *path);
+
+/*
+ * Connects to the process serving at path and receives its file descriptors.
+ *
+ * @param path The filesystem path of the control socket
+ * @param fds Filled with HANDOVER_FDS descriptors on success
+ * @return true if descriptors were received, false if no process is serving
+ *         at path or the transfer failed
+ */
+bool handover_request(const char *path, int *fds);
+
+/*
+ * Blocks until a successor connects to the control socket.
+ *
+ * @param ctlfd The socket returned by handover_listen
+ * @return The connection to the successor, or -1 on error
+ */
+int handover_wait(int ctlfd);
+
+/*
+ * Passes file descriptors to a successor and waits for it to acknowledge them.
+ *
+ * @param connfd The connection returned by handover_wait
+ * @param fds The HANDOVER_FDS descriptors to pass
+ * @return true if the successor took the descriptors, false otherwise
+ */
+bool handover_send(int connfd, int *fds);
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "utils.h"
+
+// the journal is compacted once it grows past this size, or past twice the
+// size of the last snapshot, whichever is larger
+#define JOURNAL_MIN_COMPACT (64 * 1024 * 1024)
+#define JOURNAL_BUFSIZE (64 * 1024)
+#define JOURNAL_SNAPSUFFIX ".snap"
+
+typedef struct journal_record_t {
+    uint8_t op;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t checksum;
+} __attribute__((packed)) journal_record_t;
+
+typedef void (*journal_apply_f)(uint8_t op, map_key_t key, map_val_t val);
+
+// the end of the buffered records, to roll a failed batch back to
+typedef struct journal_mark_t {
+    size_t buf_len;
+    uint64_t appended;
+} journal_mark_t;
+
+typedef struct journal_t {
+    int fd;
+    char *path;
+    char *buf, *flushbuf;
+    size_t buf_len, buf_cap, flushbuf_cap;
+    size_t file_size, compact_size;
+    uint64_t appended, synced;
+    int sync_interval;
+    hashmap_t *map;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t flush_cond;
+    pthread_cond_t sync_cond;
+    bool failed;
+    bool invalid;
+} journal_t;
+
+/*
+ * Opens or creates an append-only journal of map mutations and starts the
+ * thread that group commits it to disk.
+ *
+ * @param path The file the journal is stored in
+ * @param sync_interval Milliseconds the flusher waits after the first pending
+ *                      record before writing, so more records share one
+ *                      write and fdatasync. 0 flushes as soon as it can.
+ * @param map The map snapshotted when the journal is compacted
+ * @return A pointer to the new journal_t instance, or NULL on error
+ */
+journal_t *create_journal(const char *path, int sync_interval, hashmap_t *map);
+
+/*
+ * Replays every valid record in the journal through apply. Records after the
+ * last CLEAR are partitioned by key hash across num_threads threads, so each
+ * key still sees its own records in log order. A torn record at the tail of
+ * the file is truncated away.
+ *
+ * @param self The journal to replay
+ * @param apply The function each record is passed to. The key and value
+ *              point into the journal and must be copied to be kept.
+ * @param num_threads The number of replay threads
+ * @return true if the replay was successful, false otherwise
+ */
+bool replay_journal(journal_t *self, journal_apply_f apply, int num_threads);
+
+/*
+ * Locks the journal. Callers hold the lock across a map mutation and its
+ * journal_append so records land in the log in the order they hit the map.
+ */
+void journal_lock(journal_t *self);
+void journal_unlock(journal_t *self);
+
+/*
+ * Buffers a record for the next group commit. The caller must hold the
+ * journal lock.
+ *
+ * @param self The journal to append to
+ * @param op The request code of the mutation
+ * @param key The key of the mutation, may be empty for CLEAR
+ * @param val The value of the mutation, may be empty for EVICT and CLEAR
+ * @return The sequence number to pass to journal_wait, or 0 on error
+ */
+uint64_t journal_append(journal_t *self, uint8_t op, map_key_t key, map_val_t val);
+
+/*
+ * Marks the end of the records appended so far. The caller must hold the
+ * journal lock.
+ *
+ * @param self The journal to mark
+ * @return The mark to pass to journal_rollback
+ */
+journal_mark_t journal_mark(journal_t *self);
+
+/*
+ * Drops every record appended since mark, for a mutation that was not
+ * applied after all. The caller must have held the journal lock since
+ * taking the mark.
+ *
+ * @param self The journal to roll back
+ * @param mark A mark from journal_mark
+ */
+void journal_rollback(journal_t *self, journal_mark_t mark);
+
+/*
+ * Blocks until the record with the given sequence number is on disk.
+ *
+ * @param self The journal to wait on
+ * @param lsn A sequence number returned by journal_append
+ * @return true if the record is durable, false if the journal failed
+ */
+bool journal_wait(journal_t *self, uint64_t lsn);
+
+/*
+ * Flushes outstanding records, stops the flusher and frees the journal.
+ *
+ * @param self The journal to invalidate
+ * @return true if the journal was successfully invalidated, false otherwise
+ */
+bool invalidate_journal(journal_t *self);
+
+#endif
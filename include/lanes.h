@@ -0,0 +1,97 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <semaphore.h>
+#include <stdbool.h>
+#include <time.h>
+#include "queue.h"
+
+#define LANES_MAX 4
+
+/*
+ * Several FIFO queues drained by one set of workers. Each worker takes up to
+ * a lane's weight of items from it before moving to the next lane, skipping
+ * empty ones, so a busy slow lane can't starve a fast one and no lane sits
+ * idle while there is work. Workers can also be reserved for one lane by
+ * popping only from it.
+ */
+typedef struct lanes_t {
+    queue_t *queues[LANES_MAX];
+    int weights[LANES_MAX];
+    int num_lanes;
+    // posted once per item across every lane, for workers serving them all.
+    // items taken by reserved workers leave a post behind, which wakes a
+    // worker that then finds nothing and waits again
+    sem_t items;
+} lanes_t;
+
+// where a worker is in the weighted round
+typedef struct lanes_cursor_t {
+    int lane;
+    int taken;
+} lanes_cursor_t;
+
+/*
+ * Creates a set of lanes. A single lane is a plain queue, with no extra cost.
+ *
+ * @param num_lanes The number of lanes, 1 to LANES_MAX
+ * @param weights Items a worker takes from each lane per round, each at least 1
+ * @param limit The most items each lane holds, or 0 for no bound
+ * @return A pointer to the new lanes_t instance, or NULL on error
+ */
+lanes_t *create_lanes(int num_lanes, const int *weights, int limit);
+
+/*
+ * Frees the lanes. They must be empty.
+ *
+ * @param self The lanes to invalidate
+ * @return true if successful, false otherwise
+ */
+bool invalidate_lanes(lanes_t *self);
+
+/*
+ * Queues an item on a lane.
+ *
+ * @param self The lanes
+ * @param lane The lane, 0 to num_lanes - 1
+ * @param item The item
+ * @return true if it was queued, false otherwise. errno is EAGAIN if the
+ *         lane was full
+ */
+bool lanes_push(lanes_t *self, int lane, void *item);
+
+/*
+ * Takes the next item by weighted round robin over every lane.
+ *
+ * @param self The lanes
+ * @param cursor The calling worker's place in the round, zeroed to start
+ * @param timeout_ms Milliseconds to wait, or -1 to wait forever
+ * @param queued If not NULL, set to the CLOCK_MONOTONIC time the item was
+ *               queued
+ * @return The item, or NULL with errno ETIMEDOUT if none arrived in time,
+ *         or EAGAIN if a reserved worker took the one that woke this one
+ */
+void *lanes_pop(lanes_t *self, lanes_cursor_t *cursor, int timeout_ms, struct timespec *queued);
+
+/*
+ * Takes the next item from one lane only, for workers reserved for it.
+ *
+ * @return The item, or NULL with errno ETIMEDOUT if none arrived in time
+ */
+void *lanes_pop_lane(lanes_t *self, int lane, int timeout_ms, struct timespec *queued);
+
+/*
+ * Reports when the oldest item still queued on any lane was queued.
+ *
+ * @param self The lanes
+ * @param queued Set to the CLOCK_MONOTONIC time the oldest item was queued
+ * @return true if any lane had an item, false otherwise
+ */
+bool lanes_oldest(lanes_t *self, struct timespec *queued);
+
+/*
+ * Returns the number of items queued across every lane.
+ */
+int lanes_length(lanes_t *self);
+
+#endif
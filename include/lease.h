@@ -0,0 +1,87 @@
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "utils.h"
+
+// leases are kept in buckets of LEASE_WAYS slots
+#define LEASE_WAYS 4
+
+/*
+ * A lease on a missing key. The holder was told to fill the key; everyone
+ * else missing on it is told to retry until the lease is released or
+ * expires. Keys are told apart by hash only.
+ */
+typedef struct lease_t {
+    uint64_t token;
+    uint64_t expires;
+    uint32_t hash;
+} lease_t;
+
+typedef struct lease_table_t {
+    lease_t *leases;
+    uint32_t num_leases;
+    uint32_t ttl_ms;
+    uint64_t next_token;
+    pthread_mutex_t lock;
+    bool invalid;
+} lease_table_t;
+
+/*
+ * Creates a lease table.
+ *
+ * @param num_leases The number of leases that can be live at once
+ * @param ttl_ms Milliseconds a lease lasts if its holder never fills the key
+ * @return A pointer to the new lease_table_t instance, or NULL on error
+ */
+lease_table_t *create_lease_table(uint32_t num_leases, uint32_t ttl_ms);
+
+/*
+ * Grants a lease on a key unless one is already live. When the key's bucket
+ * is full, the lease closest to expiry is dropped to make room.
+ *
+ * @param self The lease table to use
+ * @param key The key that missed
+ * @return The token of the new lease, or 0 if another lease is live
+ */
+uint64_t lease_acquire(lease_table_t *self, map_key_t key);
+
+/*
+ * Ends a lease if token is still the live lease on the key.
+ *
+ * @param self The lease table to use
+ * @param key The key the lease is on
+ * @param token The token returned by lease_acquire
+ * @return true if the lease was live and held by token
+ */
+bool lease_release(lease_table_t *self, map_key_t key, uint64_t token);
+
+/*
+ * Ends any lease on a key, so its holder can no longer fill it.
+ *
+ * @param self The lease table to use
+ * @param key The key to revoke the lease on
+ * @return true if a lease was revoked
+ */
+bool lease_revoke(lease_table_t *self, map_key_t key);
+
+/*
+ * Ends every lease in the table.
+ *
+ * @param self The lease table to clear
+ * @return true if the operation was successful, false otherwise
+ */
+bool clear_leases(lease_table_t *self);
+
+/*
+ * Frees the lease table.
+ *
+ * @param self The lease table to invalidate
+ * @return true if the table was successfully invalidated, false otherwise
+ */
+bool invalidate_lease_table(lease_table_t *self);
+
+#endif
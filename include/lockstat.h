@@ -0,0 +1,139 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/*
+ * Contention counters for one lock. Built with -DLOCKSTAT (make lockstat),
+ * the lockstat_* wrappers below try the lock first and only time the wait
+ * when that fails, and time how long the lock is held. Every counter is
+ * updated while the lock is held, so the lock itself keeps them consistent.
+ * Without LOCKSTAT the wrappers are the plain calls.
+ */
+typedef struct lockstat_t {
+    const char *name;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_cycles;
+    uint64_t hold_cycles;
+    uint64_t held_since;
+    struct lockstat_t *next;
+} lockstat_t;
+
+/*
+ * Names a lock's counters and lists them for lockstat_print. Counters are
+ * listed whether or not LOCKSTAT is on.
+ *
+ * @param self The counters to list
+ * @param name What lockstat_print calls them; not copied
+ */
+void lockstat_register(lockstat_t *self, const char *name);
+
+/*
+ * Stops listing a lock's counters, before the lock is freed.
+ *
+ * @param self The counters to remove
+ */
+void lockstat_unregister(lockstat_t *self);
+
+/*
+ * Formats the counters of every listed lock as "name value" lines, with
+ * times in nanoseconds. Locks of the same name are summed, and locks never
+ * acquired are left out, so nothing is printed unless built with LOCKSTAT.
+ *
+ * @param buf Where to write the text
+ * @param len The size of buf
+ * @return The number of bytes written, at most len - 1
+ */
+size_t lockstat_print(char *buf, size_t len);
+
+// a cheap timestamp in cycles
+static inline uint64_t lockstat_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#ifdef LOCKSTAT
+
+// counts an acquisition; called with the lock held
+static inline void lockstat_acquired(lockstat_t *self, uint64_t waited_from) {
+    self->held_since = lockstat_now();
+    self->acquired++;
+    if(waited_from != 0){
+        self->contended++;
+        self->wait_cycles += self->held_since - waited_from;
+    }
+}
+
+static inline int lockstat_mutex_lock(pthread_mutex_t *lock, lockstat_t *self) {
+    uint64_t waited_from = 0;
+    int ret;
+
+    if((ret = pthread_mutex_trylock(lock)) == EBUSY){
+        waited_from = lockstat_now();
+        ret = pthread_mutex_lock(lock);
+    }
+    if(ret == 0){
+        lockstat_acquired(self, waited_from);
+    }
+    return ret;
+}
+
+static inline int lockstat_mutex_unlock(pthread_mutex_t *lock, lockstat_t *self) {
+    self->hold_cycles += lockstat_now() - self->held_since;
+    return pthread_mutex_unlock(lock);
+}
+
+static inline int lockstat_sem_wait(sem_t *lock, lockstat_t *self) {
+    uint64_t waited_from = 0;
+    int ret;
+
+    if((ret = sem_trywait(lock)) != 0){
+        waited_from = lockstat_now();
+        // signal handlers are installed without SA_RESTART
+        while((ret = sem_wait(lock)) != 0 && errno == EINTR);
+    }
+    if(ret == 0){
+        lockstat_acquired(self, waited_from);
+    }
+    return ret;
+}
+
+static inline int lockstat_sem_post(sem_t *lock, lockstat_t *self) {
+    self->hold_cycles += lockstat_now() - self->held_since;
+    return sem_post(lock);
+}
+
+#else
+
+#define lockstat_mutex_lock(lock, self) pthread_mutex_lock(lock)
+#define lockstat_mutex_unlock(lock, self) pthread_mutex_unlock(lock)
+#define lockstat_sem_post(lock, self) sem_post(lock)
+
+static inline int lockstat_sem_wait(sem_t *lock, lockstat_t *self) {
+    int ret;
+
+    // signal handlers are installed without SA_RESTART
+    while((ret = sem_wait(lock)) != 0 && errno == EINTR);
+    return ret;
+}
+
+#endif
+
+#endif
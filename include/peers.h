@@ -0,0 +1,93 @@
+#ifndef PEERS_H
+#define PEERS_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define PEERS_ADDR_LEN 16
+
+typedef struct peers_entry_t {
+    uint8_t addr[PEERS_ADDR_LEN];
+    // 0 marks a free slot
+    uint32_t count;
+} peers_entry_t;
+
+/*
+ * Counts open connections per client address, in an open addressing table
+ * that only holds addresses with a connection open. Addresses are IPv6,
+ * with IPv4 ones mapped into it. Not thread safe.
+ */
+typedef struct peers_t {
+    peers_entry_t *entries;
+    uint32_t mask;
+    uint32_t limit;
+    uint32_t used;
+} peers_t;
+
+/*
+ * Creates an empty table.
+ *
+ * @param capacity Slots in the table; a power of two. At most three quarters
+ *                 of them are filled.
+ * @param limit The most connections an address may have open
+ * @return A pointer to the new peers_t instance, or NULL on error
+ */
+peers_t *create_peers(uint32_t capacity, uint32_t limit);
+
+/*
+ * Frees the table.
+ *
+ * @param self The table to invalidate
+ * @return true if successful, false otherwise
+ */
+bool invalidate_peers(peers_t *self);
+
+/*
+ * Counts a new connection from addr, unless it would exceed the limit.
+ *
+ * @param self The table
+ * @param addr The client's address
+ * @return true if it was counted, false with errno EBUSY if addr is at the
+ *         limit or ENOSPC if the table is full
+ */
+bool peers_add(peers_t *self, const uint8_t *addr);
+
+/*
+ * Uncounts a connection from addr, freeing its slot with the last one.
+ *
+ * @param self The table
+ * @param addr The client's address, counted by peers_add
+ */
+void peers_remove(peers_t *self, const uint8_t *addr);
+
+/*
+ * The number of connections counted for addr.
+ *
+ * @param self The table
+ * @param addr The client's address
+ * @return The count, 0 if it has none
+ */
+uint32_t peers_count(peers_t *self, const uint8_t *addr);
+
+/*
+ * Fills addr with a socket address, IPv4 ones as ::ffff:a.b.c.d. Other
+ * families come out as all zeroes.
+ *
+ * @param sa The address accept returned
+ * @param addr Where to store it, PEERS_ADDR_LEN bytes
+ */
+static inline void peers_addr(const struct sockaddr *sa, uint8_t *addr) {
+    memset(addr, 0, PEERS_ADDR_LEN);
+    if(sa->sa_family == AF_INET){
+        addr[10] = addr[11] = 0xff;
+        memcpy(addr + 12, &((const struct sockaddr_in *)sa)->sin_addr, 4);
+    } else if(sa->sa_family == AF_INET6){
+        memcpy(addr, &((const struct sockaddr_in6 *)sa)->sin6_addr, PEERS_ADDR_LEN);
+    }
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT probes under the "cream" provider, for perf and bpftrace to attach to
+ * a running server. Built with -DUSDT (make usdt) each probe is a nop the
+ * kernel patches when something attaches, with its arguments described in
+ * the binary's .note.stapsdt section; it needs <sys/sdt.h> from systemtap.
+ * Without USDT the probes, and their arguments, compile away.
+ *
+ * Probes, with their arguments:
+ *   request__start    conn id, frame seq, request code, key size, value size
+ *   request__done     conn id, frame seq, request code, response code, ns since dequeue
+ *   map__put__entry   key, key length, value length
+ *   map__put__return  true if stored, slots probed
+ *   map__get__entry   key, key length
+ *   map__get__return  value length, or -1 on a miss, slots probed
+ *   map__delete__entry  key, key length
+ *   map__delete__return true if found
+ *   map__evict        key, key length, value length; a full map forced out
+ *   map__expire       key, key length; dropped by the EXT map's TTL
+ *   queue__enqueue    item
+ *   queue__dequeue    item
+ *
+ * For example, map get latency:
+ *   bpftrace -e 'usdt:./bin/cream:cream:map__get__entry { @s[tid] = nsecs; }
+ *       usdt:./bin/cream:cream:map__get__return /@s[tid]/ {
+ *       @ns = hist(nsecs - @s[tid]); delete(@s[tid]); }'
+ */
+#ifdef USDT
+
+#include <sys/sdt.h>
+
+#define CREAM_PROBE1(name, a) DTRACE_PROBE1(cream, name, a)
+#define CREAM_PROBE2(name, a, b) DTRACE_PROBE2(cream, name, a, b)
+#define CREAM_PROBE3(name, a, b, c) DTRACE_PROBE3(cream, name, a, b, c)
+#define CREAM_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(cream, name, a, b, c, d, e)
+
+#else
+
+#define CREAM_PROBE1(name, a) do {} while(0)
+#define CREAM_PROBE2(name, a, b) do {} while(0)
+#define CREAM_PROBE3(name, a, b, c) do {} while(0)
+#define CREAM_PROBE5(name, a, b, c, d, e) do {} while(0)
+
+#endif
+
+#endif
@@ -5,16 +5,24 @@
 #include <semaphore.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
+#include "lockstat.h"
 
 typedef struct queue_node_t {
     void *item;
+    // CLOCK_MONOTONIC time the item was enqueued
+    struct timespec queued;
     struct queue_node_t *next;
 } queue_node_t;
 
 typedef struct queue_t {
     queue_node_t *front, *rear;
     sem_t items;
+    // items queued, and how many may be; 0 for no bound
+    int length;
+    int limit;
     pthread_mutex_t lock;
+    lockstat_t lock_stat;
     bool invalid;
 } queue_t;
 
@@ -28,6 +36,15 @@ typedef void (*item_destructor_f)(void *);
  */
 queue_t *create_queue(void);
 
+/*
+ * Creates a queue that holds at most limit items; enqueue fails with
+ * EAGAIN once it is full
+ *
+ * @param limit The most items the queue holds, or 0 for no bound
+ * @return A pointer to a queue on the heap
+ */
+queue_t *create_bounded_queue(int limit);
+
 /*
  * Invalidates a queue from memory and calls destroy_function on all
  * items in the queue
@@ -43,7 +60,8 @@ bool invalidate_queue(queue_t *self, item_destructor_f destroy_function);
  *
  * @param self The pointer to the queue
  * @param item The pointer to insert into the queue
- * @return true if the insertion was successful, false otherwise
+ * @return true if the insertion was successful, false otherwise. errno is
+ *         EAGAIN if a bounded queue was full
  */
 bool enqueue(queue_t *self, void *item);
 
@@ -57,4 +75,27 @@ bool enqueue(queue_t *self, void *item);
  */
 void *dequeue(queue_t *self);
 
+/*
+ * Removes and returns the item at the head of the queue, waiting at most
+ * timeout_ms for one to arrive
+ *
+ * @param self The pointer to the queue
+ * @param timeout_ms Milliseconds to wait, 0 to not wait, or -1 to wait forever
+ * @param queued If not NULL, set to the CLOCK_MONOTONIC time the item was
+ *               enqueued
+ * @return The item in the node at the head of the queue, or NULL with errno
+ *         set to ETIMEDOUT if none arrived in time
+ */
+void *dequeue_timed(queue_t *self, int timeout_ms, struct timespec *queued);
+
+/*
+ * Reports when the item at the head of the queue was enqueued, so callers
+ * can tell how long the oldest item has waited
+ *
+ * @param self The pointer to the queue
+ * @param queued Set to the CLOCK_MONOTONIC time the head item was enqueued
+ * @return true if the queue had an item, false if it was empty
+ */
+bool queue_oldest(queue_t *self, struct timespec *queued);
+
 #endif
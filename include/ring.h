@@ -0,0 +1,81 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A bounded single-producer single-consumer queue of pointers. The producer
+ * only writes tail and the consumer only writes head, each on its own cache
+ * line, and each keeps a stale copy of the other's index so it only reads the
+ * shared one when its copy says the ring looks full or empty.
+ */
+typedef struct ring_t {
+    // written by the consumer
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail_cache;
+    // written by the producer
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t head_cache;
+    // read-only once created
+    uint64_t mask __attribute__((aligned(64)));
+    void **slots;
+} ring_t;
+
+/*
+ * Creates an empty ring.
+ *
+ * @param capacity The number of pointers the ring holds; a power of two
+ * @return A pointer to the new ring_t instance, or NULL on error
+ */
+ring_t *create_ring(uint32_t capacity);
+
+/*
+ * Frees the ring's slots. Pointers still in it are dropped.
+ *
+ * @param self The ring to invalidate
+ * @return true if successful, false otherwise
+ */
+bool invalidate_ring(ring_t *self);
+
+/*
+ * Adds a pointer at the tail. Only the producer may call this.
+ *
+ * @param self The ring
+ * @param item The pointer, not NULL
+ * @return true if it was added, false if the ring is full
+ */
+static inline bool ring_push(ring_t *self, void *item) {
+    if(self->tail - self->head_cache > self->mask){
+        self->head_cache = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+        if(self->tail - self->head_cache > self->mask){
+            return false;
+        }
+    }
+    self->slots[self->tail & self->mask] = item;
+    __atomic_store_n(&self->tail, self->tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * Removes the pointer at the head. Only the consumer may call this.
+ *
+ * @param self The ring
+ * @return The pointer, or NULL if the ring is empty
+ */
+static inline void *ring_pop(ring_t *self) {
+    void *item;
+
+    if(self->head == self->tail_cache){
+        self->tail_cache = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+        if(self->head == self->tail_cache){
+            return NULL;
+        }
+    }
+    item = self->slots[self->head & self->mask];
+    __atomic_store_n(&self->head, self->head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// blocks are padded to a cache line so workers never share one
+#define STATS_LINE 64
+
+/*
+ * Histograms are log-linear, like HDR histograms: values below
+ * STATS_SUB_BUCKETS get a bucket each, and every power of two above that is
+ * split into STATS_SUB_BUCKETS buckets, so a bucket is never wider than
+ * 1/16th of the values in it. Values of 2^STATS_MAX_BITS and up share the
+ * last bucket.
+ */
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_BITS 36
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+// the request types counted apart
+typedef enum stats_op_t {
+    STATS_GET,
+    STATS_PUT,
+    STATS_EVICT,
+    STATS_CLEAR,
+    STATS_MGET,
+    STATS_MPUT,
+    STATS_MDEL,
+    STATS_UPDATE,
+    STATS_GETS,
+    STATS_CAS,
+    STATS_LGET,
+    STATS_LPUT,
+    STATS_STATS,
+    STATS_OTHER,
+    STATS_OPS
+} stats_op_t;
+
+typedef struct stats_hist_t {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+} stats_hist_t;
+
+/*
+ * The counters of one thread. Only the owner writes them, without atomics;
+ * readers sum every block when asked, so a snapshot may trail the owners by
+ * a few increments.
+ */
+typedef struct stats_block_t {
+    uint64_t ops[STATS_OPS];
+    uint64_t hits;
+    uint64_t misses;
+    // requests answered TIMEOUT because their deadline had passed
+    uint64_t expired;
+    uint64_t conns_opened;
+    uint64_t conns_closed;
+    // connections refused for their address, closed for being idle, and
+    // shut down mid-frame
+    uint64_t conns_refused;
+    uint64_t conns_idle;
+    uint64_t conns_stalled;
+    // datagrams taken in over UDP, and those answered TOO_LARGE
+    uint64_t datagrams;
+    uint64_t datagrams_too_large;
+    // slots examined per map lookup
+    stats_hist_t probes;
+    // nanoseconds from dequeue to response, per request type
+    stats_hist_t latency[STATS_OPS];
+    // nanoseconds a connection with a frame waited in the queue for a worker
+    stats_hist_t queue_wait;
+} __attribute__((aligned(STATS_LINE))) stats_block_t;
+
+typedef struct stats_t {
+    stats_block_t *blocks;
+    int num_blocks;
+    uint64_t started;
+} stats_t;
+
+extern const char *stats_op_names[STATS_OPS];
+
+/*
+ * Creates a set of zeroed statistics blocks.
+ *
+ * @param num_blocks The number of threads that will keep counters
+ * @return A pointer to the new stats_t instance, or NULL on error
+ */
+stats_t *create_stats(int num_blocks);
+
+/*
+ * Returns the block owned by thread index, or NULL if there is none.
+ *
+ * @param self The statistics to use
+ * @param index The index of the owning thread
+ * @return The block, or NULL if index is out of range
+ */
+stats_block_t *stats_block(stats_t *self, int index);
+
+/*
+ * Sums every block into total.
+ *
+ * @param self The statistics to read
+ * @param total Where to store the sums
+ */
+void stats_merge(stats_t *self, stats_block_t *total);
+
+/*
+ * Returns a value at or above the given fraction of the recorded values.
+ *
+ * @param hist The histogram to read
+ * @param fraction A fraction between 0 and 1, such as 0.99
+ * @return The value, or 0 if nothing was recorded
+ */
+uint64_t stats_percentile(stats_hist_t *hist, double fraction);
+
+/*
+ * Formats merged counters as "name value" lines. Request types that were
+ * never seen are left out.
+ *
+ * @param total The merged counters
+ * @param buf Where to write the text
+ * @param len The size of buf
+ * @return The number of bytes written, at most len - 1
+ */
+size_t stats_print(stats_block_t *total, char *buf, size_t len);
+
+/*
+ * Frees the statistics.
+ *
+ * @param self The statistics to invalidate
+ * @return true if the statistics were freed, false otherwise
+ */
+bool invalidate_stats(stats_t *self);
+
+// the bucket value falls in
+static inline int stats_bucket(uint64_t value) {
+    int exp;
+
+    if(value < STATS_SUB_BUCKETS){
+        return (int)value;
+    }
+    exp = 63 - __builtin_clzll(value);
+    if(exp >= STATS_MAX_BITS){
+        return STATS_BUCKETS - 1;
+    }
+    return (exp - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS +
+        (int)((value >> (exp - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+// adds a value to a histogram; called by the owning thread only
+static inline void stats_record(stats_hist_t *hist, uint64_t value) {
+    hist->buckets[stats_bucket(value)]++;
+    hist->count++;
+    if(value > hist->max){
+        hist->max = value;
+    }
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "utils.h"
+
+// stubs are kept in buckets of TIER_WAYS slots, one stub per TIER_AVG_RECORD
+// bytes of tier file
+#define TIER_WAYS 4
+#define TIER_AVG_RECORD 512
+
+typedef struct tier_record_t {
+    uint32_t key_size;
+    uint32_t value_size;
+} __attribute__((packed)) tier_record_t;
+
+/*
+ * The part of a spilled entry that stays in RAM. offset is a logical offset
+ * that grows forever; the record is at offset % size in the file and has
+ * been overwritten once the write head is more than size past it. A pending
+ * stub has room reserved but its record not written yet.
+ */
+typedef struct tier_stub_t {
+    uint64_t offset;
+    uint32_t hash;
+    uint32_t length;
+    bool pending;
+} tier_stub_t;
+
+typedef struct tier_t {
+    int fd;
+    uint64_t size;
+    uint64_t head;
+    tier_stub_t *stubs;
+    uint32_t num_stubs;
+    pthread_mutex_t lock;
+    // held across each record's write, so a late write never lands on a
+    // record reserved after it
+    pthread_mutex_t io_lock;
+    bool invalid;
+} tier_t;
+
+/*
+ * Creates a disk tier in a preallocated file used as a circular log.
+ *
+ * @param path The file the tier is stored in. It is truncated.
+ * @param size The size of the file in bytes
+ * @return A pointer to the new tier_t instance, or NULL on error
+ */
+tier_t *create_tier(const char *path, uint64_t size);
+
+/*
+ * Writes a key/value pair to the tier and keeps a stub for it. The oldest
+ * records are overwritten when the log wraps. The caller keeps ownership of
+ * key and val.
+ *
+ * @param self The tier to write to
+ * @param key The key to spill
+ * @param val The value to spill
+ * @return true if the pair was written, false otherwise
+ */
+bool tier_put(tier_t *self, map_key_t key, map_val_t val);
+
+/*
+ * Makes room for a key/value pair and keeps a pending stub for it, without
+ * touching the disk, so it is cheap enough to call with the map locked. The
+ * key reads as missing until tier_write.
+ *
+ * @param self The tier to reserve in
+ * @param key The key to spill
+ * @param val_len The length of the value to spill
+ * @param stub Set to the stub, to pass to tier_write
+ * @return true if room was reserved, false otherwise
+ */
+bool tier_reserve(tier_t *self, map_key_t key, size_t val_len, tier_stub_t *stub);
+
+/*
+ * Writes a pair reserved with tier_reserve and makes it readable. Nothing is
+ * written if the stub was deleted, or lapped, since. The caller keeps
+ * ownership of key and val.
+ *
+ * @param self The tier to write to
+ * @param stub The stub tier_reserve returned
+ * @param key The key reserved for
+ * @param val The value, of the length reserved for
+ * @return true if the pair was written, false otherwise
+ */
+bool tier_write(tier_t *self, tier_stub_t *stub, map_key_t key, map_val_t val);
+
+/*
+ * Reads the value of a spilled key. The read runs without the tier lock
+ * held, so concurrent spills are not blocked behind the disk.
+ *
+ * @param self The tier to read from
+ * @param key The key to search for
+ * @return The value in a malloc'd buffer, or a map_val_t instance with a null
+ *         pointer and a value length of 0 if the key is not in the tier.
+ */
+map_val_t tier_get(tier_t *self, map_key_t key);
+
+/*
+ * Reads the value of a spilled key as tier_get does, and hands back the
+ * stub it was read through, for tier_holds.
+ *
+ * @param self The tier to read from
+ * @param key The key to search for
+ * @param stub Set to the stub of the record read, if one was
+ * @return As for tier_get
+ */
+map_val_t tier_read(tier_t *self, map_key_t key, tier_stub_t *stub);
+
+/*
+ * Tells whether a stub tier_read handed back is still kept, that is whether
+ * its key has been neither deleted nor spilled again since. No disk access,
+ * so it is cheap enough to call with the map locked.
+ *
+ * @param self The tier to check
+ * @param stub The stub tier_read handed back
+ * @return true if the stub is still kept
+ */
+bool tier_holds(tier_t *self, tier_stub_t *stub);
+
+/*
+ * Forgets the stub of a key, so a stale value is never read back.
+ *
+ * @param self The tier to use
+ * @param key The key to remove
+ * @return true if a stub was removed
+ */
+bool tier_delete(tier_t *self, map_key_t key);
+
+/*
+ * Forgets every stub in the tier.
+ *
+ * @param self The tier to clear
+ * @return true if the operation was successful, false otherwise
+ */
+bool clear_tier(tier_t *self);
+
+/*
+ * Closes the tier file and frees the tier.
+ *
+ * @param self The tier to invalidate
+ * @return true if the tier was successfully invalidated, false otherwise
+ */
+bool invalidate_tier(tier_t *self);
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TRACE_MAGIC "CREAMTRC"
+#define TRACE_VERSION 1
+// records kept per thread between drains; a power of two
+#define TRACE_RING_SIZE (1 << 16)
+
+// the points in a request's life that are timestamped
+typedef enum trace_event_t {
+    TRACE_ACCEPT,
+    TRACE_ENQUEUE,
+    TRACE_DEQUEUE,
+    TRACE_PARSED,
+    TRACE_DONE,
+    TRACE_SENT,
+    // seq holds the number of records a ring overwrote before they were drained
+    TRACE_LOST,
+    TRACE_EVENTS
+} trace_event_t;
+
+/*
+ * One timestamp. A request is named by its connection and the frame's
+ * sequence number on it; ACCEPT has sequence number 0 and frames count from 1.
+ */
+typedef struct trace_record_t {
+    uint64_t ns;
+    uint32_t conn;
+    uint32_t seq;
+    uint8_t event;
+    uint8_t op;
+    uint16_t thread;
+    // the response code, at DONE
+    uint32_t status;
+} trace_record_t;
+
+// the start of a trace file, followed by records in drain order
+typedef struct trace_file_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} trace_file_header_t;
+
+/*
+ * A single-writer ring. The owning thread fills the slot at head and then
+ * publishes it by advancing head; the drainer copies from tail up to head
+ * and throws away any record the owner may have lapped while it copied, so
+ * neither side ever waits on the other.
+ */
+typedef struct trace_ring_t {
+    uint64_t head;
+    uint64_t tail;
+    uint16_t thread;
+    uint32_t mask;
+    trace_record_t *records;
+} __attribute__((aligned(64))) trace_ring_t;
+
+typedef struct trace_t {
+    int fd;
+    trace_ring_t *rings;
+    int num_rings;
+    trace_record_t *drainbuf;
+    int interval;
+    pthread_t streamer;
+    pthread_mutex_t lock;
+    pthread_cond_t stop_cond;
+    bool invalid;
+} trace_t;
+
+/*
+ * Creates a ring per thread and the trace file they are drained to. The file
+ * is truncated and starts with a trace_file_header_t.
+ *
+ * @param path The file records are written to
+ * @param num_rings The number of threads that will record
+ * @param ring_size Slots in each ring; a power of two. A drain that finds a
+ *                  ring full keeps ring_size - 1 records, since the owner may
+ *                  be refilling the oldest slot.
+ * @param interval Milliseconds between drains by a streaming thread. 0 starts
+ *                 no thread, so the rings keep each thread's latest records
+ *                 until trace_flush is called.
+ * @return A pointer to the new trace_t instance, or NULL on error
+ */
+trace_t *create_trace(const char *path, int num_rings, uint32_t ring_size, int interval);
+
+/*
+ * Returns one thread's ring.
+ *
+ * @param self The trace
+ * @param index The thread's ring, 0 to num_rings - 1
+ * @return The ring, or NULL if index is out of range
+ */
+trace_ring_t *trace_ring(trace_t *self, int index);
+
+/*
+ * Appends every record recorded since the last drain to the trace file. A
+ * ring that was lapped gets a LOST record counting what was overwritten.
+ *
+ * @param self The trace to drain
+ * @return true if the records were written, false otherwise
+ */
+bool trace_flush(trace_t *self);
+
+/*
+ * Stops the streaming thread, drains the rings a last time and closes the
+ * file.
+ *
+ * @param self The trace to invalidate
+ * @return true if successful, false otherwise
+ */
+bool invalidate_trace(trace_t *self);
+
+/*
+ * Timestamps an event. Only the ring's owner may call this.
+ *
+ * @param ring The calling thread's ring
+ * @param event What happened
+ * @param conn The connection's id
+ * @param seq The frame's sequence number on the connection
+ * @param op The request code, if it is known yet
+ * @param status The response code, if there is one yet
+ */
+static inline void trace_record(trace_ring_t *ring, trace_event_t event, uint32_t conn, uint32_t seq,
+    uint8_t op, uint32_t status) {
+    trace_record_t *record = &ring->records[ring->head & ring->mask];
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *record = (trace_record_t) {.ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, .conn = conn,
+        .seq = seq, .event = event, .op = op, .thread = ring->thread, .status = status};
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
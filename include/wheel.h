@@ -0,0 +1,93 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A timer, embedded in whatever it times. It is linked into the wheel while
+ * armed and unlinked, with next NULL, otherwise.
+ */
+typedef struct wheel_timer_t {
+    struct wheel_timer_t *next;
+    struct wheel_timer_t *prev;
+    uint64_t expires;
+} wheel_timer_t;
+
+/*
+ * A hashed timing wheel. A timer lands in the slot of the tick it expires
+ * in, modulo the number of slots, so arming and disarming are a list insert
+ * and unlink. Advancing visits only the slots of the ticks that passed, and
+ * leaves the timers there that are due on a later turn of the wheel. Timers
+ * fire up to one tick late. Not thread safe.
+ */
+typedef struct wheel_t {
+    // circular lists, one per slot, headed by a sentinel
+    wheel_timer_t *slots;
+    uint64_t mask;
+    uint64_t tick;
+    // the first tick not yet advanced past
+    uint64_t current;
+    // timers advanced past but not yet returned
+    wheel_timer_t due;
+    size_t armed;
+} wheel_t;
+
+/*
+ * Creates an empty wheel.
+ *
+ * @param slots The number of slots; a power of two
+ * @param tick The units of time, such as milliseconds, each slot spans
+ * @param now The current time, in the units timers expire in
+ * @return A pointer to the new wheel_t instance, or NULL on error
+ */
+wheel_t *create_wheel(uint32_t slots, uint64_t tick, uint64_t now);
+
+/*
+ * Frees the wheel's slots. Timers still armed are left linked to nothing.
+ *
+ * @param self The wheel to invalidate
+ * @return true if successful, false otherwise
+ */
+bool invalidate_wheel(wheel_t *self);
+
+/*
+ * Arms a timer, moving it if it is already armed. A time already passed
+ * fires on the next advance past a tick.
+ *
+ * @param self The wheel
+ * @param timer The timer, zeroed or disarmed the first time
+ * @param expires When it fires
+ */
+void wheel_arm(wheel_t *self, wheel_timer_t *timer, uint64_t expires);
+
+/*
+ * Disarms a timer. Disarming one that isn't armed does nothing.
+ *
+ * @param self The wheel
+ * @param timer The timer
+ */
+void wheel_disarm(wheel_t *self, wheel_timer_t *timer);
+
+/*
+ * Returns the timers that have expired by now, one per call, disarming each.
+ * Call it until it returns NULL.
+ *
+ * @param self The wheel
+ * @param now The current time
+ * @return An expired timer, or NULL once there are none left
+ */
+wheel_timer_t *wheel_expire(wheel_t *self, uint64_t now);
+
+/*
+ * Whether a timer is armed.
+ *
+ * @param timer The timer
+ * @return true if it is linked into a wheel
+ */
+static inline bool wheel_armed(wheel_timer_t *timer) {
+    return timer->next != NULL;
+}
+
+#endif
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+#include "arena.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+#define CHUNK_PREFIX sizeof(uint64_t)
+
+// one prefault thread's share of the mapping
+typedef struct arena_slice_t {
+    char *from;
+    size_t len;
+    size_t stride;
+} arena_slice_t;
+
+static int size_class(size_t len){
+    int cls = ARENA_MIN_SHIFT;
+
+    while(((size_t)1 << cls) < len + CHUNK_PREFIX){
+        cls++;
+    }
+    return cls;
+}
+
+/*
+ * Maps size bytes, a multiple of ARENA_HUGE_PAGE, from the hugetlb pool if it
+ * can hold them, and otherwise as normal memory aligned to a huge page and
+ * advised to be backed by transparent huge pages.
+ */
+static char *map_huge(arena_t *self, size_t size, int flags){
+    char *base, *aligned;
+
+    if(flags & ARENA_SHARED){
+        // the pool is reserved at mmap time, so an empty pool fails here
+        if((self->fd = memfd_create("cream", MFD_HUGETLB)) >= 0){
+            if(ftruncate(self->fd, size) == 0 &&
+                (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0)) != MAP_FAILED){
+                self->pages = ARENA_PAGES_HUGETLB;
+                return base;
+            }
+            close(self->fd);
+        }
+        if((self->fd = memfd_create("cream", 0)) < 0 || ftruncate(self->fd, size) < 0 ||
+            (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0)) == MAP_FAILED){
+            return MAP_FAILED;
+        }
+    } else {
+        if((base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+            -1, 0)) != MAP_FAILED){
+            self->pages = ARENA_PAGES_HUGETLB;
+            return base;
+        }
+
+        // over-map by a huge page and trim both ends so the range is aligned
+        if((base = mmap(NULL, size + ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+            -1, 0)) == MAP_FAILED){
+            return MAP_FAILED;
+        }
+        aligned = (char *)(((uintptr_t)base + ARENA_HUGE_PAGE - 1) & ~(uintptr_t)(ARENA_HUGE_PAGE - 1));
+        if(aligned > base){
+            munmap(base, aligned - base);
+        }
+        munmap(aligned + size, base + ARENA_HUGE_PAGE - aligned);
+        base = aligned;
+    }
+
+    if(madvise(base, size, MADV_HUGEPAGE) == 0){
+        self->pages = ARENA_PAGES_THP;
+    }
+    return base;
+}
+
+arena_t *create_arena(size_t size, int flags) {
+    arena_t *new_arena;
+
+    if(size < sizeof(arena_header_t) + ARENA_ALIGN){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_arena = calloc(1, sizeof(arena_t))) == NULL){
+        return NULL;
+    }
+
+    // back shared arenas with a memfd so the segment outlives this process
+    new_arena->fd = -1;
+    new_arena->pages = ARENA_PAGES_SMALL;
+    if(flags & ARENA_HUGE){
+        size = (size + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+        new_arena->base = map_huge(new_arena, size, flags);
+    } else if(flags & ARENA_SHARED){
+        if((new_arena->fd = memfd_create("cream", 0)) < 0 || ftruncate(new_arena->fd, size) < 0){
+            if(new_arena->fd >= 0){ close(new_arena->fd); }
+            free(new_arena);
+            return NULL;
+        }
+        new_arena->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, new_arena->fd, 0);
+    } else {
+        new_arena->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if(new_arena->base == MAP_FAILED){
+        if(new_arena->fd >= 0){ close(new_arena->fd); }
+        free(new_arena);
+        return NULL;
+    }
+
+    new_arena->size = size;
+    new_arena->delta = 0;
+    new_arena->detached = false;
+    new_arena->header = (arena_header_t *)new_arena->base;
+    new_arena->header->magic = ARENA_MAGIC;
+    new_arena->header->size = size;
+    new_arena->header->used = (sizeof(arena_header_t) + ARENA_ALIGN - 1) & ~(uint64_t)(ARENA_ALIGN - 1);
+    new_arena->header->base = (uint64_t)new_arena->base;
+
+    pthread_mutex_init(&new_arena->lock, NULL);
+
+    return new_arena;
+}
+
+arena_t *attach_arena(int fd) {
+    arena_t *new_arena;
+    arena_header_t header;
+    struct stat st;
+    struct statfs fs;
+
+    if(fstat(fd, &st) < 0 || st.st_size < sizeof(arena_header_t) ||
+        pread(fd, &header, sizeof(arena_header_t), 0) != sizeof(arena_header_t) ||
+        header.magic != ARENA_MAGIC || header.size != st.st_size){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_arena = calloc(1, sizeof(arena_t))) == NULL){
+        return NULL;
+    }
+
+    if((new_arena->base = mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED){
+        free(new_arena);
+        return NULL;
+    }
+
+    new_arena->fd = fd;
+    new_arena->size = header.size;
+    new_arena->pages = fstatfs(fd, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC ? ARENA_PAGES_HUGETLB : ARENA_PAGES_SMALL;
+    new_arena->header = (arena_header_t *)new_arena->base;
+    new_arena->delta = new_arena->base - (char *)new_arena->header->base;
+    new_arena->header->base = (uint64_t)new_arena->base;
+    new_arena->detached = false;
+
+    pthread_mutex_init(&new_arena->lock, NULL);
+
+    return new_arena;
+}
+
+static void *prefault_slice(void *arg){
+    arena_slice_t *slice = arg;
+    volatile char *byte;
+
+    for(size_t off = 0; off < slice->len; off += slice->stride){
+        byte = slice->from + off;
+        *byte = *byte;
+    }
+    return NULL;
+}
+
+bool arena_prefault(arena_t *self, int threads) {
+    arena_slice_t *slices;
+    pthread_t *tids;
+    size_t pages, stride, from, to;
+    int started, err = 0;
+
+    if(threads < 1){
+        errno = EINVAL;
+        return false;
+    }
+
+    // hugetlb pages fault in whole, everything else may fall back to small pages
+    stride = self->pages == ARENA_PAGES_HUGETLB ? ARENA_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+    pages = self->size / stride;
+    if(threads > pages){
+        threads = pages;
+    }
+    slices = calloc(threads, sizeof(arena_slice_t));
+    tids = calloc(threads, sizeof(pthread_t));
+    if(slices == NULL || tids == NULL){
+        free(slices);
+        free(tids);
+        return false;
+    }
+
+    for(started = 0; started < threads; started++){
+        from = pages * started / threads;
+        to = pages * (started + 1) / threads;
+        slices[started] = (arena_slice_t) {.from = self->base + from * stride, .len = (to - from) * stride,
+            .stride = stride};
+        if((err = pthread_create(&tids[started], NULL, prefault_slice, &slices[started])) != 0){
+            break;
+        }
+    }
+    for(int i = 0; i < started; i++){
+        pthread_join(tids[i], NULL);
+    }
+    free(slices);
+    free(tids);
+
+    if(err != 0){
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+void *arena_alloc(arena_t *self, size_t len) {
+    int cls = size_class(len);
+    uint64_t off;
+    char *chunk;
+
+    if(cls >= ARENA_CLASSES){
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    if(self->detached){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // reuse a freed chunk of the same class, or carve a new one
+    if((off = self->header->free_lists[cls]) != 0){
+        chunk = self->base + off;
+        memcpy(&self->header->free_lists[cls], chunk + CHUNK_PREFIX, sizeof(uint64_t));
+    } else {
+        if(self->header->used + ((uint64_t)1 << cls) > self->size){
+            pthread_mutex_unlock(&self->lock);
+            errno = ENOMEM;
+            return NULL;
+        }
+        chunk = self->base + self->header->used;
+        self->header->used += (uint64_t)1 << cls;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    *(uint64_t *)chunk = cls;
+    return chunk + CHUNK_PREFIX;
+}
+
+void *arena_calloc(arena_t *self, size_t len) {
+    void *ptr;
+
+    if((ptr = arena_alloc(self, len)) != NULL){
+        memset(ptr, 0, len);
+    }
+    return ptr;
+}
+
+void arena_free(arena_t *self, void *ptr) {
+    char *chunk = (char *)ptr - CHUNK_PREFIX;
+    uint64_t cls;
+
+    if(ptr == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    if(self->detached){
+        pthread_mutex_unlock(&self->lock);
+        return;
+    }
+
+    // push the chunk onto the free list of its class
+    cls = *(uint64_t *)chunk;
+    memcpy(chunk + CHUNK_PREFIX, &self->header->free_lists[cls], sizeof(uint64_t));
+    self->header->free_lists[cls] = chunk - self->base;
+    pthread_mutex_unlock(&self->lock);
+}
+
+uint64_t arena_offset(arena_t *self, void *ptr) {
+    return (char *)ptr - self->base;
+}
+
+void *arena_ptr(arena_t *self, uint64_t offset) {
+    return self->base + offset;
+}
+
+bool detach_arena(arena_t *self) {
+    pthread_mutex_lock(&self->lock);
+    if(self->detached){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+    self->header->base = (uint64_t)self->base;
+    self->detached = true;
+    pthread_mutex_unlock(&self->lock);
+
+    return true;
+}
+
+bool invalidate_arena(arena_t *self) {
+    if(munmap(self->base, self->size) < 0){
+        return false;
+    }
+    if(self->fd >= 0){
+        close(self->fd);
+    }
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+
+    return true;
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include "chan.h"
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// the rings' data starts on the page after the chan_shm_t
+#define CHAN_DATA_OFFSET 4096
+#define CHAN_RECORD(len) (((uint64_t)(len) + 8 + 7) & ~(uint64_t)7)
+
+static chan_t *map_chan(int fd, size_t len, uint32_t ring_size) {
+    chan_t *new_chan;
+
+    if((new_chan = calloc(1, sizeof(chan_t))) == NULL){
+        return NULL;
+    }
+    if((new_chan->shm = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED){
+        free(new_chan);
+        return NULL;
+    }
+    new_chan->fd = fd;
+    new_chan->len = len;
+    new_chan->mask = ring_size - 1;
+    new_chan->data[CHAN_REQUESTS] = (char *)new_chan->shm + CHAN_DATA_OFFSET;
+    new_chan->data[CHAN_RESPONSES] = new_chan->data[CHAN_REQUESTS] + ring_size;
+
+    return new_chan;
+}
+
+chan_t *create_chan(uint32_t ring_size) {
+    size_t len = CHAN_DATA_OFFSET + 2 * (size_t)ring_size;
+    chan_t *new_chan;
+    int fd;
+
+    if(ring_size < 4096 || (ring_size & (ring_size - 1)) != 0){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((fd = memfd_create("cream-chan", MFD_CLOEXEC)) < 0){
+        return NULL;
+    }
+    if(ftruncate(fd, len) < 0 || (new_chan = map_chan(fd, len, ring_size)) == NULL){
+        close(fd);
+        return NULL;
+    }
+    new_chan->shm->ring_size = ring_size;
+    new_chan->shm->magic = CHAN_MAGIC;
+
+    return new_chan;
+}
+
+chan_t *attach_chan(int fd) {
+    chan_shm_t shm;
+    struct stat st;
+    chan_t *new_chan;
+
+    if(fstat(fd, &st) < 0){
+        return NULL;
+    }
+    if(st.st_size < CHAN_DATA_OFFSET || pread(fd, &shm, sizeof(shm), 0) != sizeof(shm) ||
+        shm.magic != CHAN_MAGIC || shm.ring_size < 4096 || (shm.ring_size & (shm.ring_size - 1)) != 0 ||
+        (size_t)st.st_size < CHAN_DATA_OFFSET + 2 * (size_t)shm.ring_size){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_chan = map_chan(fd, CHAN_DATA_OFFSET + 2 * (size_t)shm.ring_size, shm.ring_size)) == NULL){
+        return NULL;
+    }
+    return new_chan;
+}
+
+bool invalidate_chan(chan_t *self) {
+    if(self == NULL || self->shm == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    munmap(self->shm, self->len);
+    close(self->fd);
+    self->shm = NULL;
+    return true;
+}
+
+/*
+ * Wakes the other side if it is asleep on bell. The fence orders the
+ * caller's store to head or tail before the load of the flag, as the
+ * waiter's store to the flag comes before it checks head or tail again.
+ */
+static void ring_bell(uint32_t *waiting, uint32_t *bell) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(waiting, __ATOMIC_RELAXED)){
+        __atomic_add_fetch(bell, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, bell, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+void *chan_reserve(chan_t *self, int ring, uint32_t len) {
+    chan_ring_t *r = &self->shm->rings[ring];
+    uint64_t size = self->mask + 1, need = CHAN_RECORD(len), tail = r->tail, head, offset, skip;
+
+    if(need > size / 2){
+        errno = EMSGSIZE;
+        return NULL;
+    }
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if(tail - head > size){
+        errno = EPROTO;
+        return NULL;
+    }
+
+    // a record that would run past the end starts over at the beginning
+    offset = tail & self->mask;
+    skip = size - offset < need ? size - offset : 0;
+    if(tail + skip + need - head > size){
+        self->full_head[ring] = head;
+        errno = EAGAIN;
+        return NULL;
+    }
+    if(skip != 0){
+        *(uint32_t *)(self->data[ring] + offset) = CHAN_WRAP;
+    }
+    self->reserved[ring] = tail + skip;
+    return self->data[ring] + ((tail + skip) & self->mask) + 8;
+}
+
+void chan_commit(chan_t *self, int ring, uint32_t len) {
+    chan_ring_t *r = &self->shm->rings[ring];
+
+    *(uint32_t *)(self->data[ring] + (self->reserved[ring] & self->mask)) = len;
+    __atomic_store_n(&r->tail, self->reserved[ring] + CHAN_RECORD(len), __ATOMIC_RELEASE);
+    ring_bell(&r->consumer_waiting, &r->data_bell);
+}
+
+void *chan_peek(chan_t *self, int ring, uint32_t *len) {
+    chan_ring_t *r = &self->shm->rings[ring];
+    uint64_t size = self->mask + 1, head = r->head, tail, offset;
+    uint32_t record;
+
+    for(;;){
+        tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if(head == tail){
+            errno = EAGAIN;
+            return NULL;
+        }
+        if(tail - head > size){
+            errno = EPROTO;
+            return NULL;
+        }
+        offset = head & self->mask;
+        record = __atomic_load_n((uint32_t *)(self->data[ring] + offset), __ATOMIC_RELAXED);
+        if(record != CHAN_WRAP){
+            break;
+        }
+        // the producer skipped the rest of the ring
+        head += size - offset;
+        __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+    }
+    if(CHAN_RECORD(record) > size - offset || CHAN_RECORD(record) > tail - head){
+        errno = EPROTO;
+        return NULL;
+    }
+
+    self->peeked[ring] = record;
+    *len = record;
+    return self->data[ring] + offset + 8;
+}
+
+void chan_consume(chan_t *self, int ring) {
+    chan_ring_t *r = &self->shm->rings[ring];
+
+    __atomic_store_n(&r->head, r->head + CHAN_RECORD(self->peeked[ring]), __ATOMIC_RELEASE);
+    ring_bell(&r->producer_waiting, &r->space_bell);
+}
+
+static bool chan_ready(chan_t *self, int ring, bool producer) {
+    chan_ring_t *r = &self->shm->rings[ring];
+
+    if(producer){
+        return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != self->full_head[ring];
+    }
+    return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) != r->head;
+}
+
+bool chan_wait(chan_t *self, int ring, bool producer, int timeout_ms) {
+    chan_ring_t *r = &self->shm->rings[ring];
+    uint32_t *waiting = producer ? &r->producer_waiting : &r->consumer_waiting;
+    uint32_t *bell = producer ? &r->space_bell : &r->data_bell, seen;
+    struct timespec timeout = {.tv_sec = timeout_ms / 1000, .tv_nsec = (long)(timeout_ms % 1000) * 1000000};
+
+    // the other side is usually a few hundred nanoseconds behind, well short
+    // of a futex round trip
+    for(int i = 0; i < CHAN_SPINS; i++){
+        if(chan_ready(self, ring, producer)){
+            return true;
+        }
+    }
+
+    seen = __atomic_load_n(bell, __ATOMIC_ACQUIRE);
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if(!chan_ready(self, ring, producer)){
+        syscall(SYS_futex, bell, FUTEX_WAIT, seen, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+
+    return chan_ready(self, ring, producer);
+}
@@ -0,0 +1,57 @@
+#include "codel.h"
+#include <string.h>
+
+// the next drop is interval / sqrt(count) after t
+static uint64_t control_law(codel_t *self, uint64_t t){
+    uint64_t root = 1;
+
+    while((root + 1) * (root + 1) <= self->count){
+        root++;
+    }
+    return t + self->interval / root;
+}
+
+void codel_init(codel_t *self, uint64_t target, uint64_t interval) {
+    memset(self, 0, sizeof(codel_t));
+    self->target = target;
+    self->interval = interval;
+}
+
+bool codel_drop(codel_t *self, uint64_t sojourn, uint64_t now) {
+    bool ok_to_drop = false;
+    uint32_t delta;
+
+    // the delay has to stay above target for a whole interval
+    if(sojourn < self->target){
+        self->first_above = 0;
+    } else if(self->first_above == 0){
+        self->first_above = now + self->interval;
+    } else if(now >= self->first_above){
+        ok_to_drop = true;
+    }
+
+    if(self->dropping){
+        if(!ok_to_drop){
+            self->dropping = false;
+            return false;
+        }
+        if(now >= self->drop_next){
+            self->count++;
+            self->drop_next = control_law(self, self->drop_next);
+            return true;
+        }
+        return false;
+    }
+
+    if(!ok_to_drop){
+        return false;
+    }
+
+    // resume near the old drop rate if the last dropping spell ended recently
+    self->dropping = true;
+    delta = self->count - self->last_count;
+    self->count = delta > 1 && now - self->drop_next < 16 * self->interval ? delta : 1;
+    self->last_count = self->count;
+    self->drop_next = control_law(self, now);
+    return true;
+}
@@ -0,0 +1,167 @@
+#include "conn.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+conn_t *create_conn(int fd) {
+    conn_t *new_conn;
+
+    if((new_conn = calloc(1, sizeof(conn_t))) == NULL){
+        return NULL;
+    }
+    new_conn->fd = fd;
+    new_conn->refs = 1;
+    pthread_mutex_init(&new_conn->write_lock, NULL);
+
+    return new_conn;
+}
+
+void conn_hold(conn_t *self) {
+    __sync_fetch_and_add(&self->refs, 1);
+}
+
+void conn_release(conn_t *self) {
+    if(__sync_sub_and_fetch(&self->refs, 1) == 0){
+        close(self->fd);
+        pthread_mutex_destroy(&self->write_lock);
+        free(self->in);
+        free(self->out);
+        free(self);
+    }
+}
+
+bool conn_read(conn_t *self, void *buf, size_t len) {
+    ssize_t n;
+
+    while(len > 0){
+        if((n = read(self->fd, buf, len)) <= 0){
+            if(n < 0 && errno == EINTR){ continue; }
+            return false;
+        }
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return true;
+}
+
+bool conn_fill(conn_t *self, size_t max) {
+    size_t cap;
+    ssize_t n;
+    char *buf;
+
+    for(;;){
+        if(self->in_len == self->in_cap){
+            if(self->in_cap >= max){ return true; }
+            cap = self->in_cap == 0 ? CONN_BUFSIZE : self->in_cap * 2;
+            cap = cap > max ? max : cap;
+            if((buf = realloc(self->in, cap)) == NULL){ return false; }
+            self->in = buf;
+            self->in_cap = cap;
+        }
+        if((n = recv(self->fd, self->in + self->in_len, self->in_cap - self->in_len, MSG_DONTWAIT)) <= 0){
+            if(n < 0 && errno == EINTR){ continue; }
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        self->in_len += n;
+    }
+}
+
+void conn_consume(conn_t *self, size_t len) {
+    memmove(self->in, self->in + len, self->in_len - len);
+    self->in_len -= len;
+}
+
+bool conn_queue(conn_t *self, struct iovec *iov, int iovcnt) {
+    size_t len = 0, cap;
+    char *buf;
+    int i;
+
+    for(i = 0; i < iovcnt; i++){
+        len += iov[i].iov_len;
+    }
+    if(self->out_len + len > self->out_cap){
+        for(cap = self->out_cap == 0 ? CONN_BUFSIZE : self->out_cap; cap < self->out_len + len; cap *= 2);
+        if((buf = realloc(self->out, cap)) == NULL){ return false; }
+        self->out = buf;
+        self->out_cap = cap;
+    }
+    for(i = 0; i < iovcnt; i++){
+        memcpy(self->out + self->out_len, iov[i].iov_base, iov[i].iov_len);
+        self->out_len += iov[i].iov_len;
+    }
+    return true;
+}
+
+bool conn_flush(conn_t *self) {
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < self->out_len){
+        if((n = send(self->fd, self->out + done, self->out_len - done, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0){
+            if(errno == EINTR){ continue; }
+            if(errno == EAGAIN || errno == EWOULDBLOCK){ break; }
+            return false;
+        }
+        done += n;
+    }
+    memmove(self->out, self->out + done, self->out_len - done);
+    self->out_len -= done;
+    // only a client that stops taking responses runs the deadline out
+    if(self->out_len == 0 || done > 0 || self->write_deadline == 0){
+        conn_deadline(self, &self->write_deadline, self->out_len > 0);
+    }
+    return true;
+}
+
+bool conn_send(conn_t *self, struct iovec *iov, int iovcnt) {
+    return conn_sendfd(self, iov, iovcnt, -1);
+}
+
+bool conn_sendfd(conn_t *self, struct iovec *iov, int iovcnt, int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = {0};
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    // the fd rides on the first write, which carries at least one byte
+    if(fd >= 0){
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    pthread_mutex_lock(&self->write_lock);
+    conn_deadline(self, &self->write_deadline, true);
+    while(iovcnt > 0){
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        if((n = sendmsg(self->fd, &msg, 0)) < 0){
+            if(errno == EINTR){ continue; }
+            conn_deadline(self, &self->write_deadline, false);
+            pthread_mutex_unlock(&self->write_lock);
+            return false;
+        }
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+        // skip the fully written buffers and trim the partial one
+        while(iovcnt > 0 && n >= (ssize_t)iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    conn_deadline(self, &self->write_deadline, false);
+    pthread_mutex_unlock(&self->write_lock);
+
+    return true;
+}
@@ -1,7 +1,19 @@
+#define _GNU_SOURCE
 #include "cream.h"
 #include "utils.h"
 #include "queue.h"
 #include "cream_add.h"
+#include "journal.h"
+#include "arena.h"
+#include "handover.h"
+#include "tier.h"
+#include "conn.h"
+#include "lease.h"
+#include "stats.h"
+#include "trace.h"
+#include "probes.h"
+#include "ring.h"
+#include "codel.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,80 +21,515 @@
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sched.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <stddef.h>
 
 hashmap_t *resp_hash;
-queue_t *con_que;
+// connections with a frame waiting for a worker, on one lane unless -P or -K
+lanes_t *con_lanes;
+journal_t *journal;
+arena_t *store;
+tier_t *tier;
+// entries the calling thread's last put pushed out, not yet in the tier
+__thread cream_spill_t spills[MAX_BATCH_KEYS];
+__thread int num_spills;
+lease_table_t *leases;
+stats_t *stats;
+// the calling thread's counters; after the workers' come the main thread's
+// block and the shedding thread's
+__thread stats_block_t *stats_local;
+trace_t *trace;
+__thread trace_ring_t *trace_local;
+uint32_t next_conn_id;
+// shared-nothing mode: shard i sends to shard j on shard_rings[i * num_shards + j]
+cream_shard_t *shards;
+ring_t **shard_rings;
+int num_shards;
+// -A placement; workers wait at placed until the node table is touched
+int *worker_cpus;
+int num_cpus;
+pthread_barrier_t placed;
+// the worker pool; workers own the stats block and trace ring of their slot
+int min_workers, max_workers, live_workers;
+int pool_wait_ms, pool_idle_ms;
+bool *worker_slots;
+uint64_t pool_grown, pool_retired;
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+// set once the first workers are placed, so workers added later skip it
+volatile bool serving;
+// -B and -C: connections that found their lane full wait on shed_que to be
+// answered BUSY, and each worker sheds on its own view of the queue delay
+queue_t *shed_que;
+int codel_target_ms;
+__thread codel_t codel_local;
+uint64_t shed_full, shed_delay;
+// -K: workers in the first reserved_workers slots only serve LANE_READ
+int reserved_workers;
+// -i, -o and -m: every connection's timer sits on conn_wheel, and its
+// address is counted in conn_peers, both under conn_lock. each shard turns
+// a wheel of its own instead
+int conn_idle_ms, conn_io_ms;
+wheel_t *conn_wheel;
+peers_t *conn_peers;
+pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+// -U: the UNIX socket, and which of the channel slots have a thread
+int unix_fd = -1;
+bool chan_slots[CHAN_MAX];
+int chan_open;
+pthread_mutex_t chan_lock = PTHREAD_MUTEX_INITIALIZER;
+// -u: the UDP socket on the port
+int udp_fd = -1;
+int listen_fd = -1, handover_fd = -1, epoll_fd = -1;
+int busy_workers;
+uint32_t max_value_size = MAX_VALUE_SIZE;
+pthread_t main_thread;
+volatile sig_atomic_t handing_over;
+volatile sig_atomic_t dump_requested;
 
 void null_handler(int signo);
 void null_handler(int signo){
 }
 
+void dump_handler(int signo);
+void dump_handler(int signo){
+    dump_requested = 1;
+}
+
 int main(int argc, char *argv[]) {
     // declare arg vars
-    int num_workers, port, hash_size;
+    cream_opts_t opts;
     // declare socket vars
-    int *connfd, sockfd;
+    struct epoll_event ev, events[CREAM_EVENTS];
+    conn_t *conn;
+    bool listening = true;
+    int ready;
     // declare thread vars
     pthread_t threadID;
+    struct sigaction sa;
+    sigset_t dump_mask, wait_mask;
+    bool inherited = false;
 
     // setup signal handlers
     signal(SIGINT, null_handler);
     signal(SIGPIPE, null_handler);
 
+    // SIGUSR2 interrupts accept when the store is handed over
+    bzero(&sa, sizeof(sa));
+    sa.sa_handler = null_handler;
+    sigaction(SIGUSR2, &sa, NULL);
+
+    // SIGUSR1 dumps the STATS text to stderr and the trace rings to their file
+    sa.sa_handler = dump_handler;
+    sigaction(SIGUSR1, &sa, NULL);
+    main_thread = pthread_self();
+
     // initialize global vars using input values
-    parseargs(argc, argv, &num_workers, &port, &hash_size);
-    resp_hash = create_map(hash_size, jenkins_one_at_a_time_hash, destroymapnode);
-    con_que = create_queue();
+    parseargs(argc, argv, &opts);
+    max_value_size = (uint32_t)opts.max_value_kb * 1024;
+    worker_cpus = opts.cpus;
+    num_cpus = opts.num_cpus;
+    min_workers = opts.num_workers;
+    max_workers = opts.max_workers;
+    pool_wait_ms = opts.pool_wait_ms;
+    pool_idle_ms = opts.pool_idle_ms;
+    codel_target_ms = opts.codel_target_ms;
+    reserved_workers = opts.reserved_workers;
+    conn_idle_ms = opts.conn_idle_ms;
+    conn_io_ms = opts.conn_io_ms;
+    if(!opts.sharded && (conn_idle_ms != 0 || conn_io_ms != 0) &&
+        (conn_wheel = create_wheel(CONN_WHEEL_SLOTS, CONN_WHEEL_TICK_MS, conn_clock())) == NULL){
+        perror("wheel");
+        exit(EXIT_FAILURE);
+    }
+    if(opts.conn_per_ip != 0 && (conn_peers = create_peers(CONN_PEERS_SLOTS, opts.conn_per_ip)) == NULL){
+        perror("peers");
+        exit(EXIT_FAILURE);
+    }
+    if(opts.restart_path != NULL){
+        inherited = creamstoreinit(&opts);
+    } else if(opts.huge){
+        creamhugeinit(&opts);
+    } else if(!opts.sharded){
+        resp_hash = create_map(opts.hash_size, jenkins_one_at_a_time_hash, destroymapnode);
+    }
+    if((con_lanes = create_lanes(opts.lanes ? CREAM_LANES : 1, opts.lane_weights, opts.queue_max)) == NULL){
+        perror("lanes");
+        exit(EXIT_FAILURE);
+    }
+    if((stats = create_stats(max_workers + 3 + CHAN_MAX)) == NULL ||
+        (worker_slots = calloc(max_workers, sizeof(bool))) == NULL){
+        perror("stats");
+        exit(EXIT_FAILURE);
+    }
+    stats_local = stats_block(stats, max_workers);
+    if(opts.trace_path != NULL){
+        if((trace = create_trace(opts.trace_path, max_workers + 2, TRACE_RING_SIZE,
+            opts.trace_interval)) == NULL){
+            perror("trace");
+            exit(EXIT_FAILURE);
+        }
+        trace_local = trace_ring(trace, max_workers);
+    }
+    if((leases = create_lease_table(LEASE_SLOTS, opts.lease_ms)) == NULL){
+        perror("leases");
+        exit(EXIT_FAILURE);
+    }
+
+    // in shared-nothing mode the shards run their own event loops, and this
+    // thread is only left to dump stats
+    if(opts.sharded){
+        sigemptyset(&dump_mask);
+        sigaddset(&dump_mask, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &dump_mask, &wait_mask);
+        creamshardinit(&opts);
+        live_workers = opts.num_workers;
+        for(long i = 0; i < opts.num_workers; i++){
+            pthread_create(&threadID, NULL, (void *)creamshard, (void *)i);
+        }
+        for(;;){
+            sigsuspend(&wait_mask);
+            if(dump_requested){
+                dump_requested = 0;
+                creamdump();
+            }
+        }
+    }
+
+    // spill evicted entries to disk
+    if(opts.tier_path != NULL){
+        if((tier = create_tier(opts.tier_path, (uint64_t)opts.tier_size << 20)) == NULL){
+            perror("tier");
+            exit(EXIT_FAILURE);
+        }
+        resp_hash->evict_function = creamspill;
+        resp_hash->forget_function = creamforget;
+    }
+
+    // restore the store from the journal before serving, unless a
+    // predecessor handed over a store that is already current
+    if(opts.journal_path != NULL){
+        if((journal = create_journal(opts.journal_path, opts.sync_interval, resp_hash)) == NULL){
+            perror("journal");
+            exit(EXIT_FAILURE);
+        }
+        if(!inherited && !replay_journal(journal, creamreplay, opts.num_workers)){
+            perror("journal replay");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // create worker threads. they block SIGUSR1, so it interrupts the
+    // event loop, which does the dumping
+    sigemptyset(&dump_mask);
+    sigaddset(&dump_mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &dump_mask, NULL);
+    if(worker_cpus != NULL){
+        pthread_barrier_init(&placed, NULL, opts.num_workers + 1);
+    }
+    live_workers = opts.num_workers;
+    for(long i = 0; i < opts.num_workers; i ++){
+        worker_slots[i] = true;
+        if(!creamspawn(i)){
+            perror("worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // the table is touched in place, so nothing may be served until it is
+    if(worker_cpus != NULL){
+        pthread_barrier_wait(&placed);
+    }
+    serving = true;
+    if(max_workers > min_workers){
+        pthread_create(&threadID, NULL, (void *)creampool, NULL);
+    }
+    if(opts.queue_max > 0){
+        shed_que = create_queue();
+        pthread_create(&threadID, NULL, (void *)creamshed, NULL);
+    }
+
+    // init socket, unless it was inherited with the store
+    if(listen_fd < 0){
+        creamsockinit(&listen_fd, opts.port, false);
+    }
+    if(opts.unix_path != NULL){
+        creamunixinit(&unix_fd, opts.unix_path);
+    }
+    if(opts.udp){
+        creamudpinit(&udp_fd, opts.port);
+        pthread_create(&threadID, NULL, (void *)creamudp, NULL);
+    }
 
-    // create worker threads
-    for(long i = 0; i < num_workers; i ++){
-        // TODO create worker threads
-        pthread_create(&threadID, NULL, (void *)creamworker, (void *)i);
+    // serve hot restart requests from a successor
+    if(handover_fd >= 0){
+        pthread_create(&threadID, NULL, (void *)creamhandover, NULL);
     }
+    pthread_sigmask(SIG_UNBLOCK, &dump_mask, NULL);
 
-    // init socket
-    creamsockinit(&sockfd, port);
+    // watch the listening socket and every client connection
+    if((epoll_fd = epoll_create1(0)) < 0){
+        perror("epoll");
+        exit(EXIT_FAILURE);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0){
+        perror("epoll");
+        exit(EXIT_FAILURE);
+    }
+    ev.data.ptr = &unix_fd;
+    if(unix_fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, unix_fd, &ev) < 0){
+        perror("epoll");
+        exit(EXIT_FAILURE);
+    }
 
     for(;;){
-        connfd = calloc(1, sizeof(int));
-        if((*connfd = accept(sockfd, NULL, NULL)) < 0){
-            free(connfd);
+        if(dump_requested){
+            dump_requested = 0;
+            creamdump();
+        }
+
+        // the successor accepts from here on
+        if(handing_over && listening){
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, NULL);
+            if(unix_fd >= 0){
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, unix_fd, NULL);
+            }
+            listening = false;
+        }
+
+        // with connections timed, the wheel is turned every tick
+        if((ready = epoll_wait(epoll_fd, events, CREAM_EVENTS, conn_wheel != NULL ? CONN_WHEEL_TICK_MS : -1)) < 0){
             continue;
         }
-        enqueue(con_que, connfd);
+        for(int i = 0; i < ready; i++){
+            if(events[i].data.ptr == NULL || events[i].data.ptr == &unix_fd){
+                if(!handing_over){
+                    creamaccept(events[i].data.ptr == NULL ? listen_fd : unix_fd, events[i].data.ptr != NULL);
+                }
+            } else if(!handing_over){
+                // a worker reads the frame that arrived. once the store is
+                // handed over, clients reconnect to the successor instead
+                conn = events[i].data.ptr;
+                __atomic_store_n(&conn->state, CONN_BUSY, __ATOMIC_RELAXED);
+                conn->frames++;
+                TRACE(TRACE_ENQUEUE, conn->id, conn->frames, 0, 0);
+                if(!lanes_push(con_lanes, con_lanes->num_lanes > 1 ? creamlane(conn) : 0, conn) &&
+                    errno == EAGAIN){
+                    enqueue(shed_que, conn);
+                }
+            }
+        }
+        if(conn_wheel != NULL){
+            creamtimeouts();
+        }
     }
 
     exit(EXIT_SUCCESS);
 }
 
-void parseargs(int argc, char *argv[], int *num_workers, int *port, int *hash_size){
-    if(argc != 4){
+void parseargs(int argc, char *argv[], cream_opts_t *opts){
+    int opt;
+
+    bzero(opts, sizeof(cream_opts_t));
+    opts->store_size = STORE_DEFAULT_MB;
+    opts->tier_size = TIER_DEFAULT_MB;
+    opts->max_value_kb = MAX_VALUE_SIZE / 1024;
+    opts->lease_ms = LEASE_DEFAULT_MS;
+    opts->pool_wait_ms = POOL_WAIT_DEFAULT_MS;
+    opts->pool_idle_ms = POOL_IDLE_DEFAULT_MS;
+    opts->conn_io_ms = -1;
+    memcpy(opts->lane_weights, (int[CREAM_LANES]) LANE_WEIGHTS_DEFAULT, sizeof(opts->lane_weights));
+
+    // parse optional flags
+    while((opt = getopt(argc, argv, "hj:s:r:M:t:T:V:L:R:F:SA:HW:Q:I:B:C:P:K:i:o:m:U:u")) != -1){
+        switch(opt){
+            case 'j':
+                opts->journal_path = optarg;
+                break;
+            case 's':
+                if((opts->sync_interval = atoi(optarg)) < 0){
+                    USAGE();
+                }
+                break;
+            case 'r':
+                opts->restart_path = optarg;
+                break;
+            case 'M':
+                if((opts->store_size = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 't':
+                opts->tier_path = optarg;
+                break;
+            case 'T':
+                if((opts->tier_size = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'L':
+                if((opts->lease_ms = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'R':
+                opts->trace_path = optarg;
+                break;
+            case 'S':
+                opts->sharded = true;
+                break;
+            case 'H':
+                opts->huge = true;
+                break;
+            case 'W':
+                if((opts->max_workers = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'Q':
+                if((opts->pool_wait_ms = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'I':
+                if((opts->pool_idle_ms = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'B':
+                if((opts->queue_max = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'C':
+                if((opts->codel_target_ms = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'P':
+                opts->lanes = true;
+                if(sscanf(optarg, "%d:%d:%d", &opts->lane_weights[LANE_READ], &opts->lane_weights[LANE_WRITE],
+                    &opts->lane_weights[LANE_ADMIN]) != 3){
+                    USAGE();
+                }
+                break;
+            case 'K':
+                opts->lanes = true;
+                if((opts->reserved_workers = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'i':
+                if((opts->conn_idle_ms = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'o':
+                if((opts->conn_io_ms = atoi(optarg)) < 0){
+                    USAGE();
+                }
+                break;
+            case 'm':
+                if((opts->conn_per_ip = atoi(optarg)) <= 0){
+                    USAGE();
+                }
+                break;
+            case 'U':
+                opts->unix_path = optarg;
+                break;
+            case 'u':
+                opts->udp = true;
+                break;
+            case 'A':
+                if(!creamparsecpus(optarg, opts)){
+                    USAGE();
+                }
+                break;
+            case 'F':
+                if((opts->trace_interval = atoi(optarg)) < 0){
+                    USAGE();
+                }
+                break;
+            case 'V':
+                if((opts->max_value_kb = atoi(optarg)) <= 0 || opts->max_value_kb > MAX_VALUE_LIMIT_KB){
+                    USAGE();
+                }
+                break;
+            default:
+                USAGE();
+        }
+    }
+
+    // parse positional args
+    if(argc - optind != 3){
+        USAGE();
+    }
+
+    if((opts->num_workers = atoi(argv[optind])) == 0){
+        USAGE();
+    }
+
+    if((opts->port = atoi(argv[optind + 1])) == 0){
         USAGE();
     }
 
-    if((*num_workers = atoi(argv[1])) == 0){
+    if((opts->hash_size = atoi(argv[optind + 2])) == 0){
         USAGE();
     }
 
-    if((*port = atoi(argv[2])) == 0){
+    // without -W the pool stays at NUM_WORKERS
+    if(opts->max_workers == 0){
+        opts->max_workers = opts->num_workers;
+    }
+    // reserved workers leave at least one for every lane
+    if(opts->max_workers < opts->num_workers || opts->reserved_workers >= opts->num_workers ||
+        (opts->sharded && (opts->max_workers != opts->num_workers || opts->queue_max != 0 ||
+        opts->codel_target_ms != 0 || opts->lanes || opts->conn_per_ip != 0 || opts->unix_path != NULL ||
+        opts->udp))){
         USAGE();
     }
+    if(opts->conn_io_ms < 0){
+        opts->conn_io_ms = CONN_IO_DEFAULT_MS;
+    }
+    for(int i = 0; i < CREAM_LANES; i++){
+        if(opts->lane_weights[i] < 1){
+            USAGE();
+        }
+    }
 
-    if((*hash_size = atoi(argv[3])) == 0){
+    // the journal, tier, store and traces all assume one shared map
+    if(opts->sharded && (opts->journal_path != NULL || opts->restart_path != NULL ||
+        opts->tier_path != NULL || opts->trace_path != NULL || opts->huge)){
         USAGE();
     }
 }
 
-void creamsockinit(int *sockfd, int port){
+void creamsockinit(int *sockfd, int port, bool shared){
     struct sockaddr_in servaddr;
+    int one = 1;
 
     if((*sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0){
         perror("socket");
         exit(EXIT_FAILURE);
     }
 
+    // shards each listen on the port, and the kernel spreads connections
+    // across them
+    if(shared && setsockopt(*sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0){
+        perror("setsockopt");
+        exit(EXIT_FAILURE);
+    }
+
     bzero(&servaddr, sizeof(servaddr));
     servaddr.sin_family = AF_INET;
     servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -99,36 +546,186 @@ void creamsockinit(int *sockfd, int port){
     }
 }
 
+/*
+ * Listens on a UNIX socket at path, replacing whatever socket a previous
+ * server left there.
+ */
+void creamunixinit(int *sockfd, const char *path){
+    struct sockaddr_un servaddr = {.sun_family = AF_UNIX};
+
+    if(strlen(path) >= sizeof(servaddr.sun_path)){
+        fprintf(stderr, "socket path too long\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(servaddr.sun_path, path);
+    unlink(path);
+
+    if((*sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(*sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0 || listen(*sockfd, LISTENQ) < 0){
+        perror("unix socket");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Binds the UDP socket on the port. A successor taking over with -r binds
+ * it too while this server drains, so both share it.
+ */
+void creamudpinit(int *sockfd, int port){
+    struct sockaddr_in servaddr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(port)};
+    int one = 1;
+
+    if((*sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+        setsockopt(*sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+        bind(*sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0){
+        perror("udp socket");
+        exit(EXIT_FAILURE);
+    }
+}
+
 void creamworker(void *arg){
-    bool handled;
-    int *item, connfd, retry;
+    long index = (long)arg;
+    bool handled, v2, closing;
+    conn_t *conn;
     map_val_t val_node;
     map_key_t key_node;
     cmsg msg;
+    char *outbody;
+    uint32_t bodylen, inlinelen, request_id, conn_id, seq, budget_us;
+    uint64_t counter, version, token;
+    uint16_t flags;
+    uint8_t op, code;
+    response_header_v2_t v2resp;
+    struct iovec iov[3];
+    struct timespec queued, started, finished;
+    lanes_cursor_t cursor = {0};
+    int idle_ms = max_workers > min_workers ? pool_idle_ms : -1, chanfd;
+    stats_op_t kind;
+
+    stats_local = stats_block(stats, index);
+    trace_local = trace_ring(trace, index);
+    if(codel_target_ms > 0){
+        codel_init(&codel_local, (uint64_t)codel_target_ms * 1000000, (uint64_t)CODEL_INTERVAL_MS * 1000000);
+    }
+    if(worker_cpus != NULL && !serving){
+        creamplace(index, resp_hash, index, min_workers);
+        pthread_barrier_wait(&placed);
+    } else if(worker_cpus != NULL){
+        creamplace(index, NULL, 0, 1);
+    }
 
     for(;;){
-        retry = 0;
+        outbody = NULL;
+        inlinelen = 0;
+        closing = false;
+        chanfd = -1;
 
-        // pull item from que and dealloc the item
-        if((item = dequeue(con_que)) == NULL){
-            perror("deque");
+        // the event loop queues a connection when its next frame arrives.
+        // workers only time out when there are idle ones to retire
+        if(index < reserved_workers){
+            conn = lanes_pop_lane(con_lanes, LANE_READ, idle_ms, &queued);
+        } else {
+            conn = lanes_pop(con_lanes, &cursor, idle_ms, &queued);
+        }
+        if(conn == NULL){
+            if(errno == ETIMEDOUT){
+                if(creamretire(index)){
+                    return;
+                }
+            } else if(errno != EAGAIN){
+                perror("deque");
+            }
             continue;
         }
-        connfd = *item;
-        free(item);
+        __sync_fetch_and_add(&busy_workers, 1);
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        stats_record(&stats_local->queue_wait, (uint64_t)(started.tv_sec - queued.tv_sec) * 1000000000 +
+            started.tv_nsec - queued.tv_nsec);
+        // the connection isn't watched again until this frame is read, so
+        // frames still counts it
+        conn_id = conn->id;
+        seq = conn->frames;
+        TRACE(TRACE_DEQUEUE, conn_id, seq, 0, 0);
+        // the client has IO_MS to get the rest of the frame across
+        conn_deadline(conn, &conn->read_deadline, true);
 
-        // read from the socket
-        reread:
+        // read the header, then the body it announces
         bzero(&msg, CMSGSIZE);
-        if(read(connfd, &msg, CMSGSIZE) < sizeof(request_header_t)){
-            if(errno == EINTR){
-                retry ++;
-                if(retry > 10) { continue; }
-                goto reread;
-            }
+        if(!creamreadheader(conn, &msg.req.header, &v2, &request_id, &flags, &budget_us)){
+            creamdrop(conn);
+            __sync_fetch_and_sub(&busy_workers, 1);
+            continue;
         }
-        retry = 0;
         handled = false;
+        code = msg.req.header.request_code;
+        kind = creamstatsop(code);
+        map_probes = 0;
+
+        // a PUT value is streamed into its own allocation, not the message
+        val_node = MAP_VAL(NULL, 0);
+        bodylen = msg.req.header.key_size + msg.req.header.value_size;
+        if(msg.req.header.request_code == PUT){
+            bodylen = msg.req.header.key_size;
+        }
+        if(msg.req.header.request_code == MGET || msg.req.header.request_code == MPUT ||
+            msg.req.header.request_code == MDEL){
+            bodylen = msg.req.header.value_size;
+        }
+        if(bodylen > sizeof(msg.req.data) || bodylen < msg.req.header.key_size){
+            // the stream can't be followed past a body that isn't read
+            DBGPRINT("oversized req\n");
+            handled = true;
+            closing = true;
+            msg.resp.header.response_code = BAD_REQUEST;
+            msg.resp.header.value_size = 0;
+        } else if(msg.req.header.request_code == PUT && msg.req.header.value_size > max_value_size){
+            // too large to be worth draining, so the connection is closed
+            DBGPRINT("oversized put req\n");
+            handled = true;
+            closing = true;
+            msg.resp.header.response_code = BAD_REQUEST;
+            msg.resp.header.value_size = 0;
+        } else if(!conn_read(conn, msg.req.data, bodylen) ||
+            (msg.req.header.request_code == PUT && !creamreadvalue(conn, msg.req.header.value_size, &val_node))){
+            creamdrop(conn);
+            __sync_fetch_and_sub(&busy_workers, 1);
+            continue;
+        }
+        conn_deadline(conn, &conn->read_deadline, false);
+
+        // the client has given up on a request whose deadline passed while it
+        // was queued, so it is answered without the work
+        if(!handled && budget_us != 0 && creamexpired(&queued, budget_us)){
+            handled = true;
+            creamfree(val_node.val_base);
+            val_node = MAP_VAL(NULL, 0);
+            msg.resp.header.response_code = TIMEOUT;
+            msg.resp.header.value_size = 0;
+            stats_local->expired++;
+        }
+
+        // under a standing queue delay, answer before doing the work
+        if(!handled && codel_target_ms > 0 && codel_drop(&codel_local, (uint64_t)(started.tv_sec - queued.tv_sec) *
+            1000000000 + started.tv_nsec - queued.tv_nsec, (uint64_t)started.tv_sec * 1000000000 + started.tv_nsec)){
+            handled = true;
+            creamfree(val_node.val_base);
+            val_node = MAP_VAL(NULL, 0);
+            msg.resp.header.response_code = BUSY;
+            msg.resp.header.value_size = 0;
+            __sync_fetch_and_add(&shed_delay, 1);
+        }
+
+        TRACE(TRACE_PARSED, conn_id, seq, code, 0);
+        CREAM_PROBE5(request__start, conn_id, seq, code, msg.req.header.key_size, msg.req.header.value_size);
+
+        // the request holds its own reference from here. the next frame on a
+        // v2 connection can be read and answered while this one is served,
+        // unless it asks for a channel, which takes the connection over
+        conn_hold(conn);
+        if(v2 && !closing && code != CHANNEL && !creamwatch(conn, EPOLL_CTL_MOD)){
+            creamdrop(conn);
+        }
 
         // handle get requests
         if(!handled && msg.req.header.request_code == GET){
@@ -143,9 +740,8 @@ void creamworker(void *arg){
                 // search for key in hashmap
                 key_node.key_len = msg.req.header.key_size;
                 key_node.key_base = msg.req.data;
-                val_node = get(resp_hash, key_node);
                 // if not found set appropriate header info
-                if(val_node.val_base == NULL){
+                if(creamget(key_node, &val_node) == NOT_FOUND){
                     DBGPRINT("get req key not found\n");
                     msg.resp.header.response_code = NOT_FOUND;
                     msg.resp.header.value_size = 0;
@@ -154,9 +750,8 @@ void creamworker(void *arg){
                     DBGPRINT("get req key found\n");
                     msg.resp.header.response_code = OK;
                     msg.resp.header.value_size = val_node.val_len;
-                    memcpy(msg.resp.data, val_node.val_base, val_node.val_len);
-                    // free allocated memory from get call
-                    free(val_node.val_base);
+                    // send the copy from the get call as is; it is freed once sent
+                    outbody = val_node.val_base;
                 }
             }
         }
@@ -167,46 +762,29 @@ void creamworker(void *arg){
             handled = true;
             // validity check
             if(msg.req.header.key_size < MIN_KEY_SIZE || msg.req.header.key_size > MAX_KEY_SIZE ||
-                msg.req.header.value_size < MIN_VALUE_SIZE || msg.req.header.value_size > MAX_VALUE_SIZE){
+                msg.req.header.value_size < MIN_VALUE_SIZE || msg.req.header.value_size > max_value_size){
                 DBGPRINT("bad put req\n");
+                creamfree(val_node.val_base);
                 msg.resp.header.response_code = BAD_REQUEST;
                 msg.resp.header.value_size = 0;
             } else {
-                // create key nodes
+                // create key node, the value was read into place
                 key_node.key_len = msg.req.header.key_size;
-                if((key_node.key_base = malloc(key_node.key_len)) == NULL){
+                key_node.key_base = creamalloc(key_node.key_len);
+                if(key_node.key_base == NULL || val_node.val_base == NULL){
                     perror("malloc");
+                    creamfree(key_node.key_base);
+                    creamfree(val_node.val_base);
                     msg.resp.header.response_code = BAD_REQUEST;
                     msg.resp.header.value_size = 0;
-                    break;
+                    goto resend;
                 }
                 memcpy(key_node.key_base, msg.req.data, key_node.key_len);
 
-                // create map node
-                val_node.val_len = msg.req.header.value_size;
-                if((val_node.val_base = malloc(val_node.val_len)) == NULL){
-                    perror("malloc");
-                    free(key_node.key_base);
-                    msg.resp.header.response_code = BAD_REQUEST;
-                    msg.resp.header.value_size = 0;
-                    break;
-                }
-                memcpy(val_node.val_base, msg.req.data + key_node.key_len, val_node.val_len);
-
                 // pass nodes to hashmap
-                bool worked = put(resp_hash, key_node, val_node, true);
-                // set appropriate header
-                if(worked){
-                    DBGPRINT("put req success\n");
-                    msg.resp.header.response_code = OK;
-                    msg.resp.header.value_size = 0;
-                }else{
-                    DBGPRINT("put req failure\n");
-                    free(key_node.key_base);
-                    free(val_node.val_base);
-                    msg.resp.header.response_code = BAD_REQUEST;
-                    msg.resp.header.value_size = 0;
-                }
+                msg.resp.header.response_code = creamput(key_node, val_node);
+                msg.resp.header.value_size = 0;
+                DBGPRINT2("put req response %u\n", msg.resp.header.response_code);
             }
         }
 
@@ -224,10 +802,9 @@ void creamworker(void *arg){
                 // if valid, delete key
                 key_node.key_len = msg.req.header.key_size;
                 key_node.key_base = msg.req.data;
-                delete(resp_hash, key_node);
+                msg.resp.header.response_code = creamevict(key_node);
 
                 // set response header
-                msg.resp.header.response_code = OK;
                 msg.resp.header.value_size = 0;
             }
         }
@@ -238,10 +815,186 @@ void creamworker(void *arg){
             handled = true;
 
             // clear hash
-            clear_map(resp_hash);
+            msg.resp.header.response_code = creamclear();
 
             // set response header
-            msg.resp.header.response_code = OK;
+            msg.resp.header.value_size = 0;
+        }
+
+        // handle versioned get requests
+        if(!handled && msg.req.header.request_code == GETS){
+            DBGPRINT("gets req\n");
+            handled = true;
+            if(msg.req.header.key_size < MIN_KEY_SIZE || msg.req.header.key_size > MAX_KEY_SIZE){
+                msg.resp.header.response_code = BAD_REQUEST;
+                msg.resp.header.value_size = 0;
+            } else {
+                key_node = MAP_KEY(msg.req.data, msg.req.header.key_size);
+                val_node = get_versioned(resp_hash, key_node, &version);
+                // a spilled key has no version until it is back in the map
+                if(val_node.val_base == NULL && creampromote(key_node)){
+                    val_node = get_versioned(resp_hash, key_node, &version);
+                }
+                if(val_node.val_base == NULL){
+                    stats_local->misses++;
+                    msg.resp.header.response_code = NOT_FOUND;
+                    msg.resp.header.value_size = 0;
+                } else {
+                    // the version goes out in front of the value
+                    stats_local->hits++;
+                    msg.resp.header.response_code = OK;
+                    msg.resp.header.value_size = sizeof(uint64_t) + val_node.val_len;
+                    memcpy(msg.resp.data, &version, sizeof(uint64_t));
+                    inlinelen = sizeof(uint64_t);
+                    outbody = val_node.val_base;
+                }
+            }
+        }
+
+        // handle compare-and-swap requests
+        if(!handled && msg.req.header.request_code == CAS){
+            DBGPRINT("cas req\n");
+            handled = true;
+            if(msg.req.header.key_size < MIN_KEY_SIZE || msg.req.header.key_size > MAX_KEY_SIZE ||
+                msg.req.header.value_size < sizeof(uint64_t) + MIN_VALUE_SIZE ||
+                msg.req.header.value_size - sizeof(uint64_t) > max_value_size){
+                msg.resp.header.response_code = BAD_REQUEST;
+                msg.resp.header.value_size = 0;
+            } else {
+                memcpy(&version, msg.req.data + msg.req.header.key_size, sizeof(uint64_t));
+                key_node = MAP_KEY(creamalloc(msg.req.header.key_size), msg.req.header.key_size);
+                val_node = MAP_VAL(creamalloc(msg.req.header.value_size - sizeof(uint64_t)),
+                    msg.req.header.value_size - sizeof(uint64_t));
+                if(key_node.key_base == NULL || val_node.val_base == NULL){
+                    perror("malloc");
+                    creamfree(key_node.key_base);
+                    creamfree(val_node.val_base);
+                    msg.resp.header.response_code = BAD_REQUEST;
+                    msg.resp.header.value_size = 0;
+                    goto resend;
+                }
+                memcpy(key_node.key_base, msg.req.data, key_node.key_len);
+                memcpy(val_node.val_base, msg.req.data + key_node.key_len + sizeof(uint64_t), val_node.val_len);
+
+                msg.resp.header.response_code = creamcas(key_node, val_node, &version);
+                msg.resp.header.value_size = 0;
+                if(msg.resp.header.response_code == OK || msg.resp.header.response_code == CONFLICT){
+                    memcpy(msg.resp.data, &version, sizeof(uint64_t));
+                    msg.resp.header.value_size = sizeof(uint64_t);
+                }
+            }
+        }
+
+        // handle leased get requests
+        if(!handled && msg.req.header.request_code == LGET){
+            DBGPRINT("lget req\n");
+            handled = true;
+            if(msg.req.header.key_size < MIN_KEY_SIZE || msg.req.header.key_size > MAX_KEY_SIZE){
+                msg.resp.header.response_code = BAD_REQUEST;
+                msg.resp.header.value_size = 0;
+            } else {
+                key_node = MAP_KEY(msg.req.data, msg.req.header.key_size);
+                val_node = get(resp_hash, key_node);
+                if(val_node.val_base == NULL && tier != NULL){
+                    val_node = tier_get(tier, key_node);
+                }
+                if(val_node.val_base != NULL){
+                    stats_local->hits++;
+                    msg.resp.header.response_code = OK;
+                    msg.resp.header.value_size = val_node.val_len;
+                    outbody = val_node.val_base;
+                } else if((token = lease_acquire(leases, key_node)) != 0){
+                    // the first client to miss fills the key
+                    stats_local->misses++;
+                    msg.resp.header.response_code = NOT_FOUND;
+                    msg.resp.header.value_size = sizeof(uint64_t);
+                    memcpy(msg.resp.data, &token, sizeof(uint64_t));
+                } else {
+                    stats_local->misses++;
+                    msg.resp.header.response_code = RETRY;
+                    msg.resp.header.value_size = 0;
+                }
+            }
+        }
+
+        // handle leased put requests
+        if(!handled && msg.req.header.request_code == LPUT){
+            DBGPRINT("lput req\n");
+            handled = true;
+            if(msg.req.header.key_size < MIN_KEY_SIZE || msg.req.header.key_size > MAX_KEY_SIZE ||
+                msg.req.header.value_size < sizeof(uint64_t) + MIN_VALUE_SIZE ||
+                msg.req.header.value_size - sizeof(uint64_t) > max_value_size){
+                msg.resp.header.response_code = BAD_REQUEST;
+                msg.resp.header.value_size = 0;
+            } else {
+                // the lease is only given up once the value is stored
+                memcpy(&token, msg.req.data + msg.req.header.key_size, sizeof(uint64_t));
+                key_node = MAP_KEY(creamalloc(msg.req.header.key_size), msg.req.header.key_size);
+                val_node = MAP_VAL(creamalloc(msg.req.header.value_size - sizeof(uint64_t)),
+                    msg.req.header.value_size - sizeof(uint64_t));
+                if(key_node.key_base == NULL || val_node.val_base == NULL){
+                    perror("malloc");
+                    creamfree(key_node.key_base);
+                    creamfree(val_node.val_base);
+                    msg.resp.header.response_code = BAD_REQUEST;
+                    msg.resp.header.value_size = 0;
+                    goto resend;
+                }
+                memcpy(key_node.key_base, msg.req.data, key_node.key_len);
+                memcpy(val_node.val_base, msg.req.data + key_node.key_len + sizeof(uint64_t), val_node.val_len);
+
+                msg.resp.header.response_code = creamlput(key_node, val_node, token);
+                msg.resp.header.value_size = 0;
+            }
+        }
+
+        // handle atomic update requests
+        if(!handled && (msg.req.header.request_code == INCR || msg.req.header.request_code == DECR ||
+            msg.req.header.request_code == APPEND || msg.req.header.request_code == PREPEND)){
+            DBGPRINT("update req\n");
+            handled = true;
+            if(msg.req.header.key_size < MIN_KEY_SIZE || msg.req.header.key_size > MAX_KEY_SIZE ||
+                ((msg.req.header.request_code == INCR || msg.req.header.request_code == DECR) &&
+                msg.req.header.value_size != sizeof(uint64_t)) || msg.req.header.value_size < MIN_VALUE_SIZE){
+                DBGPRINT("bad update req\n");
+                msg.resp.header.response_code = BAD_REQUEST;
+                msg.resp.header.value_size = 0;
+            } else {
+                key_node = MAP_KEY(msg.req.data, msg.req.header.key_size);
+                val_node = MAP_VAL(msg.req.data + msg.req.header.key_size, msg.req.header.value_size);
+                // the response header overlays the request header
+                op = msg.req.header.request_code;
+                msg.resp.header.response_code = creamupdate(op, key_node, val_node, &counter);
+                msg.resp.header.value_size = 0;
+                if(msg.resp.header.response_code == OK && (op == INCR || op == DECR)){
+                    memcpy(msg.resp.data, &counter, sizeof(uint64_t));
+                    msg.resp.header.value_size = sizeof(uint64_t);
+                }
+            }
+        }
+
+        // handle batch requests
+        if(!handled && (msg.req.header.request_code == MGET || msg.req.header.request_code == MPUT ||
+            msg.req.header.request_code == MDEL)){
+            DBGPRINT("batch req\n");
+            handled = true;
+            msg.resp.header.response_code = creambatch(&msg.req.header, msg.req.data, &outbody, &bodylen);
+            msg.resp.header.value_size = bodylen;
+        }
+
+        // handle stats requests
+        if(!handled && msg.req.header.request_code == STATS){
+            DBGPRINT("stats req\n");
+            handled = true;
+            msg.resp.header.response_code = creamstats(&outbody, &bodylen);
+            msg.resp.header.value_size = bodylen;
+        }
+
+        // handle channel requests
+        if(!handled && msg.req.header.request_code == CHANNEL){
+            DBGPRINT("channel req\n");
+            handled = true;
+            msg.resp.header.response_code = creamchannelopen(conn, &chanfd);
             msg.resp.header.value_size = 0;
         }
 
@@ -254,21 +1007,2336 @@ void creamworker(void *arg){
         }
 
         resend:
+        TRACE(TRACE_DONE, conn_id, seq, code, msg.resp.header.response_code);
         DBGPRINT("sending resp\n");
-        if(send(connfd, &msg, msg.resp.header.value_size + sizeof(struct response_header_t), 0) < 0){
+        if(v2){
+            v2resp = (response_header_v2_t) {.magic = PROTOCOL_V2, .request_id = request_id,
+                .response_code = msg.resp.header.response_code, .value_size = msg.resp.header.value_size};
+            iov[0] = (struct iovec) {.iov_base = &v2resp, .iov_len = sizeof(response_header_v2_t)};
+        } else {
+            iov[0] = (struct iovec) {.iov_base = &msg.resp.header, .iov_len = sizeof(response_header_t)};
+        }
+        // the body starts in the message and ends in outbody, if there is one
+        if(outbody == NULL){
+            inlinelen = msg.resp.header.value_size;
+        }
+        iov[1] = (struct iovec) {.iov_base = msg.resp.data, .iov_len = inlinelen};
+        iov[2] = (struct iovec) {.iov_base = outbody, .iov_len = msg.resp.header.value_size - inlinelen};
+        if(!(v2 && (flags & FLAG_NOREPLY) && msg.resp.header.response_code == OK && chanfd < 0) &&
+            !conn_sendfd(conn, iov, 3, chanfd)){
             perror("send");
-            if(errno == EINTR){
-                retry ++;
-                if (retry > 10) { continue; }
-                goto resend;
-            } else if(errno == EPIPE){
-                continue;
+        }
+        if(chanfd >= 0){
+            close(chanfd);
+        }
+        free(outbody);
+        TRACE(TRACE_SENT, conn_id, seq, code, 0);
+
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        stats_local->ops[kind]++;
+        stats_record(&stats_local->latency[kind], (uint64_t)(finished.tv_sec - started.tv_sec) * 1000000000 +
+            finished.tv_nsec - started.tv_nsec);
+        if(map_probes != 0){
+            stats_record(&stats_local->probes, map_probes);
+        }
+        CREAM_PROBE5(request__done, conn_id, seq, code, msg.resp.header.response_code, (uint64_t)(finished.tv_sec - started.tv_sec) *
+            1000000000 + finished.tv_nsec - started.tv_nsec);
+
+        // a v1 connection is read again only once its response is out. one
+        // with a channel is left to the channel's thread
+        if(!(code == CHANNEL && msg.resp.header.response_code == OK) &&
+            (closing || ((!v2 || code == CHANNEL) && !creamwatch(conn, EPOLL_CTL_MOD)))){
+            creamdrop(conn);
+        }
+        conn_release(conn);
+        __sync_fetch_and_sub(&busy_workers, 1);
+    }
+}
+
+/*
+ * Starts a detached worker in slot index, which the caller has marked taken.
+ */
+bool creamspawn(long index){
+    pthread_t tid;
+    int err;
+
+    if((err = pthread_create(&tid, NULL, (void *)creamworker, (void *)index)) != 0){
+        errno = err;
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+/*
+ * Gives up the calling worker's slot if the pool is above NUM_WORKERS.
+ * Returns true if the worker must exit, and then must not touch its stats
+ * block or trace ring again, since a new worker may take the slot.
+ */
+bool creamretire(long index){
+    bool retired = false;
+
+    pthread_mutex_lock(&pool_lock);
+    if(live_workers > min_workers){
+        live_workers--;
+        worker_slots[index] = false;
+        pool_retired++;
+        retired = true;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return retired;
+}
+
+/*
+ * Grows the pool by a worker every POOL_TICK_MS while the oldest queued
+ * connection has waited pool_wait_ms for one. Idle workers retire
+ * themselves.
+ */
+void creampool(void *arg){
+    struct timespec oldest, now;
+    uint64_t waited;
+    long slot;
+
+    for(;;){
+        usleep(POOL_TICK_MS * 1000);
+        if(!lanes_oldest(con_lanes, &oldest)){
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        waited = (uint64_t)(now.tv_sec - oldest.tv_sec) * 1000000000 + now.tv_nsec - oldest.tv_nsec;
+        if(waited < (uint64_t)pool_wait_ms * 1000000){
+            continue;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        if(live_workers < max_workers){
+            for(slot = 0; worker_slots[slot]; slot++);
+            worker_slots[slot] = true;
+            if(creamspawn(slot)){
+                live_workers++;
+                pool_grown++;
+            } else {
+                worker_slots[slot] = false;
+                perror("worker");
             }
         }
+        pthread_mutex_unlock(&pool_lock);
     }
 }
 
-void destroymapnode(map_key_t key, map_val_t val){
+/*
+ * Picks the lane for a connection's next frame by peeking at its header,
+ * which has normally arrived whole by the time the socket reads ready. A
+ * frame whose header hasn't is read on the write lane, where blocking on the
+ * rest of it holds up the fewest small reads.
+ */
+int creamlane(conn_t *conn){
+    union {
+        request_header_t v1;
+        request_header_v2_t v2;
+    } header;
+    ssize_t n;
+    uint8_t code;
+
+    n = recv(conn->fd, &header, sizeof(header), MSG_PEEK | MSG_DONTWAIT);
+    if(n >= (ssize_t)sizeof(request_header_t) && header.v2.magic != PROTOCOL_V2){
+        code = header.v1.request_code;
+    } else if(n >= (ssize_t)sizeof(request_header_v2_t)){
+        code = header.v2.request_code;
+    } else {
+        return LANE_WRITE;
+    }
+
+    switch(code){
+        case GET:
+        case MGET:
+        case GETS:
+        case LGET:
+            return LANE_READ;
+        case CLEAR:
+        case STATS:
+            return LANE_ADMIN;
+        default:
+            return LANE_WRITE;
+    }
+}
+
+/*
+ * Answers the frames of connections that found the worker queue full with
+ * BUSY. Each frame is read and thrown away so the stream stays in step, and
+ * the connection is watched again for its next one.
+ */
+void creamshed(void *arg){
+    request_header_t header;
+    response_header_t resp = {.response_code = BUSY, .value_size = 0};
+    response_header_v2_t v2resp;
+    struct iovec iov;
+    char chunk[MAX_VALUE_SIZE];
+    uint32_t request_id, bodylen, budget_us, n;
+    uint16_t flags;
+    conn_t *conn;
+    bool v2;
+
+    stats_local = stats_block(stats, max_workers + 1);
+    trace_local = trace_ring(trace, max_workers + 1);
+
+    for(;;){
+        if((conn = dequeue(shed_que)) == NULL){
+            perror("deque");
+            continue;
+        }
+        conn_deadline(conn, &conn->read_deadline, true);
+        if(!creamreadheader(conn, &header, &v2, &request_id, &flags, &budget_us)){
+            creamdrop(conn);
+            continue;
+        }
+
+        // batches count entries in key_size, and a body too large for a
+        // worker to read is not worth reading here either
+        bodylen = header.value_size;
+        if(header.request_code != MGET && header.request_code != MPUT && header.request_code != MDEL){
+            bodylen += header.key_size;
+        }
+        if(bodylen < header.value_size || bodylen > CMSGSIZE + max_value_size){
+            creamdrop(conn);
+            continue;
+        }
+        for(; bodylen > 0; bodylen -= n){
+            n = bodylen < sizeof(chunk) ? bodylen : sizeof(chunk);
+            if(!conn_read(conn, chunk, n)){
+                break;
+            }
+        }
+        if(bodylen > 0){
+            creamdrop(conn);
+            continue;
+        }
+        conn_deadline(conn, &conn->read_deadline, false);
+
+        if(v2){
+            v2resp = (response_header_v2_t) {.magic = PROTOCOL_V2, .request_id = request_id,
+                .response_code = BUSY, .value_size = 0};
+            iov = (struct iovec) {.iov_base = &v2resp, .iov_len = sizeof(response_header_v2_t)};
+        } else {
+            iov = (struct iovec) {.iov_base = &resp, .iov_len = sizeof(response_header_t)};
+        }
+        shed_full++;
+        TRACE(TRACE_DONE, conn->id, conn->frames, header.request_code, BUSY);
+        if(!conn_send(conn, &iov, 1) || !creamwatch(conn, EPOLL_CTL_MOD)){
+            creamdrop(conn);
+        }
+    }
+}
+
+/*
+ * Creates a channel for a client on the UNIX socket and starts the thread
+ * that serves it, which takes the connection over. chanfd is left holding a
+ * duplicate of the channel's fd, to be passed with the response.
+ */
+uint32_t creamchannelopen(conn_t *conn, int *chanfd){
+    cream_chan_t *self;
+    pthread_t tid;
+    int slot = -1;
+
+    if(!conn->local){
+        return UNSUPPORTED;
+    }
+    pthread_mutex_lock(&chan_lock);
+    for(int i = 0; i < CHAN_MAX && slot < 0; i++){
+        if(!chan_slots[i]){
+            slot = i;
+            chan_slots[i] = true;
+            chan_open++;
+        }
+    }
+    pthread_mutex_unlock(&chan_lock);
+    if(slot < 0){
+        return BUSY;
+    }
+
+    if((self = calloc(1, sizeof(cream_chan_t))) != NULL && (self->chan = create_chan(CHAN_RING_SIZE)) != NULL){
+        self->conn = conn;
+        self->slot = slot;
+        if((*chanfd = dup(self->chan->fd)) >= 0 && pthread_create(&tid, NULL, (void *)creamchannel, self) == 0){
+            pthread_detach(tid);
+            return OK;
+        }
+    }
+
+    perror("channel");
+    if(*chanfd >= 0){
+        close(*chanfd);
+        *chanfd = -1;
+    }
+    if(self != NULL && self->chan != NULL){
+        invalidate_chan(self->chan);
+        free(self->chan);
+    }
+    free(self);
+    pthread_mutex_lock(&chan_lock);
+    chan_slots[slot] = false;
+    chan_open--;
+    pthread_mutex_unlock(&chan_lock);
+    return SERVER_ERROR;
+}
+
+/*
+ * Serves a channel's requests in order until its client disconnects or
+ * writes a record that doesn't fit the ring. An idle channel spins briefly
+ * on its ring and then sleeps on it, checking the connection every
+ * CHAN_POLL_MS.
+ */
+void creamchannel(void *arg){
+    cream_chan_t *self = arg;
+    char *record;
+    uint32_t len;
+
+    stats_local = stats_block(stats, max_workers + 2 + self->slot);
+    for(;;){
+        if((record = chan_peek(self->chan, CHAN_REQUESTS, &len)) != NULL){
+            if(!creamchannelserve(self, record, len)){
+                break;
+            }
+            chan_consume(self->chan, CHAN_REQUESTS);
+        } else if(errno != EAGAIN || (!chan_wait(self->chan, CHAN_REQUESTS, false, CHAN_POLL_MS) &&
+            !creamconnected(self->conn))){
+            break;
+        }
+    }
+    creamchannelclose(self);
+}
+
+/*
+ * Runs one request record and writes its response record, waiting for the
+ * client to make room for it. Returns false if the client is gone.
+ */
+bool creamchannelserve(cream_chan_t *self, char *record, uint32_t len){
+    request_header_t header = {.request_code = 0};
+    response_header_t *resp;
+    struct timespec started, finished;
+    char *outbody = NULL;
+    uint32_t outlen = 0, code = BAD_REQUEST;
+    stats_op_t kind;
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    map_probes = 0;
+    // the header is copied once, so the client can't change it under us
+    if(len >= sizeof(request_header_t)){
+        memcpy(&header, record, sizeof(request_header_t));
+        code = creamchannelexec(self, &header, record + sizeof(request_header_t), len - sizeof(request_header_t),
+            &outbody, &outlen);
+    }
+    kind = creamstatsop(header.request_code);
+
+    while((resp = chan_reserve(self->chan, CHAN_RESPONSES, sizeof(response_header_t) + outlen)) == NULL){
+        if(errno == EMSGSIZE){
+            free(outbody);
+            outbody = NULL;
+            outlen = 0;
+            code = SERVER_ERROR;
+        } else if(errno != EAGAIN || (!chan_wait(self->chan, CHAN_RESPONSES, true, CHAN_POLL_MS) &&
+            !creamconnected(self->conn))){
+            free(outbody);
+            return false;
+        }
+    }
+    resp->response_code = code;
+    resp->value_size = outlen;
+    memcpy(resp + 1, outbody, outlen);
+    chan_commit(self->chan, CHAN_RESPONSES, sizeof(response_header_t) + outlen);
+    free(outbody);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    stats_local->ops[kind]++;
+    stats_record(&stats_local->latency[kind], (uint64_t)(finished.tv_sec - started.tv_sec) * 1000000000 +
+        finished.tv_nsec - started.tv_nsec);
+    if(map_probes != 0){
+        stats_record(&stats_local->probes, map_probes);
+    }
+    return true;
+}
+
+/*
+ * Runs a request from a channel. body is still in the ring, so it is copied
+ * out before it is parsed, and a PUT's key and value straight into their
+ * allocations.
+ */
+uint32_t creamchannelexec(cream_chan_t *self, request_header_t *header, char *body, uint32_t bodylen,
+    char **outbody, uint32_t *outlen){
+    uint8_t op = header->request_code;
+    uint64_t expected = (uint64_t)header->key_size + header->value_size;
+    map_key_t key;
+    map_val_t val;
+
+    // batches count entries in key_size
+    if(op == MGET || op == MPUT || op == MDEL){
+        expected = header->value_size;
+    }
+    if(expected != bodylen){
+        return BAD_REQUEST;
+    }
+
+    if(op == PUT){
+        if(header->key_size < MIN_KEY_SIZE || header->key_size > MAX_KEY_SIZE ||
+            header->value_size < MIN_VALUE_SIZE || header->value_size > max_value_size){
+            return BAD_REQUEST;
+        }
+        key = MAP_KEY(creamalloc(header->key_size), header->key_size);
+        val = MAP_VAL(creamalloc(header->value_size), header->value_size);
+        if(key.key_base == NULL || val.val_base == NULL){
+            creamfree(key.key_base);
+            creamfree(val.val_base);
+            return BAD_REQUEST;
+        }
+        memcpy(key.key_base, body, header->key_size);
+        memcpy(val.val_base, body + header->key_size, header->value_size);
+        return creamput(key, val);
+    }
+
+    if(bodylen > sizeof(self->body)){
+        return BAD_REQUEST;
+    }
+    memcpy(self->body, body, bodylen);
+    key = MAP_KEY(self->body, header->key_size);
+    switch(op){
+        case GET:
+            if(header->key_size < MIN_KEY_SIZE || header->key_size > MAX_KEY_SIZE){
+                return BAD_REQUEST;
+            }
+            if(creamget(key, &val) == NOT_FOUND){
+                return NOT_FOUND;
+            }
+            *outbody = val.val_base;
+            *outlen = val.val_len;
+            return OK;
+        case EVICT:
+            if(header->key_size < MIN_KEY_SIZE || header->key_size > MAX_KEY_SIZE){
+                return BAD_REQUEST;
+            }
+            return creamevict(key);
+        case CLEAR:
+            return creamclear();
+        case MGET:
+        case MPUT:
+        case MDEL:
+            return creambatch(header, self->body, outbody, outlen);
+        case STATS:
+            return creamstats(outbody, outlen);
+        default:
+            return UNSUPPORTED;
+    }
+}
+
+/*
+ * Frees a channel, its slot, and the connection it was asked for on.
+ */
+void creamchannelclose(cream_chan_t *self){
+    creamdrop(self->conn);
+    invalidate_chan(self->chan);
+    free(self->chan);
+    pthread_mutex_lock(&chan_lock);
+    chan_slots[self->slot] = false;
+    chan_open--;
+    pthread_mutex_unlock(&chan_lock);
+    free(self);
+}
+
+/*
+ * Whether a connection's client is still there, without reading from it.
+ */
+bool creamconnected(conn_t *conn){
+    ssize_t n;
+    char byte;
+
+    n = recv(conn->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+}
+
+// a batch of datagrams from recvmmsg, and the responses sent back to each
+// one's sender with sendmmsg
+typedef struct cream_udp_t {
+    struct mmsghdr in[UDP_BATCH];
+    struct mmsghdr out[UDP_BATCH];
+    struct iovec in_iov[UDP_BATCH];
+    struct iovec out_iov[UDP_BATCH];
+    struct sockaddr_storage addrs[UDP_BATCH];
+    char requests[UDP_BATCH][UDP_DATAGRAM_MAX];
+    char responses[UDP_BATCH][UDP_DATAGRAM_MAX];
+} cream_udp_t;
+
+/*
+ * Answers the GETs and MGETs that come in over UDP, a batch of datagrams
+ * per system call each way, until the store is handed over.
+ */
+void creamudp(void *arg){
+    cream_udp_t *self;
+    int received, replies, sent, n;
+    uint32_t len;
+    bool shed = false;
+
+    if((self = calloc(1, sizeof(cream_udp_t))) == NULL){
+        perror("udp");
+        return;
+    }
+    stats_local = stats_block(stats, max_workers + 2 + CHAN_MAX);
+    for(int i = 0; i < UDP_BATCH; i++){
+        self->in_iov[i] = (struct iovec) {.iov_base = self->requests[i], .iov_len = UDP_DATAGRAM_MAX};
+        self->out_iov[i] = (struct iovec) {.iov_base = self->responses[i]};
+        self->in[i].msg_hdr.msg_iov = &self->in_iov[i];
+        self->in[i].msg_hdr.msg_iovlen = 1;
+        self->in[i].msg_hdr.msg_name = &self->addrs[i];
+        self->out[i].msg_hdr.msg_iov = &self->out_iov[i];
+        self->out[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    for(;;){
+        for(int i = 0; i < UDP_BATCH; i++){
+            self->in[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        }
+        // block for the first datagram, then take whatever else is queued.
+        // once shedding, stop when the queue is empty
+        if((received = recvmmsg(udp_fd, self->in, UDP_BATCH, shed ? MSG_DONTWAIT : MSG_WAITFORONE, NULL)) <= 0){
+            if(shed){
+                break;
+            }
+            continue;
+        }
+
+        // counted as a busy worker, so a handover waits for the batch. once
+        // one has begun the store may be frozen, so this batch and whatever
+        // is still queued are answered BUSY, to be asked of the successor
+        if(!shed){
+            __sync_fetch_and_add(&busy_workers, 1);
+            if((shed = handing_over)){
+                __sync_fetch_and_sub(&busy_workers, 1);
+            }
+        }
+        replies = 0;
+        for(int i = 0; i < received; i++){
+            len = shed ? creamudpshed(self->requests[i], self->in[i].msg_len, self->responses[replies]) :
+                creamudpserve(self->requests[i], self->in[i].msg_len,
+                (self->in[i].msg_hdr.msg_flags & MSG_TRUNC) != 0, self->responses[replies]);
+            if(len > 0){
+                self->out_iov[replies].iov_len = len;
+                self->out[replies].msg_hdr.msg_name = &self->addrs[i];
+                self->out[replies].msg_hdr.msg_namelen = self->in[i].msg_hdr.msg_namelen;
+                replies++;
+            }
+        }
+        stats_local->datagrams += received;
+        if(!shed){
+            __sync_fetch_and_sub(&busy_workers, 1);
+        }
+
+        // a response that can't be sent is lost, as it could be on the way
+        for(sent = 0; sent < replies;){
+            n = sendmmsg(udp_fd, self->out + sent, replies - sent, 0);
+            sent += n > 0 ? n : 1;
+        }
+    }
+    free(self);
+}
+
+/*
+ * Runs the request in one datagram and writes the response datagram to out.
+ * Returns its length, or 0 if the datagram is not a version 2 frame and
+ * gets no answer.
+ */
+uint32_t creamudpserve(char *datagram, uint32_t len, bool truncated, char *out){
+    request_header_v2_t header;
+    request_header_t batch;
+    response_header_v2_t resp = {.magic = PROTOCOL_V2};
+    struct timespec started, finished;
+    map_val_t val;
+    char *outbody = NULL, *body = datagram + sizeof(request_header_v2_t);
+    uint32_t outlen = 0, bodylen = len - sizeof(request_header_v2_t);
+    stats_op_t kind;
+
+    if(len < sizeof(request_header_v2_t)){
+        return 0;
+    }
+    memcpy(&header, datagram, sizeof(request_header_v2_t));
+    if(header.magic != PROTOCOL_V2){
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    map_probes = 0;
+    resp.request_id = header.request_id;
+
+    if(truncated){
+        resp.response_code = TOO_LARGE;
+    } else if(header.flags != 0){
+        resp.response_code = BAD_REQUEST;
+    } else if(header.request_code == GET){
+        if(header.key_size < MIN_KEY_SIZE || header.key_size > MAX_KEY_SIZE || header.value_size != 0 ||
+            header.key_size > bodylen){
+            resp.response_code = BAD_REQUEST;
+        } else if((resp.response_code = creamget(MAP_KEY(body, header.key_size), &val)) == OK){
+            outbody = val.val_base;
+            outlen = val.val_len;
+        }
+    } else if(header.request_code == MGET){
+        // batches count entries in key_size
+        batch = (request_header_t) {.request_code = MGET, .key_size = header.key_size,
+            .value_size = header.value_size};
+        resp.response_code = header.value_size > bodylen ? BAD_REQUEST :
+            creambatch(&batch, body, &outbody, &outlen);
+    } else {
+        resp.response_code = UNSUPPORTED;
+    }
+    // a response much larger than its request would let a spoofed sender
+    // aim the server's bandwidth at someone else. padding after the key or
+    // batch is ignored but counted, so a client pays for a larger response
+    // with a larger request
+    if(sizeof(response_header_v2_t) + outlen > UDP_DATAGRAM_MAX ||
+        sizeof(response_header_v2_t) + outlen > UDP_AMPLIFY * len){
+        resp.response_code = TOO_LARGE;
+        outlen = 0;
+    }
+    if(resp.response_code == TOO_LARGE){
+        stats_local->datagrams_too_large++;
+    }
+    resp.value_size = outlen;
+    memcpy(out, &resp, sizeof(response_header_v2_t));
+    memcpy(out + sizeof(response_header_v2_t), outbody, outlen);
+    free(outbody);
+
+    kind = creamstatsop(header.request_code);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    stats_local->ops[kind]++;
+    stats_record(&stats_local->latency[kind], (uint64_t)(finished.tv_sec - started.tv_sec) * 1000000000 +
+        finished.tv_nsec - started.tv_nsec);
+    if(map_probes != 0){
+        stats_record(&stats_local->probes, map_probes);
+    }
+    return sizeof(response_header_v2_t) + outlen;
+}
+
+/*
+ * Answers a version 2 datagram BUSY without reading the store, writing the
+ * response to out. Returns its length, or 0 if the datagram gets no answer.
+ */
+uint32_t creamudpshed(char *datagram, uint32_t len, char *out){
+    request_header_v2_t header;
+    response_header_v2_t resp = {.magic = PROTOCOL_V2, .response_code = BUSY};
+
+    if(len < sizeof(request_header_v2_t)){
+        return 0;
+    }
+    memcpy(&header, datagram, sizeof(request_header_v2_t));
+    if(header.magic != PROTOCOL_V2){
+        return 0;
+    }
+    resp.request_id = header.request_id;
+    memcpy(out, &resp, sizeof(response_header_v2_t));
+    return sizeof(response_header_v2_t);
+}
+
+/*
+ * Accepts a client on the TCP or the UNIX socket and starts watching it for
+ * requests. The registration holds the first reference to the connection.
+ */
+void creamaccept(int listener, bool local){
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    conn_t *conn;
+    int fd, one = 1;
+
+    if((fd = accept(listener, (struct sockaddr *)&addr, &addrlen)) < 0){
+        return;
+    }
+    // each response is one write; Nagle would hold pipelined ones back
+    // until the client acks the last
+    if(!local){
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if((conn = create_conn(fd)) == NULL){
+        close(fd);
+        return;
+    }
+    conn->id = ++next_conn_id;
+    conn->io_ms = conn_io_ms;
+    conn->local = local;
+    if(!creamadmit(conn, (struct sockaddr *)&addr)){
+        stats_local->conns_refused++;
+        conn_release(conn);
+        return;
+    }
+    TRACE(TRACE_ACCEPT, conn->id, 0, 0, 0);
+    stats_local->conns_opened++;
+    if(!creamwatch(conn, EPOLL_CTL_ADD)){
+        creamdrop(conn);
+    }
+}
+
+/*
+ * Counts a new connection against its address's cap and starts its timer.
+ * Returns false if the address is over its cap, or too many are counted.
+ */
+bool creamadmit(conn_t *conn, struct sockaddr *addr){
+    uint64_t now;
+
+    if(conn_wheel == NULL && conn_peers == NULL){
+        return true;
+    }
+    pthread_mutex_lock(&conn_lock);
+    // local clients all share one address, so they aren't capped
+    if(conn_peers != NULL && !conn->local){
+        peers_addr(addr, conn->peer);
+        if(!peers_add(conn_peers, conn->peer)){
+            pthread_mutex_unlock(&conn_lock);
+            return false;
+        }
+    }
+    if(conn_wheel != NULL){
+        now = conn_clock();
+        conn->idle_since = now;
+        wheel_arm(conn_wheel, &conn->timer, creamnextcheck(conn, now));
+    }
+    pthread_mutex_unlock(&conn_lock);
+
+    return true;
+}
+
+/*
+ * Arms the connection for its next frame. It is one-shot, so only one worker
+ * reads from a connection at a time.
+ */
+bool creamwatch(conn_t *conn, int op){
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = conn};
+
+    // idle from here until the event loop sees its next frame
+    if(conn_wheel != NULL){
+        __atomic_store_n(&conn->idle_since, conn_clock(), __ATOMIC_RELAXED);
+        __atomic_store_n(&conn->state, CONN_IDLE, __ATOMIC_RELEASE);
+    }
+    return epoll_ctl(epoll_fd, op, conn->fd, &ev) == 0;
+}
+
+/*
+ * Stops watching a connection and drops the registration's reference. The
+ * socket is closed once no request on it is still being served. The timer
+ * may have dropped it already, so only the first drop counts.
+ */
+void creamdrop(conn_t *conn){
+    if(conn_wheel != NULL || conn_peers != NULL){
+        pthread_mutex_lock(&conn_lock);
+        if(conn->dropped){
+            pthread_mutex_unlock(&conn_lock);
+            return;
+        }
+        conn->dropped = true;
+        if(conn_wheel != NULL){
+            wheel_disarm(conn_wheel, &conn->timer);
+        }
+        if(conn_peers != NULL && !conn->local){
+            peers_remove(conn_peers, conn->peer);
+        }
+        pthread_mutex_unlock(&conn_lock);
+    }
+    creamclose(conn);
+}
+
+void creamclose(conn_t *conn){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    stats_local->conns_closed++;
+    conn_release(conn);
+}
+
+/*
+ * When a connection's timer should next look at it: when it has been idle
+ * for CONN_IDLE_MS, or when a deadline on it passes. Deadlines are started
+ * without moving the timer, so it looks again at least every IO_MS.
+ */
+uint64_t creamnextcheck(conn_t *conn, uint64_t now){
+    uint64_t next = UINT64_MAX, deadline;
+
+    if(conn_idle_ms != 0 && __atomic_load_n(&conn->state, __ATOMIC_ACQUIRE) == CONN_IDLE){
+        next = __atomic_load_n(&conn->idle_since, __ATOMIC_RELAXED) + conn_idle_ms;
+    }
+    if(conn_io_ms != 0){
+        next = now + conn_io_ms < next ? now + conn_io_ms : next;
+        deadline = __atomic_load_n(&conn->read_deadline, __ATOMIC_RELAXED);
+        next = deadline != 0 && deadline < next ? deadline : next;
+        deadline = __atomic_load_n(&conn->write_deadline, __ATOMIC_RELAXED);
+        next = deadline != 0 && deadline < next ? deadline : next;
+    }
+    // busy, with only idle connections timed
+    if(next == UINT64_MAX){
+        next = now + conn_idle_ms;
+    }
+    return next;
+}
+
+/*
+ * Turns the wheel, run by the event loop each tick. A connection whose frame
+ * or response is overdue is shut down, which fails the read or write its
+ * worker is blocked in, and the worker drops it. An idle one is dropped
+ * here; it is only watched, so no worker is using the registration.
+ */
+void creamtimeouts(void){
+    uint64_t now = conn_clock(), read_deadline, write_deadline;
+    wheel_timer_t *timer;
+    conn_t *conn;
+
+    pthread_mutex_lock(&conn_lock);
+    while((timer = wheel_expire(conn_wheel, now)) != NULL){
+        conn = (conn_t *)((char *)timer - offsetof(conn_t, timer));
+        read_deadline = __atomic_load_n(&conn->read_deadline, __ATOMIC_RELAXED);
+        write_deadline = __atomic_load_n(&conn->write_deadline, __ATOMIC_RELAXED);
+        if((read_deadline != 0 && read_deadline <= now) || (write_deadline != 0 && write_deadline <= now)){
+            shutdown(conn->fd, SHUT_RDWR);
+            __atomic_store_n(&conn->read_deadline, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&conn->write_deadline, 0, __ATOMIC_RELAXED);
+            stats_local->conns_stalled++;
+        } else if(conn_idle_ms != 0 && __atomic_load_n(&conn->state, __ATOMIC_ACQUIRE) == CONN_IDLE &&
+            __atomic_load_n(&conn->idle_since, __ATOMIC_RELAXED) + conn_idle_ms <= now){
+            conn->dropped = true;
+            if(conn_peers != NULL && !conn->local){
+                peers_remove(conn_peers, conn->peer);
+            }
+            stats_local->conns_idle++;
+            creamclose(conn);
+            continue;
+        }
+        wheel_arm(conn_wheel, timer, creamnextcheck(conn, now));
+    }
+    pthread_mutex_unlock(&conn_lock);
+}
+
+/*
+ * Reads a PUT value of len bytes straight into the allocation the map will
+ * own. If the store is out of memory the value is drained and val is left
+ * NULL, so the request fails without losing the stream.
+ */
+bool creamreadvalue(conn_t *conn, uint32_t len, map_val_t *val){
+    char chunk[MAX_VALUE_SIZE];
+    uint32_t n;
+
+    *val = MAP_VAL(NULL, 0);
+    if(len == 0){
+        return true;
+    }
+
+    if((val->val_base = creamalloc(len)) == NULL){
+        for(; len > 0; len -= n){
+            n = len < sizeof(chunk) ? len : sizeof(chunk);
+            if(!conn_read(conn, chunk, n)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if(!conn_read(conn, val->val_base, len)){
+        creamfree(val->val_base);
+        val->val_base = NULL;
+        return false;
+    }
+    val->val_len = len;
+    return true;
+}
+
+/*
+ * Reads a v1 or v2 request header. A v2 header is translated into header,
+ * with its request id, flags and deadline budget returned separately.
+ */
+bool creamreadheader(conn_t *conn, request_header_t *header, bool *v2, uint32_t *request_id, uint16_t *flags,
+    uint32_t *budget_us){
+    request_header_v2_t v2hdr;
+
+    *request_id = 0;
+    *flags = 0;
+    *budget_us = 0;
+    if(!conn_read(conn, &v2hdr.magic, 1)){
+        return false;
+    }
+
+    if(!(*v2 = v2hdr.magic == PROTOCOL_V2)){
+        header->request_code = v2hdr.magic;
+        return conn_read(conn, (char *)header + 1, sizeof(request_header_t) - 1);
+    }
+
+    if(!conn_read(conn, (char *)&v2hdr + 1, sizeof(request_header_v2_t) - 1)){
+        return false;
+    }
+    header->request_code = v2hdr.request_code;
+    header->key_size = v2hdr.key_size;
+    header->value_size = v2hdr.value_size;
+    *request_id = v2hdr.request_id;
+    *flags = v2hdr.flags;
+    return !(v2hdr.flags & FLAG_DEADLINE) || conn_read(conn, budget_us, sizeof(uint32_t));
+}
+
+/*
+ * Parses a header from the start of buf the way creamreadheader reads one.
+ * Returns its length, or 0 if buf doesn't hold all of it yet.
+ */
+size_t creamparseheader(char *buf, size_t len, request_header_t *header, bool *v2, uint32_t *request_id,
+    uint16_t *flags, uint32_t *budget_us){
+    request_header_v2_t v2hdr;
+    size_t hdrlen;
+
+    *request_id = 0;
+    *flags = 0;
+    *budget_us = 0;
+    if(len == 0){
+        return 0;
+    }
+
+    if(!(*v2 = (uint8_t)buf[0] == PROTOCOL_V2)){
+        if(len < sizeof(request_header_t)){
+            return 0;
+        }
+        memcpy(header, buf, sizeof(request_header_t));
+        return sizeof(request_header_t);
+    }
+
+    if(len < sizeof(request_header_v2_t)){
+        return 0;
+    }
+    memcpy(&v2hdr, buf, sizeof(request_header_v2_t));
+    hdrlen = sizeof(request_header_v2_t) + (v2hdr.flags & FLAG_DEADLINE ? sizeof(uint32_t) : 0);
+    if(len < hdrlen){
+        return 0;
+    }
+    header->request_code = v2hdr.request_code;
+    header->key_size = v2hdr.key_size;
+    header->value_size = v2hdr.value_size;
+    *request_id = v2hdr.request_id;
+    *flags = v2hdr.flags;
+    if(v2hdr.flags & FLAG_DEADLINE){
+        memcpy(budget_us, buf + sizeof(request_header_v2_t), sizeof(uint32_t));
+    }
+    return hdrlen;
+}
+
+/*
+ * Returns true if more than budget_us microseconds have passed since since.
+ */
+bool creamexpired(struct timespec *since, uint32_t budget_us){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - since->tv_sec) * 1000000000 + now.tv_nsec - since->tv_nsec >
+        (uint64_t)budget_us * 1000;
+}
+
+/*
+ * Handles MGET, MPUT and MDEL. Entries are validated up front so a bad entry
+ * rejects the whole frame, then every key goes through the map under one lock
+ * acquisition. The response body is malloc'd into outbody.
+ */
+uint32_t creambatch(request_header_t *header, char *body, char **outbody, uint32_t *outlen){
+    map_key_t keys[MAX_BATCH_KEYS];
+    map_val_t vals[MAX_BATCH_KEYS];
+    uint32_t codes[MAX_BATCH_KEYS];
+    response_header_t entry_resp;
+    batch_entry_t entry;
+    uint32_t count = header->key_size, off = 0;
+    char *out;
+
+    *outbody = NULL;
+    *outlen = 0;
+    if(count < 1 || count > MAX_BATCH_KEYS){
+        return BAD_REQUEST;
+    }
+
+    // parse and validate every entry
+    for(int i = 0; i < count; i++){
+        if(off + sizeof(batch_entry_t) > header->value_size){
+            return BAD_REQUEST;
+        }
+        memcpy(&entry, body + off, sizeof(batch_entry_t));
+        off += sizeof(batch_entry_t);
+        if(entry.key_size < MIN_KEY_SIZE || entry.key_size > MAX_KEY_SIZE ||
+            (header->request_code == MPUT && (entry.value_size < MIN_VALUE_SIZE || entry.value_size > MAX_VALUE_SIZE)) ||
+            (header->request_code != MPUT && entry.value_size != 0) ||
+            off + entry.key_size + entry.value_size > header->value_size){
+            return BAD_REQUEST;
+        }
+        keys[i] = MAP_KEY(body + off, entry.key_size);
+        vals[i] = MAP_VAL(body + off + entry.key_size, entry.value_size);
+        off += entry.key_size + entry.value_size;
+    }
+
+    if(header->request_code == MGET){
+        if(!get_many(resp_hash, keys, vals, count)){
+            return SERVER_ERROR;
+        }
+        for(int i = 0; i < count; i++){
+            if(vals[i].val_base == NULL && tier != NULL){
+                vals[i] = tier_get(tier, keys[i]);
+            }
+            *outlen += sizeof(response_header_t) + vals[i].val_len;
+        }
+    } else if(header->request_code == MPUT){
+        // copy pairs out of the request for the map to own
+        for(int i = 0; i < count; i++){
+            map_key_t key = MAP_KEY(creamalloc(keys[i].key_len), keys[i].key_len);
+            map_val_t val = MAP_VAL(creamalloc(vals[i].val_len), vals[i].val_len);
+            if(key.key_base == NULL || val.val_base == NULL){
+                creamfree(key.key_base);
+                creamfree(val.val_base);
+                for(int j = 0; j < i; j++){
+                    destroymapnode(keys[j], vals[j]);
+                }
+                return BAD_REQUEST;
+            }
+            memcpy(key.key_base, keys[i].key_base, key.key_len);
+            memcpy(val.val_base, vals[i].val_base, val.val_len);
+            keys[i] = key;
+            vals[i] = val;
+        }
+        creamputmany(keys, vals, codes, count);
+        *outlen = count * sizeof(response_header_t);
+    } else {
+        codes[0] = creamevictmany(keys, count);
+        for(int i = 1; i < count; i++){
+            codes[i] = codes[0];
+        }
+        *outlen = count * sizeof(response_header_t);
+    }
+
+    // one response header per entry, followed by the value for MGET
+    if((out = *outbody = malloc(*outlen)) == NULL){
+        for(int i = 0; i < count && header->request_code == MGET; i++){
+            free(vals[i].val_base);
+        }
+        *outlen = 0;
+        return SERVER_ERROR;
+    }
+    for(int i = 0; i < count; i++){
+        if(header->request_code == MGET){
+            entry_resp.response_code = vals[i].val_base != NULL ? OK : NOT_FOUND;
+            entry_resp.value_size = vals[i].val_len;
+            if(vals[i].val_base != NULL){
+                stats_local->hits++;
+            } else {
+                stats_local->misses++;
+            }
+        } else {
+            entry_resp.response_code = codes[i];
+            entry_resp.value_size = 0;
+        }
+        memcpy(out, &entry_resp, sizeof(response_header_t));
+        out += sizeof(response_header_t);
+        if(header->request_code == MGET && vals[i].val_base != NULL){
+            memcpy(out, vals[i].val_base, vals[i].val_len);
+            out += vals[i].val_len;
+            free(vals[i].val_base);
+        }
+    }
+
+    return OK;
+}
+
+void destroymapnode(map_key_t key, map_val_t val){
+    creamfree(val.val_base);
+    creamfree(key.key_base);
+}
+
+/*
+ * Evict function of the map when the disk tier is on. It runs with the map
+ * locked, so it only reserves room for the entry; creamspillflush writes it
+ * once the put returns. Until then a GET of the key misses.
+ */
+void creamspill(map_key_t key, map_val_t val){
+    // a put evicts at most one entry per pair, so this only drops an entry
+    // whose reservation failed
+    if(num_spills < MAX_BATCH_KEYS && tier_reserve(tier, key, val.val_len, &spills[num_spills].stub)){
+        spills[num_spills].key = key;
+        spills[num_spills].val = val;
+        num_spills++;
+        return;
+    }
+    destroymapnode(key, val);
+}
+
+/*
+ * Moves a key spilled to the tier back into the map, for the requests that
+ * need it there: updates, and the version GETS hands out for CAS. The value
+ * is read with no lock held and only put back if nothing wrote, evicted or
+ * spilled the key meanwhile; the journal already holds it, so nothing is
+ * logged. Returns true if the key may now be in the map.
+ */
+bool creampromote(map_key_t key){
+    tier_stub_t stub;
+    map_key_t key_node;
+    map_val_t val, val_node;
+    bool promoted, present;
+
+    if(tier == NULL || (val = tier_read(tier, key, &stub)).val_base == NULL){
+        return false;
+    }
+    key_node = MAP_KEY(creamalloc(key.key_len), key.key_len);
+    val_node = MAP_VAL(creamalloc(val.val_len), val.val_len);
+    if(key_node.key_base == NULL || val_node.val_base == NULL){
+        creamfree(key_node.key_base);
+        creamfree(val_node.val_base);
+        free(val.val_base);
+        return false;
+    }
+    memcpy(key_node.key_base, key.key_base, key.key_len);
+    memcpy(val_node.val_base, val.val_base, val.val_len);
     free(val.val_base);
-    free(key.key_base);
-}
\ No newline at end of file
+
+    // a put of the key since the read leaves it in the map as well
+    promoted = put_absent(resp_hash, key_node, val_node, true, creamspilled, &stub);
+    present = promoted || errno == EEXIST;
+    if(!promoted){
+        destroymapnode(key_node, val_node);
+    }
+    creamspillflush();
+
+    return present;
+}
+
+/*
+ * Check for put_absent while promoting: the stub the value was read through
+ * is still kept.
+ */
+bool creamspilled(map_key_t key, void *arg){
+    return tier_holds(tier, arg);
+}
+
+/*
+ * Writes the entries the calling thread's puts spilled to the tier, with
+ * no lock held, and releases their memory.
+ */
+void creamspillflush(void){
+    for(int i = 0; i < num_spills; i++){
+        tier_write(tier, &spills[i].stub, spills[i].key, spills[i].val);
+        destroymapnode(spills[i].key, spills[i].val);
+    }
+    num_spills = 0;
+}
+
+/*
+ * Forget function of the map when the disk tier is on. A key's spilled copy
+ * is dropped in the same critical section that writes or removes the key,
+ * so no spill can slip in between and be read back later.
+ */
+void creamforget(map_key_t key){
+    if(key.key_base == NULL){
+        clear_tier(tier);
+    } else {
+        tier_delete(tier, key);
+    }
+}
+
+/*
+ * Keys and values live in the store when hot restart or huge pages are on,
+ * and on the heap otherwise.
+ */
+void *creamalloc(size_t len){
+    return store != NULL ? arena_alloc(store, len) : malloc(len);
+}
+
+void creamfree(void *ptr){
+    if(store != NULL){
+        arena_free(store, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+/*
+ * Builds the map in a shared memory store, taking the store and the listening
+ * socket over from a running server at the restart path if there is one.
+ * Returns true if the store was inherited.
+ */
+bool creamstoreinit(cream_opts_t *opts){
+    int fds[HANDOVER_FDS];
+    map_node_t *nodes;
+    bool inherited;
+    ptrdiff_t delta;
+
+    if((inherited = handover_request(opts->restart_path, fds))){
+        listen_fd = fds[0];
+        if((store = attach_arena(fds[1])) == NULL){
+            perror("attach store");
+            exit(EXIT_FAILURE);
+        }
+        nodes = arena_ptr(store, store->header->nodes);
+        if(opts->hash_size != store->header->capacity){
+            fprintf(stderr, "cream: inherited store holds %u entries\n", store->header->capacity);
+            opts->hash_size = store->header->capacity;
+        }
+
+        // rebase the key and value pointers stored by the predecessor
+        if((delta = store->delta) != 0){
+            for(int i = 0; i < opts->hash_size; i++){
+                if(nodes[i].key.key_len != 0 && !nodes[i].tombstone){
+                    nodes[i].key.key_base = (char *)nodes[i].key.key_base + delta;
+                    if(nodes[i].val.val_base != NULL){
+                        nodes[i].val.val_base = (char *)nodes[i].val.val_base + delta;
+                    }
+                }
+            }
+        }
+    } else {
+        if((store = create_arena((size_t)opts->store_size << 20,
+            ARENA_SHARED | (opts->huge ? ARENA_HUGE : 0))) == NULL ||
+            (nodes = arena_calloc(store, (size_t)opts->hash_size * sizeof(map_node_t))) == NULL){
+            perror("create store");
+            exit(EXIT_FAILURE);
+        }
+        store->header->nodes = arena_offset(store, nodes);
+        store->header->capacity = opts->hash_size;
+    }
+    if(opts->huge){
+        creamstoreprefault(opts->num_workers);
+    }
+
+    resp_hash = create_map_over(opts->hash_size, nodes, jenkins_one_at_a_time_hash, destroymapnode);
+
+    // listen for the next upgrade
+    if((handover_fd = handover_listen(opts->restart_path)) < 0){
+        perror("handover");
+        exit(EXIT_FAILURE);
+    }
+
+    return inherited;
+}
+
+/*
+ * Builds the map in a private store of huge pages, so table probes and value
+ * reads miss the TLB less, and faults the whole store in before serving.
+ */
+void creamhugeinit(cream_opts_t *opts){
+    map_node_t *nodes;
+
+    if((store = create_arena((size_t)opts->store_size << 20, ARENA_HUGE)) == NULL ||
+        (nodes = arena_calloc(store, (size_t)opts->hash_size * sizeof(map_node_t))) == NULL){
+        perror("create store");
+        exit(EXIT_FAILURE);
+    }
+    store->header->nodes = arena_offset(store, nodes);
+    store->header->capacity = opts->hash_size;
+    creamstoreprefault(opts->num_workers);
+
+    resp_hash = create_map_over(opts->hash_size, nodes, jenkins_one_at_a_time_hash, destroymapnode);
+}
+
+/*
+ * Faults every page of the store in with several threads, so no request pays
+ * for a first touch, and reports what backs it on stderr.
+ */
+void creamstoreprefault(int threads){
+    static const char *pages[] = {
+        [ARENA_PAGES_SMALL] = "small pages",
+        [ARENA_PAGES_HUGETLB] = "hugetlb pages",
+        [ARENA_PAGES_THP] = "transparent huge pages"
+    };
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(!arena_prefault(store, threads)){
+        perror("prefault store");
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "store: %zu MB of %s, faulted in by %d threads in %ld ms\n", store->size >> 20,
+        pages[store->pages], threads, (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+}
+
+/*
+ * Waits for a successor, drains in-flight requests and hands it the store
+ * and the listening socket. The process exits once the successor has them.
+ */
+void creamhandover(void *arg){
+    int connfd, pending, fds[HANDOVER_FDS];
+
+    if((connfd = handover_wait(handover_fd)) < 0){
+        perror("handover");
+        return;
+    }
+
+    // stop accepting and let queued requests finish
+    handing_over = 1;
+    pthread_kill(main_thread, SIGUSR2);
+    for(int i = 0; i < HANDOVER_DRAIN_MS; i++){
+        pending = lanes_length(con_lanes);
+        if(pending == 0 && busy_workers == 0){
+            break;
+        }
+        usleep(1000);
+    }
+
+    // freeze the store so this process no longer touches it
+    detach_map(resp_hash);
+    detach_arena(store);
+
+    fds[0] = listen_fd;
+    fds[1] = store->fd;
+    if(!handover_send(connfd, fds)){
+        perror("handover");
+        exit(EXIT_FAILURE);
+    }
+    if(trace != NULL){
+        invalidate_trace(trace);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Looks a key up in the map, then in the disk tier for evicted entries, and
+ * counts the hit or miss. val holds a copy of the value for the caller to
+ * free.
+ */
+uint32_t creamget(map_key_t key, map_val_t *val){
+    *val = get(resp_hash, key);
+    if(val->val_base == NULL && tier != NULL){
+        *val = tier_get(tier, key);
+    }
+    if(val->val_base == NULL){
+        stats_local->misses++;
+        return NOT_FOUND;
+    }
+    stats_local->hits++;
+    return OK;
+}
+
+/*
+ * Puts a key/value pair, journaling it first when the journal is on.
+ * The map owns key and val afterwards; they are freed here if it can't take them.
+ */
+uint32_t creamput(map_key_t key, map_val_t val){
+    uint32_t code;
+
+    creamputmany(&key, &val, &code, 1);
+    return code;
+}
+
+/*
+ * Puts a batch of pairs under one acquisition of the map lock, setting a
+ * response code per pair. Ownership is as for creamput.
+ */
+void creamputmany(map_key_t *keys, map_val_t *vals, uint32_t *codes, int count){
+    bool added[MAX_BATCH_KEYS];
+    journal_mark_t mark;
+    uint64_t lsn = 0;
+    bool durable = true;
+
+    // a lease holder must not overwrite a newer value with the one it fetched
+    for(int i = 0; i < count; i++){
+        lease_revoke(leases, keys[i]);
+    }
+
+    bzero(added, sizeof(added));
+    if(journal == NULL){
+        put_many(resp_hash, keys, vals, added, count, true);
+    } else {
+        // log and apply under the journal lock so the log matches map order
+        journal_lock(journal);
+        mark = journal_mark(journal);
+        for(int i = 0; i < count && durable; i++){
+            durable = (lsn = journal_append(journal, PUT, keys[i], vals[i])) != 0;
+        }
+        // a batch that isn't applied leaves none of its records behind
+        if(durable){
+            put_many(resp_hash, keys, vals, added, count, true);
+        } else {
+            journal_rollback(journal, mark);
+        }
+        // nor do entries the map turned away; the buffer already has room
+        // for the records of the others, so logging them again can't fail
+        if(durable && memchr(added, false, count) != NULL){
+            journal_rollback(journal, mark);
+            lsn = mark.appended;
+            for(int i = 0; i < count; i++){
+                if(added[i]){
+                    lsn = journal_append(journal, PUT, keys[i], vals[i]);
+                }
+            }
+        }
+        journal_unlock(journal);
+    }
+    creamspillflush();
+
+    // group commit: wait for the flusher to make the records durable
+    if(journal != NULL){
+        durable = durable && journal_wait(journal, lsn);
+    }
+
+    for(int i = 0; i < count; i++){
+        if(!added[i]){
+            destroymapnode(keys[i], vals[i]);
+            codes[i] = durable ? BAD_REQUEST : SERVER_ERROR;
+        } else {
+            codes[i] = durable ? OK : SERVER_ERROR;
+        }
+    }
+}
+
+uint32_t creamevict(map_key_t key){
+    return creamevictmany(&key, 1);
+}
+
+uint32_t creamevictmany(map_key_t *keys, int count){
+    journal_mark_t mark;
+    uint64_t lsn = 0;
+
+    // a lease holder must not refill a key evicted since it missed
+    for(int i = 0; i < count; i++){
+        lease_revoke(leases, keys[i]);
+    }
+
+    if(journal == NULL){
+        delete_many(resp_hash, keys, count);
+        return OK;
+    }
+
+    journal_lock(journal);
+    mark = journal_mark(journal);
+    for(int i = 0; i < count; i++){
+        if((lsn = journal_append(journal, EVICT, keys[i], MAP_VAL(NULL, 0))) == 0){
+            journal_rollback(journal, mark);
+            journal_unlock(journal);
+            return SERVER_ERROR;
+        }
+    }
+    delete_many(resp_hash, keys, count);
+    journal_unlock(journal);
+
+    return journal_wait(journal, lsn) ? OK : SERVER_ERROR;
+}
+
+/*
+ * Stores a pair only if the entry still has the given version, journaling it
+ * when the journal is on. Ownership is as for creamput.
+ */
+uint32_t creamcas(map_key_t key, map_val_t val, uint64_t *version){
+    journal_mark_t mark;
+    uint64_t lsn = 0;
+    bool swapped;
+    int err;
+
+    // the record goes in before the swap, and is taken back if there is none
+    if(journal != NULL){
+        journal_lock(journal);
+        mark = journal_mark(journal);
+        if((lsn = journal_append(journal, PUT, key, val)) == 0){
+            journal_unlock(journal);
+            destroymapnode(key, val);
+            return SERVER_ERROR;
+        }
+    }
+    swapped = cas(resp_hash, key, val, version);
+    err = errno;
+    if(journal != NULL){
+        if(!swapped){
+            journal_rollback(journal, mark);
+        }
+        journal_unlock(journal);
+    }
+
+    if(!swapped){
+        destroymapnode(key, val);
+        return err == ESTALE ? CONFLICT : err == ENOENT ? NOT_FOUND : BAD_REQUEST;
+    }
+    lease_revoke(leases, key);
+    if(journal != NULL && !journal_wait(journal, lsn)){
+        return SERVER_ERROR;
+    }
+    return OK;
+}
+
+/*
+ * Fills a key under a lease from LGET. The pair is journaled and goes in only
+ * if the key is still missing and token still holds the lease, which ends as
+ * the pair goes in. Ownership is as for creamput.
+ */
+uint32_t creamlput(map_key_t key, map_val_t val, uint64_t token){
+    journal_mark_t mark;
+    uint64_t lsn = 0;
+    bool added;
+    int err;
+
+    if(journal != NULL){
+        journal_lock(journal);
+        mark = journal_mark(journal);
+        if((lsn = journal_append(journal, PUT, key, val)) == 0){
+            journal_unlock(journal);
+            destroymapnode(key, val);
+            return SERVER_ERROR;
+        }
+    }
+    added = put_absent(resp_hash, key, val, true, creamleased, &token);
+    err = errno;
+    if(journal != NULL){
+        if(!added){
+            journal_rollback(journal, mark);
+        }
+        journal_unlock(journal);
+    }
+    creamspillflush();
+
+    if(!added){
+        destroymapnode(key, val);
+        return err == EEXIST || err == ESTALE ? CONFLICT : BAD_REQUEST;
+    }
+    if(journal != NULL && !journal_wait(journal, lsn)){
+        return SERVER_ERROR;
+    }
+    return OK;
+}
+
+/*
+ * Check for put_absent on LPUT: releases the lease if token still holds it.
+ */
+bool creamleased(map_key_t key, void *arg){
+    return lease_release(leases, key, *(uint64_t *)arg);
+}
+
+/*
+ * Applies INCR, DECR, APPEND or PREPEND to the value of key. The new value is
+ * computed and journaled while the map is locked, so concurrent updates of
+ * one key are never lost. A key spilled to the tier is promoted first.
+ */
+uint32_t creamupdate(uint8_t op, map_key_t key, map_val_t operand, uint64_t *counter){
+    cream_update_t upd = {.op = op, .operand = operand, .code = NOT_FOUND};
+
+    // a spilled key is moved back into the map and updated there
+    for(int tries = 0; tries < 2 && upd.code == NOT_FOUND; tries++){
+        if(tries > 0 && !creampromote(key)){
+            break;
+        }
+        if(journal == NULL){
+            update(resp_hash, key, creamapply, &upd);
+        } else {
+            journal_lock(journal);
+            update(resp_hash, key, creamapply, &upd);
+            journal_unlock(journal);
+        }
+    }
+
+    *counter = upd.counter;
+    if(upd.code == OK){
+        lease_revoke(leases, key);
+    }
+    if(journal == NULL){
+        return upd.code;
+    }
+    if(upd.code == OK && !journal_wait(journal, upd.lsn)){
+        return SERVER_ERROR;
+    }
+    return upd.code;
+}
+
+/*
+ * Updater passed to the map by creamupdate. Counters are stored as decimal
+ * text so they read back naturally through GET.
+ */
+bool creamapply(map_key_t key, map_val_t *val, void *arg){
+    cream_update_t *upd = arg;
+    char digits[COUNTER_DIGITS + 1];
+    map_val_t newval;
+    uint64_t delta;
+    char *end;
+    int len;
+
+    if(upd->op == INCR || upd->op == DECR){
+        // the stored value must be a plain decimal number
+        if(val->val_len < 1 || val->val_len > COUNTER_DIGITS){
+            upd->code = BAD_REQUEST;
+            return false;
+        }
+        memcpy(digits, val->val_base, val->val_len);
+        digits[val->val_len] = '\0';
+        errno = 0;
+        upd->counter = strtoull(digits, &end, 10);
+        if(*end != '\0' || digits[0] < '0' || digits[0] > '9' || errno == ERANGE){
+            upd->code = BAD_REQUEST;
+            return false;
+        }
+
+        memcpy(&delta, upd->operand.val_base, sizeof(uint64_t));
+        if(upd->op == INCR){
+            upd->counter += delta;
+        } else {
+            upd->counter = delta > upd->counter ? 0 : upd->counter - delta;
+        }
+        len = snprintf(digits, sizeof(digits), "%" PRIu64, upd->counter);
+        newval = MAP_VAL(creamalloc(len), len);
+        if(newval.val_base != NULL){
+            memcpy(newval.val_base, digits, len);
+        }
+    } else {
+        if(val->val_len + upd->operand.val_len > max_value_size){
+            upd->code = BAD_REQUEST;
+            return false;
+        }
+        newval = MAP_VAL(creamalloc(val->val_len + upd->operand.val_len), val->val_len + upd->operand.val_len);
+        if(newval.val_base != NULL && upd->op == APPEND){
+            memcpy(newval.val_base, val->val_base, val->val_len);
+            memcpy((char *)newval.val_base + val->val_len, upd->operand.val_base, upd->operand.val_len);
+        } else if(newval.val_base != NULL){
+            memcpy(newval.val_base, upd->operand.val_base, upd->operand.val_len);
+            memcpy((char *)newval.val_base + upd->operand.val_len, val->val_base, val->val_len);
+        }
+    }
+
+    if(newval.val_base == NULL){
+        upd->code = SERVER_ERROR;
+        return false;
+    }
+
+    // the caller holds the journal lock, so the record lands in map order
+    if(journal != NULL && (upd->lsn = journal_append(journal, PUT, key, newval)) == 0){
+        creamfree(newval.val_base);
+        upd->code = SERVER_ERROR;
+        return false;
+    }
+
+    creamfree(val->val_base);
+    *val = newval;
+    upd->code = OK;
+    return true;
+}
+
+uint32_t creamclear(void){
+    uint64_t lsn;
+
+    clear_leases(leases);
+
+    if(journal == NULL){
+        clear_map(resp_hash);
+        return OK;
+    }
+
+    journal_lock(journal);
+    if((lsn = journal_append(journal, CLEAR, MAP_KEY(NULL, 0), MAP_VAL(NULL, 0))) == 0){
+        journal_unlock(journal);
+        return SERVER_ERROR;
+    }
+    clear_map(resp_hash);
+    journal_unlock(journal);
+
+    return journal_wait(journal, lsn) ? OK : SERVER_ERROR;
+}
+
+stats_op_t creamstatsop(uint8_t request_code){
+    switch(request_code){
+        case GET: return STATS_GET;
+        case PUT: return STATS_PUT;
+        case EVICT: return STATS_EVICT;
+        case CLEAR: return STATS_CLEAR;
+        case MGET: return STATS_MGET;
+        case MPUT: return STATS_MPUT;
+        case MDEL: return STATS_MDEL;
+        case INCR: case DECR: case APPEND: case PREPEND: return STATS_UPDATE;
+        case GETS: return STATS_GETS;
+        case CAS: return STATS_CAS;
+        case LGET: return STATS_LGET;
+        case LPUT: return STATS_LPUT;
+        case STATS: return STATS_STATS;
+        default: return STATS_OTHER;
+    }
+}
+
+/*
+ * Formats the server's counters. The per-thread blocks are summed here, so
+ * serving requests never touches a shared counter.
+ */
+uint32_t creamstats(char **outbody, uint32_t *outlen){
+    static const char *lane_names[CREAM_LANES] = {"read", "write", "admin"};
+    stats_block_t *total;
+    uint64_t entries = 0, capacity = 0, bytes = 0, evictions = 0, expirations = 0;
+    hashmap_t *map;
+    struct timespec now;
+    size_t used;
+    char *buf;
+
+    *outbody = NULL;
+    *outlen = 0;
+    if((total = aligned_alloc(STATS_LINE, sizeof(stats_block_t))) == NULL){
+        return SERVER_ERROR;
+    }
+    if((buf = malloc(STATS_BUFSIZE)) == NULL){
+        free(total);
+        return SERVER_ERROR;
+    }
+    stats_merge(stats, total);
+
+    // the map keeps its own gauges, updated under its write lock. in
+    // shared-nothing mode they are summed over every shard's partition
+    for(int i = 0; i < (shards != NULL ? num_shards : 1); i++){
+        map = shards != NULL ? shards[i].map : resp_hash;
+        entries += map->size;
+        capacity += map->capacity;
+        bytes += map->bytes;
+        evictions += map->evictions;
+        expirations += map->expirations;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    used = snprintf(buf, STATS_BUFSIZE, "uptime_s %" PRIu64 "\nworkers %d\nworkers_min %d\nworkers_max %d\n"
+        "workers_grown %" PRIu64 "\nworkers_retired %" PRIu64 "\nqueue_length %d\nqueue_limit %d\n"
+        "shed_full %" PRIu64 "\nshed_delay %" PRIu64 "\nconnections_open %" PRIu64 "\nchannels_open %d\n"
+        "entries %" PRIu64 "\ncapacity %" PRIu64 "\nbytes_stored %" PRIu64 "\nevictions %" PRIu64 "\n"
+        "expirations %" PRIu64 "\n", (uint64_t)now.tv_sec - stats->started, live_workers, min_workers,
+        max_workers, pool_grown, pool_retired, lanes_length(con_lanes), con_lanes->queues[0]->limit, shed_full,
+        shed_delay, total->conns_opened - total->conns_closed, chan_open, entries, capacity, bytes, evictions, expirations);
+    for(int i = 0; con_lanes->num_lanes > 1 && i < con_lanes->num_lanes; i++){
+        used += snprintf(buf + used, STATS_BUFSIZE - used, "lane_%s_length %d\nlane_%s_weight %d\n", lane_names[i],
+            con_lanes->queues[i]->length, lane_names[i], con_lanes->weights[i]);
+    }
+    used += stats_print(total, buf + used, STATS_BUFSIZE - used);
+    used += lockstat_print(buf + used, STATS_BUFSIZE - used);
+    free(total);
+
+    *outbody = buf;
+    *outlen = used;
+    return OK;
+}
+
+void creamdump(void){
+    char *text;
+    uint32_t len;
+
+    if(creamstats(&text, &len) == OK){
+        fwrite(text, 1, len, stderr);
+        free(text);
+    }
+    if(trace != NULL && !trace_flush(trace)){
+        perror("trace");
+    }
+}
+
+/*
+ * Applies a journal record at startup. Records point into the journal, so
+ * PUTs are copied before they are handed to the map.
+ */
+void creamreplay(uint8_t op, map_key_t key, map_val_t val){
+    map_key_t key_node;
+    map_val_t val_node;
+
+    if(op == PUT){
+        key_node = MAP_KEY(creamalloc(key.key_len), key.key_len);
+        val_node = MAP_VAL(creamalloc(val.val_len), val.val_len);
+        if(key_node.key_base == NULL || val_node.val_base == NULL){
+            destroymapnode(key_node, val_node);
+            return;
+        }
+        memcpy(key_node.key_base, key.key_base, key.key_len);
+        memcpy(val_node.val_base, val.val_base, val.val_len);
+        if(!put(resp_hash, key_node, val_node, true)){
+            destroymapnode(key_node, val_node);
+        }
+        creamspillflush();
+    } else if(op == EVICT){
+        delete(resp_hash, key);
+    } else if(op == CLEAR){
+        clear_map(resp_hash);
+    }
+}
+
+/*
+ * Parses a CPU list such as 0-3,8,10-11 into opts->cpus, in order.
+ */
+bool creamparsecpus(const char *list, cream_opts_t *opts){
+    long first, last;
+    char *end;
+
+    free(opts->cpus);
+    opts->num_cpus = 0;
+    if((opts->cpus = malloc(CPU_SETSIZE * sizeof(int))) == NULL){
+        return false;
+    }
+    for(;;){
+        first = last = strtol(list, &end, 10);
+        if(end == list || first < 0){
+            return false;
+        }
+        if(*end == '-'){
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if(end == list || last < first){
+                return false;
+            }
+        }
+        if(last >= CPU_SETSIZE || opts->num_cpus + (last - first + 1) > CPU_SETSIZE){
+            return false;
+        }
+        for(long cpu = first; cpu <= last; cpu++){
+            opts->cpus[opts->num_cpus++] = cpu;
+        }
+        if(*end == '\0'){
+            return true;
+        }
+        if(*end != ','){
+            return false;
+        }
+        list = end + 1;
+    }
+}
+
+/*
+ * Pins the calling worker to its CPU from -A and touches its share of the
+ * map's node table, so the pages are allocated on the worker's NUMA node
+ * rather than wherever the table happens to be first written. Nodes in a
+ * shared store are already backed and are left alone. Reports where the
+ * worker ended up on stderr.
+ */
+void creamplace(long index, hashmap_t *map, long share, long shares){
+    size_t from, to;
+    cpu_set_t set;
+    unsigned int cpu = 0, node = 0;
+
+    CPU_ZERO(&set);
+    CPU_SET(worker_cpus[index % num_cpus], &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0){
+        fprintf(stderr, "worker %ld: can't run on cpu %d\n", index, worker_cpus[index % num_cpus]);
+    }
+
+    if(map != NULL && !map->shared_nodes){
+        from = (size_t)map->capacity * share / shares;
+        to = (size_t)map->capacity * (share + 1) / shares;
+        creamprefault(map->nodes + from, (to - from) * sizeof(map_node_t));
+    }
+
+    syscall(SYS_getcpu, &cpu, &node, NULL);
+    fprintf(stderr, "worker %ld: cpu %u, node %u\n", index, cpu, node);
+}
+
+/*
+ * Writes each page of a range back to itself, so untouched pages are
+ * allocated by the calling thread. Nothing else may write the range
+ * meanwhile.
+ */
+void creamprefault(void *base, size_t len){
+    long page = sysconf(_SC_PAGESIZE);
+    volatile char *byte;
+
+    for(size_t off = 0; off < len; off += page){
+        byte = (volatile char *)base + off;
+        *byte = *byte;
+    }
+}
+
+/*
+ * Sets up shared-nothing mode: a partition of MAX_ENTRIES / NUM_WORKERS
+ * entries, rounded up, and a listening socket per shard, and a ring for
+ * every ordered pair of shards.
+ */
+void creamshardinit(cream_opts_t *opts){
+    struct epoll_event ev = {.events = EPOLLIN};
+    cream_shard_t *shard;
+    uint32_t capacity;
+
+    num_shards = opts->num_workers;
+    capacity = (opts->hash_size + num_shards - 1) / num_shards;
+    if((shards = calloc(num_shards, sizeof(cream_shard_t))) == NULL ||
+        (shard_rings = calloc(num_shards * num_shards, sizeof(ring_t *))) == NULL){
+        perror("shards");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 0; i < num_shards; i++){
+        shard = &shards[i];
+        shard->index = i;
+        shard->map = create_map(capacity, jenkins_one_at_a_time_hash, destroymapnode);
+        shard->backlog = calloc(num_shards, sizeof(cream_shard_msg_t *));
+        shard->backlog_tail = calloc(num_shards, sizeof(cream_shard_msg_t *));
+        shard->wake = calloc(num_shards, sizeof(bool));
+        if(shard->map == NULL || shard->backlog == NULL || shard->backlog_tail == NULL || shard->wake == NULL){
+            perror("shards");
+            exit(EXIT_FAILURE);
+        }
+        for(int j = 0; j < num_shards; j++){
+            if(i != j && (shard_rings[i * num_shards + j] = create_ring(SHARD_RING_SIZE)) == NULL){
+                perror("ring");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // the listening socket and the wakeup are told apart from
+        // connections by their pointers
+        creamsockinit(&shard->listen_fd, opts->port, true);
+        if((shard->epoll_fd = epoll_create1(0)) < 0 || (shard->wake_fd = eventfd(0, EFD_NONBLOCK)) < 0){
+            perror("epoll");
+            exit(EXIT_FAILURE);
+        }
+        ev.data.ptr = NULL;
+        if(epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->listen_fd, &ev) < 0){
+            perror("epoll");
+            exit(EXIT_FAILURE);
+        }
+        ev.data.ptr = &shard->wake_fd;
+        if(epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->wake_fd, &ev) < 0){
+            perror("epoll");
+            exit(EXIT_FAILURE);
+        }
+        if((conn_idle_ms != 0 || conn_io_ms != 0) &&
+            (shard->wheel = create_wheel(CONN_WHEEL_SLOTS, CONN_WHEEL_TICK_MS, conn_clock())) == NULL){
+            perror("wheel");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+ * The event loop of one shard. It serves its own connections and whatever
+ * the other shards send it, and never waits on another thread.
+ */
+void creamshard(void *arg){
+    cream_shard_t *self = &shards[(long)arg];
+    struct epoll_event events[CREAM_EVENTS];
+    uint64_t wakeups;
+    conn_t *conn;
+    bool backed_up;
+    int ready;
+
+    stats_local = stats_block(stats, self->index);
+    // only this shard touches its partition, so it can be placed while the
+    // others serve
+    if(worker_cpus != NULL){
+        creamplace(self->index, self->map, 0, 1);
+    }
+
+    for(;;){
+        // a full ring's reader won't say when it has room, so a backlog is
+        // retried every millisecond, and timed connections every tick
+        backed_up = false;
+        for(int j = 0; j < num_shards; j++){
+            backed_up = backed_up || self->backlog[j] != NULL;
+        }
+        if((ready = epoll_wait(self->epoll_fd, events, CREAM_EVENTS,
+            backed_up ? 1 : self->wheel != NULL ? CONN_WHEEL_TICK_MS : -1)) < 0){
+            ready = 0;
+        }
+
+        for(int i = 0; i < ready; i++){
+            conn = events[i].data.ptr;
+            if(conn == NULL){
+                creamshardaccept(self);
+            } else if(events[i].data.ptr == &self->wake_fd){
+                while(read(self->wake_fd, &wakeups, sizeof(wakeups)) > 0);
+            } else if(((events[i].events & EPOLLOUT) && (!conn_flush(conn) || !creamsharddispatch(self, conn))) ||
+                ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !creamshardread(self, conn))){
+                creamsharddrop(self, conn);
+            }
+        }
+        creamshardpoll(self);
+        if(self->wheel != NULL){
+            creamshardtimeouts(self);
+        }
+    }
+}
+
+void creamshardaccept(cream_shard_t *self){
+    struct epoll_event ev = {.events = EPOLLIN};
+    uint64_t now;
+    conn_t *conn;
+    int fd, one = 1;
+
+    // a shard serves every one of its connections, so it never blocks on one
+    if((fd = accept4(self->listen_fd, NULL, NULL, SOCK_NONBLOCK)) < 0){
+        return;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if((conn = create_conn(fd)) == NULL){
+        close(fd);
+        return;
+    }
+    conn->io_ms = conn_io_ms;
+    conn->events = ev.events;
+    ev.data.ptr = conn;
+    if(epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0){
+        conn_release(conn);
+        return;
+    }
+    if(self->wheel != NULL){
+        now = conn_clock();
+        conn->idle_since = now;
+        wheel_arm(self->wheel, &conn->timer, creamnextcheck(conn, now));
+    }
+    stats_local->conns_opened++;
+}
+
+/*
+ * Stops serving a connection. Requests still in flight hold it open and
+ * answer it if the socket takes their responses; only the first drop counts.
+ */
+void creamsharddrop(cream_shard_t *self, conn_t *conn){
+    if(conn->dropped){
+        return;
+    }
+    conn->dropped = true;
+    if(self->wheel != NULL){
+        wheel_disarm(self->wheel, &conn->timer);
+    }
+    epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    stats_local->conns_closed++;
+    conn_release(conn);
+}
+
+/*
+ * The shard owning a key. The map hash is scrambled first, so a partition's
+ * keys don't all share a residue modulo its table's capacity.
+ */
+int creamshardof(map_key_t key){
+    uint32_t mixed = jenkins_one_at_a_time_hash(key) * 2654435761u;
+
+    return ((uint64_t)mixed * num_shards) >> 32;
+}
+
+/*
+ * Takes whatever a connection has sent and dispatches the frames that are
+ * whole. Returns false once the connection should be dropped.
+ */
+bool creamshardread(cream_shard_t *self, conn_t *conn){
+    bool open;
+
+    // a frame's header says whether it's too long before its body comes,
+    // so the buffer never has to hold more than the longest frame
+    open = conn_fill(conn, sizeof(request_header_v2_t) + sizeof(uint32_t) + CMSGSIZE + max_value_size);
+    return creamsharddispatch(self, conn) && open;
+}
+
+/*
+ * Sends each whole frame in a connection's input buffer on its way: to the
+ * shard owning its key, to every shard for a CLEAR, or straight to its reply
+ * for anything else. It stops at a partial frame, behind a version 1 frame
+ * being answered, or while the connection's responses back up. Returns
+ * false once the connection should be dropped.
+ */
+bool creamsharddispatch(cream_shard_t *self, conn_t *conn){
+    request_header_t header;
+    cream_shard_msg_t *msg, *child;
+    struct timespec started;
+    uint32_t bodylen, request_id, statslen, budget_us;
+    uint16_t flags;
+    size_t done = 0, hdrlen;
+    char *statsbody, *frame;
+    bool v2, oversized, partial = false;
+    int dest;
+
+    while(!conn->dropped && !conn->awaiting && conn->out_len < SHARD_OUT_MAX){
+        frame = conn->in + done;
+        if((hdrlen = creamparseheader(frame, conn->in_len - done, &header, &v2, &request_id, &flags,
+            &budget_us)) == 0){
+            partial = conn->in_len > done;
+            break;
+        }
+
+        // a PUT value goes into its own allocation for the map to own
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        bodylen = header.request_code == PUT ? header.key_size : header.key_size + header.value_size;
+        oversized = bodylen > CMSGSIZE || bodylen < header.key_size ||
+            (header.request_code == PUT && header.value_size > max_value_size);
+        if(!oversized && conn->in_len - done - hdrlen < (size_t)header.key_size + header.value_size){
+            partial = true;
+            break;
+        }
+        if((msg = calloc(1, sizeof(cream_shard_msg_t) + (oversized ? 0 : bodylen))) == NULL){
+            conn_consume(conn, done);
+            return false;
+        }
+        conn_hold(conn);
+        conn->frames++;
+        *msg = (cream_shard_msg_t) {.conn = conn, .origin = self->index, .v2 = v2, .request_id = request_id,
+            .flags = flags, .code = header.request_code, .key_size = header.key_size, .response_code = BAD_REQUEST,
+            .started = started, .budget_us = budget_us};
+        // a version 1 client gets its answers in order, so its next frame
+        // waits until this one is answered
+        conn->awaiting = !v2;
+        if(oversized){
+            // the stream can't be followed past a body that isn't read
+            conn_consume(conn, done);
+            creamshardreply(self, msg);
+            return false;
+        }
+        memcpy(msg->body, frame + hdrlen, bodylen);
+        if(header.request_code == PUT && header.value_size > 0 &&
+            (msg->val.val_base = creamalloc(header.value_size)) != NULL){
+            memcpy(msg->val.val_base, frame + hdrlen + bodylen, header.value_size);
+            msg->val.val_len = header.value_size;
+        }
+        done += hdrlen + header.key_size + header.value_size;
+
+        switch(header.request_code){
+            case GET:
+            case PUT:
+            case EVICT:
+                if(header.key_size < MIN_KEY_SIZE || header.key_size > MAX_KEY_SIZE ||
+                    (header.request_code == PUT && header.value_size < MIN_VALUE_SIZE)){
+                    creamfree(msg->val.val_base);
+                    msg->val = MAP_VAL(NULL, 0);
+                    break;
+                }
+                if((dest = creamshardof(MAP_KEY(msg->body, header.key_size))) != self->index){
+                    creamshardroute(self, msg, dest);
+                    continue;
+                }
+                creamshardexec(self, msg);
+                break;
+            case CLEAR:
+                // answered once every shard has cleared its partition
+                creamshardexec(self, msg);
+                for(int j = 0; j < num_shards; j++){
+                    if(j == self->index){
+                        continue;
+                    }
+                    if((child = calloc(1, sizeof(cream_shard_msg_t))) == NULL){
+                        msg->response_code = SERVER_ERROR;
+                        continue;
+                    }
+                    *child = (cream_shard_msg_t) {.origin = self->index, .code = CLEAR, .parent = msg};
+                    msg->pending++;
+                    creamshardroute(self, child, j);
+                }
+                if(msg->pending > 0){
+                    continue;
+                }
+                break;
+            case STATS:
+                msg->response_code = creamstats(&statsbody, &statslen);
+                msg->val = MAP_VAL(statsbody, statslen);
+                break;
+            default:
+                msg->response_code = UNSUPPORTED;
+        }
+
+        creamshardreply(self, msg);
+    }
+    conn_consume(conn, done);
+
+    // a frame that has started must finish arriving within the deadline
+    if(!partial || conn->read_deadline == 0){
+        conn_deadline(conn, &conn->read_deadline, partial);
+    }
+    creamshardwatch(self, conn);
+    return !conn->dropped;
+}
+
+/*
+ * Watches a connection for its next frames unless it is waiting on a
+ * version 1 answer or its responses are backed up, and for room to write
+ * while any are. A connection with nothing in flight, buffered or unsent is
+ * idle.
+ */
+void creamshardwatch(cream_shard_t *self, conn_t *conn){
+    struct epoll_event ev = {.data.ptr = conn};
+    bool idle;
+
+    if(conn->dropped){
+        return;
+    }
+    ev.events = (conn->awaiting || conn->out_len >= SHARD_OUT_MAX ? 0 : EPOLLIN) | (conn->out_len > 0 ? EPOLLOUT : 0);
+    if(ev.events != conn->events){
+        epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = ev.events;
+    }
+
+    idle = conn->frames == 0 && conn->in_len == 0 && conn->out_len == 0;
+    if(self->wheel != NULL && idle && conn->state != CONN_IDLE){
+        conn->idle_since = conn_clock();
+    }
+    conn->state = idle ? CONN_IDLE : CONN_BUSY;
+}
+
+/*
+ * Sends a message to another shard. Behind a backlog a message waits its
+ * turn, so a ring always delivers in send order.
+ */
+void creamshardroute(cream_shard_t *self, cream_shard_msg_t *msg, int dest){
+    if(self->backlog[dest] == NULL && ring_push(shard_rings[self->index * num_shards + dest], msg)){
+        self->wake[dest] = true;
+        return;
+    }
+    msg->next = NULL;
+    if(self->backlog[dest] == NULL){
+        self->backlog[dest] = msg;
+    } else {
+        self->backlog_tail[dest]->next = msg;
+    }
+    self->backlog_tail[dest] = msg;
+}
+
+/*
+ * Serves what the other shards sent: requests for this shard's partition
+ * are run and sent back, and answers to this shard's own requests go out to
+ * their clients. Then retries backed up messages and wakes every shard that
+ * was sent something.
+ */
+void creamshardpoll(cream_shard_t *self){
+    cream_shard_msg_t *msg;
+    ring_t *ring;
+    uint64_t one = 1;
+
+    for(int j = 0; j < num_shards; j++){
+        if(j == self->index){
+            continue;
+        }
+        ring = shard_rings[j * num_shards + self->index];
+        while((msg = ring_pop(ring)) != NULL){
+            if(msg->origin != self->index){
+                creamshardexec(self, msg);
+                creamshardroute(self, msg, msg->origin);
+            } else if(msg->parent != NULL){
+                // the last shard to clear its partition answers the CLEAR
+                if(--msg->parent->pending == 0){
+                    creamshardanswer(self, msg->parent);
+                }
+                free(msg);
+            } else {
+                creamshardanswer(self, msg);
+            }
+        }
+    }
+
+    for(int j = 0; j < num_shards; j++){
+        ring = shard_rings[self->index * num_shards + j];
+        while(self->backlog[j] != NULL && ring_push(ring, self->backlog[j])){
+            self->backlog[j] = self->backlog[j]->next;
+            self->wake[j] = true;
+        }
+        if(self->wake[j]){
+            self->wake[j] = false;
+            if(write(shards[j].wake_fd, &one, sizeof(one)) < 0){
+                perror("eventfd");
+            }
+        }
+    }
+}
+
+/*
+ * Runs a request against this shard's partition. A GET leaves a copy of the
+ * value in msg->val, and a PUT hands its pair to the map.
+ */
+void creamshardexec(cream_shard_t *self, cream_shard_msg_t *msg){
+    map_key_t key = MAP_KEY(msg->body, msg->key_size);
+
+    // a CLEAR runs on every shard or none, so only single keys expire
+    if(msg->budget_us != 0 && msg->code != CLEAR && creamexpired(&msg->started, msg->budget_us)){
+        creamfree(msg->val.val_base);
+        msg->val = MAP_VAL(NULL, 0);
+        msg->response_code = TIMEOUT;
+        stats_local->expired++;
+        return;
+    }
+
+    switch(msg->code){
+        case GET:
+            msg->val = get(self->map, key);
+            if(msg->val.val_base == NULL){
+                stats_local->misses++;
+                msg->response_code = NOT_FOUND;
+            } else {
+                stats_local->hits++;
+                msg->response_code = OK;
+            }
+            break;
+        case PUT:
+            key.key_base = creamalloc(msg->key_size);
+            msg->response_code = BAD_REQUEST;
+            if(key.key_base != NULL && msg->val.val_base != NULL){
+                memcpy(key.key_base, msg->body, msg->key_size);
+                if(put(self->map, key, msg->val, true)){
+                    msg->response_code = OK;
+                    msg->val = MAP_VAL(NULL, 0);
+                    break;
+                }
+            }
+            destroymapnode(key, msg->val);
+            msg->val = MAP_VAL(NULL, 0);
+            break;
+        case EVICT:
+            delete(self->map, key);
+            msg->response_code = OK;
+            break;
+        case CLEAR:
+            clear_map(self->map);
+            msg->response_code = OK;
+            break;
+    }
+}
+
+/*
+ * Answers a request from the shard that read it, on the connection it came
+ * in on. The response is written as far as the socket takes it, and the rest
+ * when epoll says there's room.
+ */
+void creamshardreply(cream_shard_t *self, cream_shard_msg_t *msg){
+    response_header_t resp = {.response_code = msg->response_code, .value_size = msg->val.val_len};
+    response_header_v2_t v2resp;
+    struct iovec iov[2];
+    struct timespec finished;
+    stats_op_t kind = creamstatsop(msg->code);
+    conn_t *conn = msg->conn;
+
+    if(msg->val.val_base == NULL){
+        resp.value_size = 0;
+    }
+    if(msg->v2){
+        v2resp = (response_header_v2_t) {.magic = PROTOCOL_V2, .request_id = msg->request_id,
+            .response_code = resp.response_code, .value_size = resp.value_size};
+        iov[0] = (struct iovec) {.iov_base = &v2resp, .iov_len = sizeof(response_header_v2_t)};
+    } else {
+        iov[0] = (struct iovec) {.iov_base = &resp, .iov_len = sizeof(response_header_t)};
+    }
+    iov[1] = (struct iovec) {.iov_base = msg->val.val_base, .iov_len = resp.value_size};
+    if(!(msg->v2 && (msg->flags & FLAG_NOREPLY) && resp.response_code == OK) &&
+        (!conn_queue(conn, iov, 2) || !conn_flush(conn))){
+        creamsharddrop(self, conn);
+    }
+    free(msg->val.val_base);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    stats_local->ops[kind]++;
+    stats_record(&stats_local->latency[kind], (uint64_t)(finished.tv_sec - msg->started.tv_sec) * 1000000000 +
+        finished.tv_nsec - msg->started.tv_nsec);
+
+    conn->frames--;
+    if(!msg->v2){
+        conn->awaiting = false;
+    }
+    creamshardwatch(self, conn);
+    conn_release(conn);
+    free(msg);
+}
+
+/*
+ * Replies to a request that came back from the other shards, then
+ * dispatches the frames its connection sent meanwhile, which a version 1
+ * answer may have been holding back.
+ */
+void creamshardanswer(cream_shard_t *self, cream_shard_msg_t *msg){
+    conn_t *conn = msg->conn;
+
+    conn_hold(conn);
+    creamshardreply(self, msg);
+    if(!creamsharddispatch(self, conn)){
+        creamsharddrop(self, conn);
+    }
+    conn_release(conn);
+}
+
+/*
+ * Turns the shard's wheel, run by its event loop each tick. Nothing is
+ * blocked on a connection, so a stalled or idle one is dropped here.
+ */
+void creamshardtimeouts(cream_shard_t *self){
+    uint64_t now = conn_clock();
+    wheel_timer_t *timer;
+    conn_t *conn;
+
+    while((timer = wheel_expire(self->wheel, now)) != NULL){
+        conn = (conn_t *)((char *)timer - offsetof(conn_t, timer));
+        if((conn->read_deadline != 0 && conn->read_deadline <= now) ||
+            (conn->write_deadline != 0 && conn->write_deadline <= now)){
+            // the requests it has in flight find the socket shut
+            shutdown(conn->fd, SHUT_RDWR);
+            stats_local->conns_stalled++;
+            creamsharddrop(self, conn);
+            continue;
+        } else if(conn_idle_ms != 0 && conn->state == CONN_IDLE && conn->idle_since + conn_idle_ms <= now){
+            stats_local->conns_idle++;
+            creamsharddrop(self, conn);
+            continue;
+        }
+        wheel_arm(self->wheel, timer, creamnextcheck(conn, now));
+    }
+}
@@ -0,0 +1,122 @@
+#include "handover.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static bool ctladdr(const char *path, struct sockaddr_un *addr){
+    if(strlen(path) >= sizeof(addr->sun_path)){
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    bzero(addr, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+int handover_listen(const char *path) {
+    struct sockaddr_un addr;
+    int ctlfd;
+
+    if(!ctladdr(path, &addr) || (ctlfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0){
+        return -1;
+    }
+
+    unlink(path);
+    if(bind(ctlfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(ctlfd, 1) < 0){
+        close(ctlfd);
+        return -1;
+    }
+
+    return ctlfd;
+}
+
+bool handover_request(const char *path, int *fds) {
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    char ctrl[CMSG_SPACE(sizeof(int) * HANDOVER_FDS)];
+    char byte;
+    int connfd;
+
+    if(!ctladdr(path, &addr) || (connfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0){
+        return false;
+    }
+
+    // nobody serving at path means there is nothing to take over
+    if(connect(connfd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        close(connfd);
+        return false;
+    }
+
+    bzero(&msg, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    if(recvmsg(connfd, &msg, 0) <= 0 || (cmsgp = CMSG_FIRSTHDR(&msg)) == NULL ||
+        cmsgp->cmsg_type != SCM_RIGHTS || cmsgp->cmsg_len != CMSG_LEN(sizeof(int) * HANDOVER_FDS)){
+        close(connfd);
+        errno = EPROTO;
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsgp), sizeof(int) * HANDOVER_FDS);
+
+    // tell the predecessor it can exit
+    if(write(connfd, &byte, 1) != 1){
+        perror("handover ack");
+    }
+    close(connfd);
+
+    return true;
+}
+
+int handover_wait(int ctlfd) {
+    int connfd;
+
+    while((connfd = accept(ctlfd, NULL, NULL)) < 0){
+        if(errno != EINTR){
+            return -1;
+        }
+    }
+
+    return connfd;
+}
+
+bool handover_send(int connfd, int *fds) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    char ctrl[CMSG_SPACE(sizeof(int) * HANDOVER_FDS)];
+    char byte = 'H';
+
+    bzero(&msg, sizeof(msg));
+    bzero(ctrl, sizeof(ctrl));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    cmsgp = CMSG_FIRSTHDR(&msg);
+    cmsgp->cmsg_level = SOL_SOCKET;
+    cmsgp->cmsg_type = SCM_RIGHTS;
+    cmsgp->cmsg_len = CMSG_LEN(sizeof(int) * HANDOVER_FDS);
+    memcpy(CMSG_DATA(cmsgp), fds, sizeof(int) * HANDOVER_FDS);
+
+    if(sendmsg(connfd, &msg, 0) < 0){
+        return false;
+    }
+
+    // wait for the successor to hold the descriptors
+    return read(connfd, &byte, 1) == 1;
+}
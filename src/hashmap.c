@@ -1,5 +1,6 @@
 #include "utils.h"
 #include "cream_add.h"
+#include "probes.h"
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,6 +9,13 @@
 #define MAP_VAL(base, len) (map_val_t) {.val_base = base, .val_len = len}
 #define MAP_NODE(key_arg, val_arg, tombstone_arg) (map_node_t) {.key = key_arg, .val = val_arg, .tombstone = tombstone_arg}
 
+static bool put_locked(hashmap_t *self, map_key_t key, map_val_t val, bool force);
+static map_val_t get_locked(hashmap_t *self, map_key_t key, uint64_t *version);
+static map_node_t *find_locked(hashmap_t *self, map_key_t key);
+static map_node_t delete_locked(hashmap_t *self, map_key_t key);
+
+__thread uint32_t map_probes;
+
 hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f destroy_function) {
     hashmap_t *new_hmap;
     if((new_hmap = calloc(1, sizeof(hashmap_t))) == NULL){
@@ -19,23 +27,69 @@ hashmap_t *create_map(uint32_t capacity, hash_func_f hash_function, destructor_f
     new_hmap->nodes = calloc(capacity, sizeof(map_node_t));
     new_hmap->hash_function = hash_function;
     new_hmap->destroy_function = destroy_function;
+    new_hmap->evict_function = NULL;
+    new_hmap->forget_function = NULL;
+    new_hmap->num_readers = 0;
+    new_hmap->shared_nodes = false;
+    new_hmap->version = 0;
+    new_hmap->invalid = false;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+    sem_init(&new_hmap->write_lock, 0, 1);
+    pthread_mutex_init(&new_hmap->fields_lock, &attr);
+    lockstat_register(&new_hmap->write_stat, "map_write");
+    lockstat_register(&new_hmap->fields_stat, "map_fields");
+
+    return new_hmap;
+}
+
+hashmap_t *create_map_over(uint32_t capacity, map_node_t *nodes, hash_func_f hash_function, destructor_f destroy_function) {
+    hashmap_t *new_hmap;
+    if(nodes == NULL || (new_hmap = calloc(1, sizeof(hashmap_t))) == NULL){
+        return NULL;
+    }
+
+    new_hmap->capacity = capacity;
+    new_hmap->size = 0;
+    new_hmap->nodes = nodes;
+    new_hmap->hash_function = hash_function;
+    new_hmap->destroy_function = destroy_function;
+    new_hmap->evict_function = NULL;
+    new_hmap->forget_function = NULL;
     new_hmap->num_readers = 0;
+    new_hmap->shared_nodes = true;
     new_hmap->invalid = false;
 
+    // count entries left by a previous owner
+    for(int i = 0; i < capacity; i++){
+        if(nodes[i].key.key_len != 0 && !nodes[i].tombstone){
+            new_hmap->size++;
+            new_hmap->bytes += nodes[i].key.key_len + nodes[i].val.val_len;
+        }
+        if(nodes[i].version > new_hmap->version){
+            new_hmap->version = nodes[i].version;
+        }
+    }
+
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
-    pthread_mutex_init(&new_hmap->write_lock, &attr);
+    sem_init(&new_hmap->write_lock, 0, 1);
     pthread_mutex_init(&new_hmap->fields_lock, &attr);
+    lockstat_register(&new_hmap->write_stat, "map_write");
+    lockstat_register(&new_hmap->fields_stat, "map_fields");
 
     return new_hmap;
 }
 
 bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
-    int index;
+    bool added;
 
+    CREAM_PROBE3(map__put__entry, key.key_base, key.key_len, val.val_len);
     // lock hashmap for editing
-    if(pthread_mutex_lock(&self->write_lock) != 0){
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
         DBGPRINT("put: lock failed\n");
         errno = EINVAL;
         return false;
@@ -45,10 +99,50 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
     if(!nullcheck_map(self) || key.key_base == NULL || val.val_base == NULL){
         DBGPRINT("put: invalid key or hashmap\n");
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+        return false;
+    }
+
+    added = put_locked(self, key, val, force);
+
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
+    CREAM_PROBE2(map__put__return, added, map_probes);
+    return added;
+}
+
+bool put_many(hashmap_t *self, map_key_t *keys, map_val_t *vals, bool *added, int count, bool force) {
+
+    // lock hashmap once for the whole batch
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+        errno = EINVAL;
         return false;
     }
 
+    if(!nullcheck_map(self)){
+        errno = EINVAL;
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+        return false;
+    }
+
+    for(int i = 0; i < count; i++){
+        added[i] = keys[i].key_base != NULL && vals[i].val_base != NULL &&
+            put_locked(self, keys[i], vals[i], force);
+    }
+
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
+    return true;
+}
+
+/*
+ * Inserts a key/value pair. The caller holds the write lock.
+ */
+static bool put_locked(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
+    int index;
+
+    if(self->forget_function != NULL){
+        self->forget_function(key);
+    }
+
     // get hash index and search from index for key
     index = self->hash_function(key) % self->capacity;
 
@@ -57,12 +151,19 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
     bool added = false;
     for(int i = 0; i < self->capacity; i++){
         curindex = index + i;
+        // a key is never stored past a slot that was never used
+        if(self->nodes[curindex%self->capacity].key.key_len == 0){
+            break;
+        }
         // search to see if key exists and replace old val
         if(!self->nodes[curindex%self->capacity].tombstone && keycmp(self->nodes[curindex%self->capacity].key, key)){
             DBGPRINT2("dupe node found at %i\n", curindex%self->capacity);
+            self->bytes -= self->nodes[curindex%self->capacity].key.key_len + self->nodes[curindex%self->capacity].val.val_len;
             self->destroy_function(self->nodes[curindex%self->capacity].key, self->nodes[curindex%self->capacity].val);
             self->size--;
             self->nodes[curindex%self->capacity] = MAP_NODE(key, val, false);
+            self->nodes[curindex%self->capacity].version = ++self->version;
+            map_probes = i + 1;
             added = true;
             break;
         }
@@ -76,6 +177,8 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
             if((size_t)self->nodes[curindex%self->capacity].key.key_len == (size_t)0 || self->nodes[curindex%self->capacity].tombstone){
                 DBGPRINT2("empty node found at index: %i\n", curindex%self->capacity);
                 self->nodes[curindex%self->capacity] = MAP_NODE(key, val, false);
+                self->nodes[curindex%self->capacity].version = ++self->version;
+                map_probes = i + 1;
                 added = true;
                 break;
             }
@@ -88,29 +191,44 @@ bool put(hashmap_t *self, map_key_t key, map_val_t val, bool force) {
         if(force){
             DBGPRINT3("forcing node: deleting %s at %i\n", (char *)self->nodes[index].key.key_base, index);
             // remove index and insert value
-            self->destroy_function(self->nodes[index].key, self->nodes[index].val);
+            self->bytes -= self->nodes[index].key.key_len + self->nodes[index].val.val_len;
+            self->evictions++;
+            CREAM_PROBE3(map__evict, self->nodes[index].key.key_base, self->nodes[index].key.key_len,
+                self->nodes[index].val.val_len);
+            if(self->evict_function != NULL){
+                self->evict_function(self->nodes[index].key, self->nodes[index].val);
+            } else {
+                self->destroy_function(self->nodes[index].key, self->nodes[index].val);
+            }
             self->size--;
             self->nodes[index] = MAP_NODE(key, val, false);
+            self->nodes[index].version = ++self->version;
+            map_probes = 1;
         } else {
             DBGPRINT("put: no memory failed\n");
             errno = ENOMEM;
-            pthread_mutex_unlock(&self->write_lock);
             return false;
         }
     }
 
     self->size++;
+    self->bytes += key.key_len + val.val_len;
 
-    pthread_mutex_unlock(&self->write_lock);
     return true;
 }
 
 map_val_t get(hashmap_t *self, map_key_t key) {
-    int index;
+    uint64_t version;
+
+    return get_versioned(self, key, &version);
+}
+
+map_val_t get_versioned(hashmap_t *self, map_key_t key, uint64_t *version) {
     map_val_t outval = MAP_VAL(NULL, 0);
 
+    CREAM_PROBE2(map__get__entry, key.key_base, key.key_len);
     // lock hashmap for editing
-    if(pthread_mutex_lock(&self->fields_lock) != 0){
+    if(lockstat_mutex_lock(&self->fields_lock, &self->fields_stat) != 0){
         errno = EINVAL;
         return outval;
     }
@@ -118,60 +236,237 @@ map_val_t get(hashmap_t *self, map_key_t key) {
     // null check args
     if(!nullcheck_map(self) || key.key_base == NULL){
         errno = EINVAL;
-        pthread_mutex_unlock(&self->fields_lock);
+        lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
         return outval;
     }
 
     self->num_readers++;
     if(self->num_readers == 1){
-        if(pthread_mutex_lock(&self->write_lock) != 0){
-            pthread_mutex_unlock(&self->fields_lock);
+        if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+            self->num_readers--;
+            lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
             errno = EINVAL;
             return outval;
         }
     }
-    pthread_mutex_unlock(&self->fields_lock);
+    lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+
+    outval = get_locked(self, key, version);
+
+     // unlock hashmap for editing
+    lockstat_mutex_lock(&self->fields_lock, &self->fields_stat);
+
+    self->num_readers--;
+    if(self->num_readers == 0){
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+    }
+    lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+
+    CREAM_PROBE2(map__get__return, outval.val_base != NULL ? (int64_t)outval.val_len : -1, map_probes);
+    return outval;
+}
+
+bool get_many(hashmap_t *self, map_key_t *keys, map_val_t *vals, int count) {
+    uint64_t version;
+
+    // register as a reader once for the whole batch
+    if(lockstat_mutex_lock(&self->fields_lock, &self->fields_stat) != 0){
+        errno = EINVAL;
+        return false;
+    }
+
+    if(!nullcheck_map(self)){
+        errno = EINVAL;
+        lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+        return false;
+    }
+
+    self->num_readers++;
+    if(self->num_readers == 1){
+        if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+            self->num_readers--;
+            lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+            errno = EINVAL;
+            return false;
+        }
+    }
+    lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+
+    for(int i = 0; i < count; i++){
+        vals[i] = keys[i].key_base != NULL ? get_locked(self, keys[i], &version) : MAP_VAL(NULL, 0);
+    }
+
+    // unlock hashmap for editing
+    lockstat_mutex_lock(&self->fields_lock, &self->fields_stat);
+
+    self->num_readers--;
+    if(self->num_readers == 0){
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+    }
+    lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+
+    return true;
+}
+
+/*
+ * Looks up a key and copies its value. The caller is registered as a reader.
+ */
+static map_val_t get_locked(hashmap_t *self, map_key_t key, uint64_t *version) {
+    int index;
+    map_val_t outval = MAP_VAL(NULL, 0);
+
+    *version = 0;
 
     // get hash index and search from index for key
     index = self->hash_function(key) % self->capacity;
-    int curindex;
-    for(int i = 0; i < self->capacity; i++){
+    int curindex, i;
+    for(i = 0; i < self->capacity; i++){
         curindex = index + i;
         if(self->nodes[curindex % self->capacity].key.key_len == 0){
             break;
         }
-        if(keycmp(self->nodes[curindex % self->capacity].key, key) && !self->nodes[curindex % self->capacity].tombstone){
+        if(!self->nodes[curindex % self->capacity].tombstone && keycmp(self->nodes[curindex % self->capacity].key, key)){
             outval = self->nodes[curindex % self->capacity].val;
+            *version = self->nodes[curindex % self->capacity].version;
             break;
         }
     }
-
+    map_probes = i + 1;
 
     // copy value over to protect from future overwrites
     if(outval.val_len > 0){
-        void *safespace = calloc(outval.val_len, sizeof(char));
+        void *safespace = malloc(outval.val_len);
+        if(safespace == NULL){
+            return MAP_VAL(NULL, 0);
+        }
         memcpy(safespace, outval.val_base, outval.val_len);
         outval.val_base = safespace;
     }
 
-     // unlock hashmap for editing
-    pthread_mutex_lock(&self->fields_lock);
+    return outval;
+}
 
-    self->num_readers--;
-    if(self->num_readers == 0){
-        pthread_mutex_unlock(&self->write_lock);
+bool update(hashmap_t *self, map_key_t key, updater_f updater, void *arg) {
+    map_node_t *node;
+    bool updated = false;
+
+    // lock hashmap for editing
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+        errno = EINVAL;
+        return false;
     }
-    pthread_mutex_unlock(&self->fields_lock);
 
-    return outval;
+    if(!nullcheck_map(self) || key.key_base == NULL || updater == NULL){
+        errno = EINVAL;
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+        return false;
+    }
+
+    // the value is read and replaced without releasing the lock
+    if((node = find_locked(self, key)) == NULL){
+        errno = ENOENT;
+    } else {
+        size_t old_len = node->val.val_len;
+        if((updated = updater(node->key, &node->val, arg))){
+            node->version = ++self->version;
+            self->bytes += node->val.val_len - old_len;
+        }
+    }
+
+    // unlock and return
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
+    return updated;
+}
+
+bool cas(hashmap_t *self, map_key_t key, map_val_t val, uint64_t *version) {
+    map_node_t *node;
+    bool swapped = false;
+
+    // lock hashmap for editing
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+        errno = EINVAL;
+        return false;
+    }
+
+    if(!nullcheck_map(self) || key.key_base == NULL || val.val_base == NULL){
+        errno = EINVAL;
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+        return false;
+    }
+
+    // the key is still there, so put_locked overwrites it in place
+    if((node = find_locked(self, key)) == NULL){
+        errno = ENOENT;
+    } else if(node->version != *version){
+        errno = ESTALE;
+        *version = node->version;
+    } else if((swapped = put_locked(self, key, val, false))){
+        *version = self->version;
+    }
+
+    // unlock and return
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
+    return swapped;
+}
+
+bool put_absent(hashmap_t *self, map_key_t key, map_val_t val, bool force, check_f check, void *arg) {
+    bool added = false;
+
+    // lock hashmap for editing
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+        errno = EINVAL;
+        return false;
+    }
+
+    if(!nullcheck_map(self) || key.key_base == NULL || val.val_base == NULL || check == NULL){
+        errno = EINVAL;
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+        return false;
+    }
+
+    // the check and the insert see the same map
+    if(find_locked(self, key) != NULL){
+        errno = EEXIST;
+    } else if(!check(key, arg)){
+        errno = ESTALE;
+    } else {
+        added = put_locked(self, key, val, force);
+    }
+
+    // unlock and return
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
+    return added;
+}
+
+/*
+ * Returns the live node holding a key, or NULL. The caller holds the write
+ * lock.
+ */
+static map_node_t *find_locked(hashmap_t *self, map_key_t key) {
+    int index, curindex;
+
+    // get hash index and search from index for key
+    index = self->hash_function(key) % self->capacity;
+    for(int i = 0; i < self->capacity; i++){
+        curindex = (index + i) % self->capacity;
+        map_probes = i + 1;
+        if(self->nodes[curindex].key.key_len == 0){
+            break;
+        }
+        if(!self->nodes[curindex].tombstone && keycmp(self->nodes[curindex].key, key)){
+            return &self->nodes[curindex];
+        }
+    }
+
+    return NULL;
 }
 
 map_node_t delete(hashmap_t *self, map_key_t key) {
-    int index;
     map_node_t outval = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
 
+    CREAM_PROBE2(map__delete__entry, key.key_base, key.key_len);
     // lock hashmap for editing
-    if(pthread_mutex_lock(&self->write_lock) != 0){
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
         errno = EINVAL;
         return outval;
     }
@@ -179,10 +474,55 @@ map_node_t delete(hashmap_t *self, map_key_t key) {
     // null check hashmap
     if(!nullcheck_map(self) || key.key_base == NULL){
         errno = EINVAL;
-        pthread_mutex_unlock(&self->write_lock);
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
         return outval;
     }
 
+    outval = delete_locked(self, key);
+
+    // unlock and return
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
+    CREAM_PROBE1(map__delete__return, outval.key.key_base != NULL);
+    return outval;
+}
+
+bool delete_many(hashmap_t *self, map_key_t *keys, int count) {
+
+    // lock hashmap once for the whole batch
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+        errno = EINVAL;
+        return false;
+    }
+
+    if(!nullcheck_map(self)){
+        errno = EINVAL;
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+        return false;
+    }
+
+    for(int i = 0; i < count; i++){
+        if(keys[i].key_base != NULL){
+            delete_locked(self, keys[i]);
+        }
+    }
+
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
+    return true;
+}
+
+/*
+ * Tombstones the node holding a key and destroys its key and value; the slot
+ * keeps its key length so probes go on past it. The caller holds the write
+ * lock.
+ */
+static map_node_t delete_locked(hashmap_t *self, map_key_t key) {
+    int index;
+    map_node_t outval = MAP_NODE(MAP_KEY(NULL, 0), MAP_VAL(NULL, 0), false);
+
+    if(self->forget_function != NULL){
+        self->forget_function(key);
+    }
+
     // look for key
     int curindex;
     index = self->hash_function(key) % self->capacity;
@@ -191,23 +531,25 @@ map_node_t delete(hashmap_t *self, map_key_t key) {
         if(self->nodes[curindex % self->capacity].key.key_len == 0){
             break;
         }
-        if(keycmp(self->nodes[curindex % self->capacity].key, key) && !self->nodes[curindex % self->capacity].tombstone){
+        if(!self->nodes[curindex % self->capacity].tombstone && keycmp(self->nodes[curindex % self->capacity].key, key)){
             self->nodes[curindex % self->capacity].tombstone = true;
             self->size--;
+            self->bytes -= self->nodes[curindex % self->capacity].key.key_len + self->nodes[curindex % self->capacity].val.val_len;
             outval = MAP_NODE(self->nodes[curindex % self->capacity].key, self->nodes[curindex % self->capacity].val, true);
+            self->destroy_function(outval.key, outval.val);
+            self->nodes[curindex % self->capacity].key.key_base = NULL;
+            self->nodes[curindex % self->capacity].val = MAP_VAL(NULL, 0);
             break;
         }
     }
 
-    // unlock and return
-    pthread_mutex_unlock(&self->write_lock);
     return outval;
 }
 
 bool clear_map(hashmap_t *self) {
 
     // lock hashmap for editing
-    if(pthread_mutex_lock(&self->write_lock) != 0){
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
         errno = EINVAL;
         return false;
     }
@@ -215,14 +557,21 @@ bool clear_map(hashmap_t *self) {
     // null check map
     if(!nullcheck_map(self)){
         errno = EINVAL;
-        pthread_mutex_lock(&self->write_lock);
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
         return false;
     }
 
-    // call destroy on all nodes
+    if(self->forget_function != NULL){
+        self->forget_function(MAP_KEY(NULL, 0));
+    }
+
+    // call destroy on all live nodes; tombstones were destroyed on delete
     for(int i = 0; i < self->capacity; i++){
         if(self->nodes[i].key.key_len != 0) {
-            self->destroy_function(self->nodes[i].key, self->nodes[i].val);
+            if(!self->nodes[i].tombstone){
+                self->destroy_function(self->nodes[i].key, self->nodes[i].val);
+            }
+            self->nodes[i].tombstone = false;
             self->nodes[i].key.key_len = 0;
             self->nodes[i].key.key_base = 0;
             self->nodes[i].val.val_len = 0;
@@ -231,39 +580,107 @@ bool clear_map(hashmap_t *self) {
     }
 
     self->size = 0;
+    self->bytes = 0;
 
     // unlock and return
-    pthread_mutex_unlock(&self->write_lock);
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
 	return true;
 }
 
+bool iterate_map(hashmap_t *self, iterator_f iterator, void *arg) {
+
+    // register as a reader so the walk sees a stable table
+    if(lockstat_mutex_lock(&self->fields_lock, &self->fields_stat) != 0){
+        errno = EINVAL;
+        return false;
+    }
+
+    if(!nullcheck_map(self) || iterator == NULL){
+        errno = EINVAL;
+        lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+        return false;
+    }
+
+    self->num_readers++;
+    if(self->num_readers == 1){
+        if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+            self->num_readers--;
+            lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+            errno = EINVAL;
+            return false;
+        }
+    }
+    lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+
+    // call iterator on all live nodes
+    for(int i = 0; i < self->capacity; i++){
+        if(self->nodes[i].key.key_len != 0 && !self->nodes[i].tombstone) {
+            iterator(self->nodes[i].key, self->nodes[i].val, arg);
+        }
+    }
+
+    // unlock and return
+    lockstat_mutex_lock(&self->fields_lock, &self->fields_stat);
+    self->num_readers--;
+    if(self->num_readers == 0){
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+    }
+    lockstat_mutex_unlock(&self->fields_lock, &self->fields_stat);
+    return true;
+}
+
+bool detach_map(hashmap_t *self) {
+
+    // lock hashmap so no operation is still touching the nodes
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
+        errno = EINVAL;
+        return false;
+    }
+
+    if(!nullcheck_map(self)){
+        errno = EINVAL;
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
+        return false;
+    }
+
+    // later operations fail the null check and leave the nodes alone
+    self->invalid = true;
+
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
+    return true;
+}
+
 bool invalidate_map(hashmap_t *self) {
 
     // lock hashmap for editing
-    if(pthread_mutex_lock(&self->write_lock) != 0){
+    if(lockstat_sem_wait(&self->write_lock, &self->write_stat) != 0){
         errno = EINVAL;
         return false;
     }
 
     if(!nullcheck_map(self)){
         errno = EINVAL;
-        pthread_mutex_lock(&self->write_lock);
+        lockstat_sem_post(&self->write_lock, &self->write_stat);
         return false;
     }
 
-    // call destroy on all nodes
+    // call destroy on all live nodes; tombstones were destroyed on delete
     for(int i = 0; i < self->capacity; i++){
-        if(self->nodes[i].key.key_len != 0) {
+        if(self->nodes[i].key.key_len != 0 && !self->nodes[i].tombstone) {
             self->destroy_function(self->nodes[i].key, self->nodes[i].val);
         }
     }
 
     // free the calloc'd space and set invalid
-    free(self->nodes);
+    if(!self->shared_nodes){
+        free(self->nodes);
+    }
     self->invalid = true;
+    lockstat_unregister(&self->write_stat);
+    lockstat_unregister(&self->fields_stat);
 
     // unlock and return
-    pthread_mutex_unlock(&self->write_lock);
+    lockstat_sem_post(&self->write_lock, &self->write_stat);
 
     return false;
 }
@@ -0,0 +1,467 @@
+#include "journal.h"
+#include "cream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct replay_arg_t {
+    char *base;
+    size_t start, end;
+    int id, num_threads;
+    journal_apply_f apply;
+} replay_arg_t;
+
+typedef struct snapshot_t {
+    char *buf;
+    size_t len, cap;
+    bool ok;
+} snapshot_t;
+
+static uint32_t record_checksum(uint8_t op, map_key_t key, map_val_t val){
+    map_key_t valbytes = MAP_KEY(val.val_base, val.val_len);
+    uint32_t hash = jenkins_one_at_a_time_hash(key);
+
+    hash = hash * 31 + jenkins_one_at_a_time_hash(valbytes);
+    return hash ^ (op | (uint32_t)key.key_len << 8) ^ (uint32_t)val.val_len;
+}
+
+static size_t record_size(journal_record_t *hdr){
+    return sizeof(journal_record_t) + hdr->key_size + hdr->value_size;
+}
+
+// encodes a record at dst, which must have room for it
+static size_t encode_record(char *dst, uint8_t op, map_key_t key, map_val_t val){
+    journal_record_t hdr;
+
+    hdr.op = op;
+    hdr.key_size = key.key_len;
+    hdr.value_size = val.val_len;
+    hdr.checksum = record_checksum(op, key, val);
+
+    memcpy(dst, &hdr, sizeof(journal_record_t));
+    memcpy(dst + sizeof(journal_record_t), key.key_base, key.key_len);
+    memcpy(dst + sizeof(journal_record_t) + key.key_len, val.val_base, val.val_len);
+    return record_size(&hdr);
+}
+
+static bool writeall(int fd, const char *buf, size_t len){
+    ssize_t n;
+
+    while(len > 0){
+        if((n = write(fd, buf, len)) < 0){
+            if(errno == EINTR){ continue; }
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool growbuf(char **buf, size_t *cap, size_t need){
+    size_t newcap = *cap;
+    char *newbuf;
+
+    if(need <= *cap){
+        return true;
+    }
+    while(newcap < need){
+        newcap *= 2;
+    }
+    if((newbuf = realloc(*buf, newcap)) == NULL){
+        return false;
+    }
+    *buf = newbuf;
+    *cap = newcap;
+    return true;
+}
+
+// runs with the map locked, so it only encodes; the file is written after
+static void snapshot_entry(map_key_t key, map_val_t val, void *arg){
+    snapshot_t *snap = arg;
+    size_t len = sizeof(journal_record_t) + key.key_len + val.val_len;
+
+    if(!snap->ok || !(snap->ok = growbuf(&snap->buf, &snap->cap, snap->len + len))){
+        return;
+    }
+    snap->len += encode_record(snap->buf + snap->len, PUT, key, val);
+}
+
+static void sync_parent_dir(const char *path){
+    char *copy;
+    int dirfd;
+
+    if((copy = strdup(path)) == NULL){
+        return;
+    }
+    if((dirfd = open(dirname(copy), O_RDONLY | O_DIRECTORY)) >= 0){
+        fsync(dirfd);
+        close(dirfd);
+    }
+    free(copy);
+}
+
+/*
+ * Rewrites the journal as a snapshot of the map. Called by the flusher with
+ * the journal locked, so every record buffered so far has been applied to
+ * the map. The lock is dropped while the map is walked under its read lock,
+ * and records appended meanwhile stay buffered for the new file: each sets
+ * a key outright, so replaying one the snapshot already holds is harmless.
+ * The walk only copies the entries into memory; the snapshot is written
+ * once the map is unlocked again.
+ */
+static bool compact_journal(journal_t *self){
+    journal_mark_t mark = journal_mark(self);
+    snapshot_t snap;
+    char *snappath;
+    int fd;
+
+    if((snappath = malloc(strlen(self->path) + sizeof(JOURNAL_SNAPSUFFIX))) == NULL){
+        return false;
+    }
+    sprintf(snappath, "%s%s", self->path, JOURNAL_SNAPSUFFIX);
+
+    bzero(&snap, sizeof(snapshot_t));
+    snap.ok = true;
+    snap.cap = JOURNAL_BUFSIZE;
+    if((snap.buf = malloc(snap.cap)) == NULL){
+        free(snappath);
+        return false;
+    }
+    if((fd = open(snappath, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0){
+        perror("journal snapshot");
+        free(snap.buf);
+        free(snappath);
+        return false;
+    }
+
+    // dump every live entry as a PUT record
+    pthread_mutex_unlock(&self->lock);
+    if(!iterate_map(self->map, snapshot_entry, &snap)){
+        snap.ok = false;
+    }
+    snap.ok = snap.ok && writeall(fd, snap.buf, snap.len) && fdatasync(fd) == 0;
+    pthread_mutex_lock(&self->lock);
+
+    if(!snap.ok || rename(snappath, self->path) != 0){
+        perror("journal snapshot");
+        close(fd);
+        unlink(snappath);
+        free(snap.buf);
+        free(snappath);
+        return false;
+    }
+    sync_parent_dir(self->path);
+
+    // the snapshot file is now the journal
+    close(self->fd);
+    self->fd = fd;
+    self->file_size = snap.len;
+    self->compact_size = snap.len * 2 > JOURNAL_MIN_COMPACT ? snap.len * 2 : JOURNAL_MIN_COMPACT;
+
+    // records buffered before the walk are in the snapshot
+    memmove(self->buf, self->buf + mark.buf_len, self->buf_len - mark.buf_len);
+    self->buf_len -= mark.buf_len;
+    self->synced = mark.appended;
+    pthread_cond_broadcast(&self->sync_cond);
+
+    free(snap.buf);
+    free(snappath);
+    return true;
+}
+
+static void *journal_flusher(void *arg){
+    journal_t *self = arg;
+    char *tmpbuf;
+    size_t tmpcap, len;
+    uint64_t lsn;
+    bool ok;
+
+    pthread_mutex_lock(&self->lock);
+    for(;;){
+        // wait for records to flush
+        while(self->buf_len == 0 && !self->invalid){
+            pthread_cond_wait(&self->flush_cond, &self->lock);
+        }
+        if(self->buf_len == 0){
+            break;
+        }
+
+        // give concurrent requests a chance to join this commit
+        if(self->sync_interval > 0 && !self->invalid){
+            pthread_mutex_unlock(&self->lock);
+            usleep(self->sync_interval * 1000);
+            pthread_mutex_lock(&self->lock);
+        }
+
+        // swap buffers so appends continue during the write
+        tmpbuf = self->flushbuf;
+        tmpcap = self->flushbuf_cap;
+        self->flushbuf = self->buf;
+        self->flushbuf_cap = self->buf_cap;
+        self->buf = tmpbuf;
+        self->buf_cap = tmpcap;
+        len = self->buf_len;
+        lsn = self->appended;
+        self->buf_len = 0;
+        pthread_mutex_unlock(&self->lock);
+
+        ok = writeall(self->fd, self->flushbuf, len) && fdatasync(self->fd) == 0;
+
+        // publish the commit and wake the requests in it
+        pthread_mutex_lock(&self->lock);
+        if(!ok){
+            perror("journal");
+            self->failed = true;
+        } else {
+            self->synced = lsn;
+            self->file_size += len;
+        }
+        pthread_cond_broadcast(&self->sync_cond);
+
+        if(ok && self->file_size >= self->compact_size){
+            compact_journal(self);
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+journal_t *create_journal(const char *path, int sync_interval, hashmap_t *map) {
+    journal_t *new_jnl;
+    struct stat st;
+
+    if(path == NULL || map == NULL || sync_interval < 0){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_jnl = calloc(1, sizeof(journal_t))) == NULL){
+        return NULL;
+    }
+
+    if((new_jnl->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0 || fstat(new_jnl->fd, &st) < 0){
+        free(new_jnl);
+        return NULL;
+    }
+
+    new_jnl->path = strdup(path);
+    new_jnl->buf_cap = JOURNAL_BUFSIZE;
+    new_jnl->flushbuf_cap = JOURNAL_BUFSIZE;
+    new_jnl->buf = malloc(new_jnl->buf_cap);
+    new_jnl->flushbuf = malloc(new_jnl->flushbuf_cap);
+    if(new_jnl->path == NULL || new_jnl->buf == NULL || new_jnl->flushbuf == NULL){
+        close(new_jnl->fd);
+        free(new_jnl->path);
+        free(new_jnl->buf);
+        free(new_jnl->flushbuf);
+        free(new_jnl);
+        return NULL;
+    }
+
+    new_jnl->buf_len = 0;
+    new_jnl->file_size = st.st_size;
+    new_jnl->compact_size = JOURNAL_MIN_COMPACT;
+    new_jnl->appended = 0;
+    new_jnl->synced = 0;
+    new_jnl->sync_interval = sync_interval;
+    new_jnl->map = map;
+    new_jnl->failed = false;
+    new_jnl->invalid = false;
+
+    pthread_mutex_init(&new_jnl->lock, NULL);
+    pthread_cond_init(&new_jnl->flush_cond, NULL);
+    pthread_cond_init(&new_jnl->sync_cond, NULL);
+
+    if(pthread_create(&new_jnl->flusher, NULL, journal_flusher, new_jnl) != 0){
+        close(new_jnl->fd);
+        free(new_jnl->path);
+        free(new_jnl->buf);
+        free(new_jnl->flushbuf);
+        free(new_jnl);
+        return NULL;
+    }
+
+    return new_jnl;
+}
+
+static void *replay_worker(void *arg){
+    replay_arg_t *rarg = arg;
+    journal_record_t hdr;
+    map_key_t key;
+    map_val_t val;
+    size_t off = rarg->start;
+
+    while(off < rarg->end){
+        memcpy(&hdr, rarg->base + off, sizeof(journal_record_t));
+        key = MAP_KEY(rarg->base + off + sizeof(journal_record_t), hdr.key_size);
+        val = MAP_VAL(rarg->base + off + sizeof(journal_record_t) + hdr.key_size, hdr.value_size);
+
+        // each key belongs to exactly one replay thread
+        if(jenkins_one_at_a_time_hash(key) % rarg->num_threads == rarg->id){
+            rarg->apply(hdr.op, key, val);
+        }
+        off += record_size(&hdr);
+    }
+
+    return NULL;
+}
+
+bool replay_journal(journal_t *self, journal_apply_f apply, int num_threads) {
+    journal_record_t hdr;
+    replay_arg_t *args;
+    pthread_t *threads;
+    struct stat st;
+    size_t off, start;
+    char *base;
+
+    if(self == NULL || self->invalid || apply == NULL || num_threads < 1){
+        errno = EINVAL;
+        return false;
+    }
+
+    if(fstat(self->fd, &st) < 0){
+        return false;
+    }
+    if(st.st_size == 0){
+        return true;
+    }
+    if((base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, self->fd, 0)) == MAP_FAILED){
+        return false;
+    }
+
+    // find the end of the valid records and the last CLEAR before it
+    off = 0;
+    start = 0;
+    while(off + sizeof(journal_record_t) <= st.st_size){
+        memcpy(&hdr, base + off, sizeof(journal_record_t));
+        if(off + record_size(&hdr) > st.st_size ||
+            hdr.checksum != record_checksum(hdr.op,
+                MAP_KEY(base + off + sizeof(journal_record_t), hdr.key_size),
+                MAP_VAL(base + off + sizeof(journal_record_t) + hdr.key_size, hdr.value_size))){
+            break;
+        }
+        off += record_size(&hdr);
+        if(hdr.op == CLEAR){
+            start = off;
+        }
+    }
+
+    // drop a torn write left by a crash
+    if(off < st.st_size){
+        fprintf(stderr, "journal: truncating %zu trailing bytes\n", (size_t)st.st_size - off);
+        if(ftruncate(self->fd, off) < 0){
+            munmap(base, st.st_size);
+            return false;
+        }
+    }
+
+    threads = calloc(num_threads, sizeof(pthread_t));
+    args = calloc(num_threads, sizeof(replay_arg_t));
+    if(threads == NULL || args == NULL){
+        free(threads);
+        free(args);
+        munmap(base, st.st_size);
+        return false;
+    }
+
+    for(int i = 0; i < num_threads; i++){
+        args[i] = (replay_arg_t) {.base = base, .start = start, .end = off, .id = i,
+            .num_threads = num_threads, .apply = apply};
+        pthread_create(&threads[i], NULL, replay_worker, &args[i]);
+    }
+    for(int i = 0; i < num_threads; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_lock(&self->lock);
+    self->file_size = off;
+    pthread_mutex_unlock(&self->lock);
+
+    free(threads);
+    free(args);
+    munmap(base, st.st_size);
+    return true;
+}
+
+void journal_lock(journal_t *self) {
+    pthread_mutex_lock(&self->lock);
+}
+
+void journal_unlock(journal_t *self) {
+    pthread_mutex_unlock(&self->lock);
+}
+
+uint64_t journal_append(journal_t *self, uint8_t op, map_key_t key, map_val_t val) {
+    size_t len = sizeof(journal_record_t) + key.key_len + val.val_len;
+
+    if(self->invalid || self->failed){
+        errno = EINVAL;
+        return 0;
+    }
+
+    if(!growbuf(&self->buf, &self->buf_cap, self->buf_len + len)){
+        errno = ENOMEM;
+        return 0;
+    }
+    self->buf_len += encode_record(self->buf + self->buf_len, op, key, val);
+
+    // wake the flusher on the first record of a batch
+    if(self->buf_len == len){
+        pthread_cond_signal(&self->flush_cond);
+    }
+
+    return ++self->appended;
+}
+
+journal_mark_t journal_mark(journal_t *self) {
+    return (journal_mark_t) {.buf_len = self->buf_len, .appended = self->appended};
+}
+
+void journal_rollback(journal_t *self, journal_mark_t mark) {
+    self->buf_len = mark.buf_len;
+    self->appended = mark.appended;
+}
+
+bool journal_wait(journal_t *self, uint64_t lsn) {
+    bool durable;
+
+    pthread_mutex_lock(&self->lock);
+    while(self->synced < lsn && !self->failed){
+        pthread_cond_wait(&self->sync_cond, &self->lock);
+    }
+    durable = self->synced >= lsn;
+    pthread_mutex_unlock(&self->lock);
+
+    return durable;
+}
+
+bool invalidate_journal(journal_t *self) {
+
+    // stop the flusher once it has drained the buffer
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+    self->invalid = true;
+    pthread_cond_signal(&self->flush_cond);
+    pthread_mutex_unlock(&self->lock);
+
+    pthread_join(self->flusher, NULL);
+
+    close(self->fd);
+    free(self->path);
+    free(self->buf);
+    free(self->flushbuf);
+    free(self);
+
+    return true;
+}
@@ -0,0 +1,142 @@
+#include "lanes.h"
+#include <errno.h>
+#include <stdlib.h>
+
+// items still queued when invalidated are not owned by the lanes
+static void forget_item(void *item){
+}
+
+lanes_t *create_lanes(int num_lanes, const int *weights, int limit) {
+    lanes_t *new_lanes;
+
+    if(num_lanes < 1 || num_lanes > LANES_MAX || limit < 0){
+        errno = EINVAL;
+        return NULL;
+    }
+    for(int i = 0; i < num_lanes; i++){
+        if(weights[i] < 1){
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    if((new_lanes = calloc(1, sizeof(lanes_t))) == NULL){
+        return NULL;
+    }
+    new_lanes->num_lanes = num_lanes;
+    for(int i = 0; i < num_lanes; i++){
+        new_lanes->weights[i] = weights[i];
+        if((new_lanes->queues[i] = create_bounded_queue(limit)) == NULL){
+            for(int j = 0; j < i; j++){
+                invalidate_queue(new_lanes->queues[j], forget_item);
+                free(new_lanes->queues[j]);
+            }
+            free(new_lanes);
+            return NULL;
+        }
+    }
+    sem_init(&new_lanes->items, 0, 0);
+
+    return new_lanes;
+}
+
+bool invalidate_lanes(lanes_t *self) {
+    if(self->num_lanes < 1){
+        errno = EINVAL;
+        return false;
+    }
+
+    for(int i = 0; i < self->num_lanes; i++){
+        invalidate_queue(self->queues[i], forget_item);
+        free(self->queues[i]);
+    }
+    sem_destroy(&self->items);
+    self->num_lanes = 0;
+    return true;
+}
+
+bool lanes_push(lanes_t *self, int lane, void *item) {
+    if(lane < 0 || lane >= self->num_lanes){
+        errno = EINVAL;
+        return false;
+    }
+    if(!enqueue(self->queues[lane], item)){
+        return false;
+    }
+    if(self->num_lanes > 1){
+        sem_post(&self->items);
+    }
+    return true;
+}
+
+void *lanes_pop(lanes_t *self, lanes_cursor_t *cursor, int timeout_ms, struct timespec *queued) {
+    struct timespec deadline;
+    void *item;
+    int waited;
+
+    if(self->num_lanes == 1){
+        return dequeue_timed(self->queues[0], timeout_ms, queued);
+    }
+
+    // wait for an item on any lane. sem_timedwait only takes CLOCK_REALTIME
+    if(timeout_ms < 0){
+        waited = sem_wait(&self->items);
+    } else {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        waited = sem_timedwait(&self->items, &deadline);
+    }
+    if(waited != 0){
+        errno = errno == ETIMEDOUT ? ETIMEDOUT : EINVAL;
+        return NULL;
+    }
+
+    // take up to the current lane's weight, then move on, skipping empty lanes
+    for(int tries = 0; tries <= self->num_lanes; tries++){
+        if(cursor->taken < self->weights[cursor->lane] &&
+            (item = dequeue_timed(self->queues[cursor->lane], 0, queued)) != NULL){
+            cursor->taken++;
+            return item;
+        }
+        cursor->lane = (cursor->lane + 1) % self->num_lanes;
+        cursor->taken = 0;
+    }
+    errno = EAGAIN;
+    return NULL;
+}
+
+void *lanes_pop_lane(lanes_t *self, int lane, int timeout_ms, struct timespec *queued) {
+    if(lane < 0 || lane >= self->num_lanes){
+        errno = EINVAL;
+        return NULL;
+    }
+    return dequeue_timed(self->queues[lane], timeout_ms, queued);
+}
+
+bool lanes_oldest(lanes_t *self, struct timespec *queued) {
+    struct timespec head;
+    bool found = false;
+
+    for(int i = 0; i < self->num_lanes; i++){
+        if(queue_oldest(self->queues[i], &head) && (!found || head.tv_sec < queued->tv_sec ||
+            (head.tv_sec == queued->tv_sec && head.tv_nsec < queued->tv_nsec))){
+            *queued = head;
+            found = true;
+        }
+    }
+    return found;
+}
+
+int lanes_length(lanes_t *self) {
+    int length = 0;
+
+    for(int i = 0; i < self->num_lanes; i++){
+        length += self->queues[i]->length;
+    }
+    return length;
+}
@@ -0,0 +1,141 @@
+#include "lease.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ms(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static lease_t *bucket(lease_table_t *self, uint32_t hash){
+    return &self->leases[(hash % (self->num_leases / LEASE_WAYS)) * LEASE_WAYS];
+}
+
+// the live lease on hash, or NULL
+static lease_t *find(lease_table_t *self, uint32_t hash, uint64_t now){
+    lease_t *slots = bucket(self, hash);
+
+    for(int i = 0; i < LEASE_WAYS; i++){
+        if(slots[i].token != 0 && slots[i].hash == hash && slots[i].expires > now){
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+lease_table_t *create_lease_table(uint32_t num_leases, uint32_t ttl_ms) {
+    lease_table_t *new_table;
+
+    if(num_leases < LEASE_WAYS || ttl_ms == 0){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_table = calloc(1, sizeof(lease_table_t))) == NULL){
+        return NULL;
+    }
+
+    new_table->num_leases = num_leases / LEASE_WAYS * LEASE_WAYS;
+    if((new_table->leases = calloc(new_table->num_leases, sizeof(lease_t))) == NULL){
+        free(new_table);
+        return NULL;
+    }
+
+    new_table->ttl_ms = ttl_ms;
+    new_table->next_token = 1;
+    new_table->invalid = false;
+    pthread_mutex_init(&new_table->lock, NULL);
+
+    return new_table;
+}
+
+uint64_t lease_acquire(lease_table_t *self, map_key_t key) {
+    uint32_t hash = jenkins_one_at_a_time_hash(key);
+    uint64_t now = now_ms(), token;
+    lease_t *slots, *slot;
+
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid || find(self, hash, now) != NULL){
+        pthread_mutex_unlock(&self->lock);
+        return 0;
+    }
+
+    // take an empty or expired slot, else the one closest to expiry
+    slots = bucket(self, hash);
+    slot = &slots[0];
+    for(int i = 0; i < LEASE_WAYS; i++){
+        if(slots[i].token == 0 || slots[i].expires <= now){
+            slot = &slots[i];
+            break;
+        }
+        if(slots[i].expires < slot->expires){
+            slot = &slots[i];
+        }
+    }
+
+    token = self->next_token++;
+    *slot = (lease_t) {.token = token, .expires = now + self->ttl_ms, .hash = hash};
+    pthread_mutex_unlock(&self->lock);
+
+    return token;
+}
+
+bool lease_release(lease_table_t *self, map_key_t key, uint64_t token) {
+    lease_t *lease;
+    bool held = false;
+
+    pthread_mutex_lock(&self->lock);
+    if(!self->invalid && token != 0 &&
+        (lease = find(self, jenkins_one_at_a_time_hash(key), now_ms())) != NULL && lease->token == token){
+        lease->token = 0;
+        held = true;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return held;
+}
+
+bool lease_revoke(lease_table_t *self, map_key_t key) {
+    lease_t *lease;
+    bool revoked = false;
+
+    pthread_mutex_lock(&self->lock);
+    if(!self->invalid && (lease = find(self, jenkins_one_at_a_time_hash(key), now_ms())) != NULL){
+        lease->token = 0;
+        revoked = true;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return revoked;
+}
+
+bool clear_leases(lease_table_t *self) {
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+    memset(self->leases, 0, self->num_leases * sizeof(lease_t));
+    pthread_mutex_unlock(&self->lock);
+
+    return true;
+}
+
+bool invalidate_lease_table(lease_table_t *self) {
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+    self->invalid = true;
+    free(self->leases);
+    self->leases = NULL;
+    pthread_mutex_unlock(&self->lock);
+
+    return true;
+}
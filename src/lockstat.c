@@ -0,0 +1,95 @@
+#include "lockstat.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static lockstat_t *registered;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// timestamp units per nanosecond, measured once against the monotonic clock.
+// called with registry_lock held
+static double cycles_per_ns(void){
+    static double rate;
+    struct timespec start, end, pause = {.tv_nsec = 10000000};
+    uint64_t cycles;
+
+    if(rate == 0){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        cycles = lockstat_now();
+        nanosleep(&pause, NULL);
+        cycles = lockstat_now() - cycles;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        rate = cycles / ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec));
+    }
+    return rate;
+}
+
+void lockstat_register(lockstat_t *self, const char *name) {
+    memset(self, 0, sizeof(lockstat_t));
+    self->name = name;
+
+    pthread_mutex_lock(&registry_lock);
+    self->next = registered;
+    registered = self;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void lockstat_unregister(lockstat_t *self) {
+    lockstat_t **link;
+
+    pthread_mutex_lock(&registry_lock);
+    for(link = &registered; *link != NULL; link = &(*link)->next){
+        if(*link == self){
+            *link = self->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+size_t lockstat_print(char *buf, size_t len) {
+    lockstat_t *stat, *first;
+    uint64_t acquired, contended, wait_cycles, hold_cycles;
+    size_t used = 0;
+    double rate;
+    int n;
+
+    if(len == 0){
+        return 0;
+    }
+    buf[0] = '\0';
+
+    pthread_mutex_lock(&registry_lock);
+    for(first = registered; first != NULL && used + 1 < len; first = first->next){
+        // sum every lock of this name, once, at its first entry
+        for(stat = registered; stat != first && strcmp(stat->name, first->name) != 0; stat = stat->next);
+        if(stat != first){
+            continue;
+        }
+        acquired = contended = wait_cycles = hold_cycles = 0;
+        for(; stat != NULL; stat = stat->next){
+            if(strcmp(stat->name, first->name) == 0){
+                acquired += stat->acquired;
+                contended += stat->contended;
+                wait_cycles += stat->wait_cycles;
+                hold_cycles += stat->hold_cycles;
+            }
+        }
+        // locks are only counted in LOCKSTAT builds
+        if(acquired == 0){
+            continue;
+        }
+        rate = cycles_per_ns();
+
+        n = snprintf(buf + used, len - used, "lock_%s_acquired %" PRIu64 "\nlock_%s_contended %" PRIu64 "\n"
+            "lock_%s_wait_ns %.0f\nlock_%s_hold_ns %.0f\n", first->name, acquired, first->name, contended,
+            first->name, wait_cycles / rate, first->name, hold_cycles / rate);
+        if(n > 0){
+            used += (size_t)n < len - used ? (size_t)n : len - used - 1;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    return used;
+}
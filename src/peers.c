@@ -0,0 +1,105 @@
+#include "peers.h"
+#include <errno.h>
+
+static uint32_t peers_hash(const uint8_t *addr) {
+    uint32_t hash = 2166136261u;
+
+    for(int i = 0; i < PEERS_ADDR_LEN; i++){
+        hash = (hash ^ addr[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * The slot holding addr, or the free slot ending its probe sequence.
+ */
+static peers_entry_t *peers_find(peers_t *self, const uint8_t *addr) {
+    peers_entry_t *entry;
+
+    for(uint32_t i = peers_hash(addr);; i++){
+        entry = &self->entries[i & self->mask];
+        if(entry->count == 0 || memcmp(entry->addr, addr, PEERS_ADDR_LEN) == 0){
+            return entry;
+        }
+    }
+}
+
+peers_t *create_peers(uint32_t capacity, uint32_t limit) {
+    peers_t *new_peers;
+
+    if(capacity < 4 || (capacity & (capacity - 1)) != 0 || limit == 0){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_peers = calloc(1, sizeof(peers_t))) == NULL){
+        return NULL;
+    }
+    if((new_peers->entries = calloc(capacity, sizeof(peers_entry_t))) == NULL){
+        free(new_peers);
+        return NULL;
+    }
+    new_peers->mask = capacity - 1;
+    new_peers->limit = limit;
+
+    return new_peers;
+}
+
+bool invalidate_peers(peers_t *self) {
+    if(self == NULL || self->entries == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    free(self->entries);
+    self->entries = NULL;
+    return true;
+}
+
+bool peers_add(peers_t *self, const uint8_t *addr) {
+    peers_entry_t *entry = peers_find(self, addr);
+
+    if(entry->count >= self->limit){
+        errno = EBUSY;
+        return false;
+    }
+    if(entry->count == 0){
+        // keep a quarter free so probe sequences stay short and end
+        if(self->used >= (self->mask + 1) / 4 * 3){
+            errno = ENOSPC;
+            return false;
+        }
+        memcpy(entry->addr, addr, PEERS_ADDR_LEN);
+        self->used++;
+    }
+    entry->count++;
+    return true;
+}
+
+void peers_remove(peers_t *self, const uint8_t *addr) {
+    peers_entry_t *entry = peers_find(self, addr), *next;
+    uint32_t hole, i, home;
+
+    if(entry->count == 0 || --entry->count > 0){
+        return;
+    }
+    self->used--;
+
+    // shift later entries of the probe sequence back into the hole, so no
+    // lookup stops short at it
+    hole = entry - self->entries;
+    for(i = (hole + 1) & self->mask; self->entries[i].count != 0; i = (i + 1) & self->mask){
+        next = &self->entries[i];
+        home = peers_hash(next->addr) & self->mask;
+        // an entry may move back only if the hole lies between its home and it
+        if(((i - home) & self->mask) >= ((i - hole) & self->mask)){
+            self->entries[hole] = *next;
+            next->count = 0;
+            hole = i;
+        }
+    }
+}
+
+uint32_t peers_count(peers_t *self, const uint8_t *addr) {
+    return peers_find(self, addr)->count;
+}
@@ -1,21 +1,33 @@
 #include "queue.h"
+#include "probes.h"
 #include <errno.h>
 
 queue_t *create_queue(void) {
+    return create_bounded_queue(0);
+}
+
+queue_t *create_bounded_queue(int limit) {
     queue_t *new_q;
     pthread_mutexattr_t attr;
 
+    if(limit < 0){
+        errno = EINVAL;
+        return NULL;
+    }
     if((new_q = calloc(1, sizeof(queue_t))) == NULL){
         return NULL;
     }
 
     new_q->front = NULL;
     new_q->rear = NULL;
+    new_q->length = 0;
+    new_q->limit = limit;
     sem_init(&new_q->items, 0, 0);
 
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
     pthread_mutex_init(&new_q->lock, &attr);
+    lockstat_register(&new_q->lock_stat, "queue");
     new_q->invalid = false;
 
     return new_q;
@@ -25,7 +37,7 @@ bool invalidate_queue(queue_t *self, item_destructor_f destroy_function) {
     queue_node_t *nextitem, *previtem;
 
     // lock que for editing
-    if(pthread_mutex_lock(&self->lock) != 0){
+    if(lockstat_mutex_lock(&self->lock, &self->lock_stat) != 0){
         // set errno and exit
         errno = EINVAL;
         return false;
@@ -41,15 +53,16 @@ bool invalidate_queue(queue_t *self, item_destructor_f destroy_function) {
 
         // dec. item count and exit on error
         if(sem_trywait(&self->items) < 0){
-            pthread_mutex_unlock(&self->lock);
-            errno == EINVAL;
+            lockstat_mutex_unlock(&self->lock, &self->lock_stat);
+            errno = EINVAL;
             return false;
         }
     }
 
     // unlock and return
     self->invalid = true;
-    pthread_mutex_unlock(&self->lock);
+    lockstat_unregister(&self->lock_stat);
+    lockstat_mutex_unlock(&self->lock, &self->lock_stat);
     return true;
 }
 
@@ -64,14 +77,20 @@ bool enqueue(queue_t *self, void *item) {
     }
 
     // lock que for editing, and inc. item count
-    if(pthread_mutex_lock(&self->lock) != 0){
+    if(lockstat_mutex_lock(&self->lock, &self->lock_stat) != 0){
         // set errno and exit
         errno = EINVAL;
         return false;
     }
+    // a full bounded queue turns the item away
+    if(self->limit > 0 && self->length >= self->limit){
+        lockstat_mutex_unlock(&self->lock, &self->lock_stat);
+        errno = EAGAIN;
+        return false;
+    }
     if(sem_post(&self->items) != 0){
         // release lock
-        pthread_mutex_unlock(&self->lock);
+        lockstat_mutex_unlock(&self->lock, &self->lock_stat);
         // set errno and exit
         errno = EINVAL;
         return false;
@@ -82,15 +101,18 @@ bool enqueue(queue_t *self, void *item) {
         // dec. item count
         sem_wait(&self->items);
         // release lock and exit
-        pthread_mutex_unlock(&self->lock);
+        lockstat_mutex_unlock(&self->lock, &self->lock_stat);
         return false;
     }
     new_nd->item = item;
     new_nd->next = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &new_nd->queued);
 
     // add node to que
     if(self->front == NULL){
+        // rear may still point at a node that was dequeued and freed
         self->front = new_nd;
+        self->rear = new_nd;
     } else {
         if (self->rear == NULL){
             self->rear = self->front;
@@ -98,15 +120,23 @@ bool enqueue(queue_t *self, void *item) {
         self->rear->next = new_nd;
         self->rear = new_nd;
     }
+    self->length++;
 
     // release lock
-    pthread_mutex_unlock(&self->lock);
+    lockstat_mutex_unlock(&self->lock, &self->lock_stat);
+    CREAM_PROBE1(queue__enqueue, item);
 
     return true;
 }
 
 void *dequeue(queue_t *self) {
+    return dequeue_timed(self, -1, NULL);
+}
+
+void *dequeue_timed(queue_t *self, int timeout_ms, struct timespec *queued) {
     void *item = NULL;
+    struct timespec deadline;
+    int waited;
 
     // check que validity
     if(self->invalid){
@@ -115,14 +145,26 @@ void *dequeue(queue_t *self) {
         return item;
     }
 
-    // wait for pos. item count
-    if(sem_wait(&self->items) != 0){
+    // wait for pos. item count. sem_timedwait only takes CLOCK_REALTIME
+    if(timeout_ms < 0){
+        waited = sem_wait(&self->items);
+    } else {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        waited = sem_timedwait(&self->items, &deadline);
+    }
+    if(waited != 0){
         // set errno and exit
-        errno = EINVAL;
+        errno = errno == ETIMEDOUT ? ETIMEDOUT : EINVAL;
         return item;
     }
     // lock que for editing
-    if(pthread_mutex_lock(&self->lock) != 0){
+    if(lockstat_mutex_lock(&self->lock, &self->lock_stat) != 0){
         // inc. item count
         sem_post(&self->items);
         // set errno and exit
@@ -137,12 +179,32 @@ void *dequeue(queue_t *self) {
         head_nd = self->front;
         // get item at head pointer
         item = self->front->item;
+        if(queued != NULL){
+            *queued = head_nd->queued;
+        }
         // shift head pointer to next item in list and free old head
         self->front = self->front->next;
+        self->length--;
         free(head_nd);
     }
 
     // unlock and return
-    pthread_mutex_unlock(&self->lock);
+    lockstat_mutex_unlock(&self->lock, &self->lock_stat);
+    CREAM_PROBE1(queue__dequeue, item);
     return item;
 }
+
+bool queue_oldest(queue_t *self, struct timespec *queued) {
+    bool found = false;
+
+    if(self->invalid || lockstat_mutex_lock(&self->lock, &self->lock_stat) != 0){
+        errno = EINVAL;
+        return false;
+    }
+    if(self->front != NULL){
+        *queued = self->front->queued;
+        found = true;
+    }
+    lockstat_mutex_unlock(&self->lock, &self->lock_stat);
+    return found;
+}
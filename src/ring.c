@@ -0,0 +1,35 @@
+#include "ring.h"
+#include <errno.h>
+#include <string.h>
+
+ring_t *create_ring(uint32_t capacity) {
+    ring_t *new_ring;
+
+    if(capacity < 2 || (capacity & (capacity - 1)) != 0){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_ring = aligned_alloc(64, sizeof(ring_t))) == NULL){
+        return NULL;
+    }
+    memset(new_ring, 0, sizeof(ring_t));
+    if((new_ring->slots = calloc(capacity, sizeof(void *))) == NULL){
+        free(new_ring);
+        return NULL;
+    }
+    new_ring->mask = capacity - 1;
+
+    return new_ring;
+}
+
+bool invalidate_ring(ring_t *self) {
+    if(self == NULL || self->slots == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    free(self->slots);
+    self->slots = NULL;
+    return true;
+}
@@ -0,0 +1,195 @@
+#include "stats.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+const char *stats_op_names[STATS_OPS] = {
+    "get", "put", "evict", "clear", "mget", "mput", "mdel",
+    "update", "gets", "cas", "lget", "lput", "stats", "other"
+};
+
+// the smallest value that falls in bucket
+static uint64_t bucket_floor(int bucket){
+    int exp;
+
+    if(bucket < STATS_SUB_BUCKETS){
+        return bucket;
+    }
+    exp = bucket / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+    return (uint64_t)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << (exp - STATS_SUB_BITS);
+}
+
+static void merge_hist(stats_hist_t *total, stats_hist_t *hist){
+    total->count += hist->count;
+    if(hist->max > total->max){
+        total->max = hist->max;
+    }
+    for(int i = 0; i < STATS_BUCKETS; i++){
+        total->buckets[i] += hist->buckets[i];
+    }
+}
+
+// appends to buf, stopping quietly once it is full
+static void append(char *buf, size_t len, size_t *used, const char *fmt, ...){
+    va_list ap;
+    int n;
+
+    if(*used + 1 >= len){
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(buf + *used, len - *used, fmt, ap);
+    va_end(ap);
+    if(n > 0){
+        *used += (size_t)n < len - *used ? (size_t)n : len - *used - 1;
+    }
+}
+
+stats_t *create_stats(int num_blocks) {
+    stats_t *new_stats;
+    struct timespec ts;
+
+    if(num_blocks < 1){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_stats = calloc(1, sizeof(stats_t))) == NULL){
+        return NULL;
+    }
+    if((new_stats->blocks = aligned_alloc(STATS_LINE, num_blocks * sizeof(stats_block_t))) == NULL){
+        free(new_stats);
+        return NULL;
+    }
+    memset(new_stats->blocks, 0, num_blocks * sizeof(stats_block_t));
+    new_stats->num_blocks = num_blocks;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    new_stats->started = ts.tv_sec;
+
+    return new_stats;
+}
+
+stats_block_t *stats_block(stats_t *self, int index) {
+    if(index < 0 || index >= self->num_blocks){
+        return NULL;
+    }
+    return &self->blocks[index];
+}
+
+void stats_merge(stats_t *self, stats_block_t *total) {
+    stats_block_t *block;
+
+    memset(total, 0, sizeof(stats_block_t));
+    for(int i = 0; i < self->num_blocks; i++){
+        block = &self->blocks[i];
+        for(int op = 0; op < STATS_OPS; op++){
+            total->ops[op] += block->ops[op];
+            merge_hist(&total->latency[op], &block->latency[op]);
+        }
+        total->hits += block->hits;
+        total->misses += block->misses;
+        total->expired += block->expired;
+        total->conns_opened += block->conns_opened;
+        total->conns_closed += block->conns_closed;
+        total->conns_refused += block->conns_refused;
+        total->conns_idle += block->conns_idle;
+        total->conns_stalled += block->conns_stalled;
+        total->datagrams += block->datagrams;
+        total->datagrams_too_large += block->datagrams_too_large;
+        merge_hist(&total->probes, &block->probes);
+        merge_hist(&total->queue_wait, &block->queue_wait);
+    }
+}
+
+uint64_t stats_percentile(stats_hist_t *hist, double fraction) {
+    uint64_t target, seen = 0, ceiling;
+
+    if(hist->count == 0){
+        return 0;
+    }
+
+    // the rank of the value asked for, counting from 1
+    target = (uint64_t)(fraction * hist->count + 0.5);
+    if(target < 1){
+        target = 1;
+    }
+    for(int i = 0; i < STATS_BUCKETS; i++){
+        seen += hist->buckets[i];
+        if(seen >= target){
+            // report the top of the bucket, but never more than was seen
+            ceiling = i + 1 < STATS_BUCKETS ? bucket_floor(i + 1) - 1 : hist->max;
+            return ceiling < hist->max ? ceiling : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+size_t stats_print(stats_block_t *total, char *buf, size_t len) {
+    static const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *labels[] = {"p50", "p90", "p99", "p999"};
+    size_t used = 0;
+
+    if(len == 0){
+        return 0;
+    }
+    buf[0] = '\0';
+
+    for(int op = 0; op < STATS_OPS; op++){
+        if(total->ops[op] != 0){
+            append(buf, len, &used, "ops_%s %" PRIu64 "\n", stats_op_names[op], total->ops[op]);
+        }
+    }
+    append(buf, len, &used, "hits %" PRIu64 "\nmisses %" PRIu64 "\nexpired %" PRIu64 "\n", total->hits,
+        total->misses, total->expired);
+    append(buf, len, &used, "connections_opened %" PRIu64 "\nconnections_closed %" PRIu64 "\n",
+        total->conns_opened, total->conns_closed);
+    append(buf, len, &used, "connections_refused %" PRIu64 "\nconnections_idle %" PRIu64 "\n"
+        "connections_stalled %" PRIu64 "\n", total->conns_refused, total->conns_idle, total->conns_stalled);
+    append(buf, len, &used, "datagrams %" PRIu64 "\ndatagrams_too_large %" PRIu64 "\n", total->datagrams,
+        total->datagrams_too_large);
+
+    // the probe length distribution, one line per bucket that was hit
+    for(int i = 0; i < STATS_BUCKETS; i++){
+        if(total->probes.buckets[i] != 0){
+            append(buf, len, &used, "probes_%" PRIu64 " %" PRIu64 "\n", bucket_floor(i), total->probes.buckets[i]);
+        }
+    }
+    append(buf, len, &used, "probes_max %" PRIu64 "\n", total->probes.max);
+
+    for(int op = 0; op < STATS_OPS; op++){
+        if(total->latency[op].count == 0){
+            continue;
+        }
+        for(int i = 0; i < sizeof(fractions) / sizeof(fractions[0]); i++){
+            append(buf, len, &used, "latency_%s_%s_ns %" PRIu64 "\n", stats_op_names[op], labels[i],
+                stats_percentile(&total->latency[op], fractions[i]));
+        }
+        append(buf, len, &used, "latency_%s_max_ns %" PRIu64 "\n", stats_op_names[op], total->latency[op].max);
+    }
+
+    if(total->queue_wait.count != 0){
+        for(int i = 0; i < sizeof(fractions) / sizeof(fractions[0]); i++){
+            append(buf, len, &used, "queue_wait_%s_ns %" PRIu64 "\n", labels[i],
+                stats_percentile(&total->queue_wait, fractions[i]));
+        }
+        append(buf, len, &used, "queue_wait_max_ns %" PRIu64 "\n", total->queue_wait.max);
+    }
+
+    return used;
+}
+
+bool invalidate_stats(stats_t *self) {
+    if(self->blocks == NULL){
+        errno = EINVAL;
+        return false;
+    }
+    free(self->blocks);
+    self->blocks = NULL;
+    self->num_blocks = 0;
+
+    return true;
+}
@@ -0,0 +1,285 @@
+#include "tier.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+static tier_stub_t *bucket(tier_t *self, uint32_t hash){
+    return &self->stubs[(hash % (self->num_stubs / TIER_WAYS)) * TIER_WAYS];
+}
+
+// a record is intact until the write head laps it
+static bool intact(tier_t *self, tier_stub_t *stub){
+    return self->head <= stub->offset + self->size;
+}
+
+// the slot still holding a reserved stub, if nothing replaced it
+static tier_stub_t *reserved(tier_t *self, tier_stub_t *stub){
+    tier_stub_t *slots = bucket(self, stub->hash);
+
+    for(int i = 0; i < TIER_WAYS; i++){
+        if(slots[i].length != 0 && slots[i].offset == stub->offset && slots[i].hash == stub->hash){
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+tier_t *create_tier(const char *path, uint64_t size) {
+    tier_t *new_tier;
+
+    if(path == NULL || size < TIER_AVG_RECORD * TIER_WAYS){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_tier = calloc(1, sizeof(tier_t))) == NULL){
+        return NULL;
+    }
+
+    // preallocate the file so spills never extend it
+    if((new_tier->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0){
+        free(new_tier);
+        return NULL;
+    }
+    if((errno = posix_fallocate(new_tier->fd, 0, size)) != 0){
+        close(new_tier->fd);
+        free(new_tier);
+        return NULL;
+    }
+
+    new_tier->num_stubs = (size / TIER_AVG_RECORD) / TIER_WAYS * TIER_WAYS;
+    if((new_tier->stubs = calloc(new_tier->num_stubs, sizeof(tier_stub_t))) == NULL){
+        close(new_tier->fd);
+        free(new_tier);
+        return NULL;
+    }
+
+    new_tier->size = size;
+    new_tier->head = 0;
+    new_tier->invalid = false;
+    pthread_mutex_init(&new_tier->lock, NULL);
+    pthread_mutex_init(&new_tier->io_lock, NULL);
+
+    return new_tier;
+}
+
+bool tier_put(tier_t *self, map_key_t key, map_val_t val) {
+    tier_stub_t stub;
+
+    return tier_reserve(self, key, val.val_len, &stub) && tier_write(self, &stub, key, val);
+}
+
+bool tier_reserve(tier_t *self, map_key_t key, size_t val_len, tier_stub_t *stub) {
+    uint64_t length = sizeof(tier_record_t) + key.key_len + val_len;
+    uint64_t phys;
+    uint32_t hash = jenkins_one_at_a_time_hash(key);
+    tier_stub_t *slots, *slot;
+
+    if(length > self->size){
+        errno = EFBIG;
+        return false;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+
+    // records never straddle the end of the file
+    phys = self->head % self->size;
+    if(phys + length > self->size){
+        self->head += self->size - phys;
+        phys = 0;
+    }
+
+    // replace the key's stub, else an empty or overwritten slot, else the oldest
+    slots = bucket(self, hash);
+    slot = NULL;
+    for(int i = 0; i < TIER_WAYS && slot == NULL; i++){
+        if(slots[i].length != 0 && slots[i].hash == hash){
+            slot = &slots[i];
+        }
+    }
+    for(int i = 0; i < TIER_WAYS && slot == NULL; i++){
+        if(slots[i].length == 0 || !intact(self, &slots[i])){
+            slot = &slots[i];
+        }
+    }
+    if(slot == NULL){
+        slot = &slots[0];
+        for(int i = 1; i < TIER_WAYS; i++){
+            if(slots[i].offset < slot->offset){
+                slot = &slots[i];
+            }
+        }
+    }
+    *slot = (tier_stub_t) {.offset = self->head, .hash = hash, .length = length, .pending = true};
+    *stub = *slot;
+    self->head += length;
+
+    pthread_mutex_unlock(&self->lock);
+    return true;
+}
+
+bool tier_write(tier_t *self, tier_stub_t *stub, map_key_t key, map_val_t val) {
+    tier_record_t hdr = {.key_size = key.key_len, .value_size = val.val_len};
+    struct iovec iov[3];
+    tier_stub_t *slot;
+    bool written;
+
+    // a record reserved after this one and overlapping it has lapped it, so
+    // checking before the write, with writes in turn, keeps it intact
+    pthread_mutex_lock(&self->io_lock);
+    pthread_mutex_lock(&self->lock);
+    written = !self->invalid && intact(self, stub) && reserved(self, stub) != NULL;
+    pthread_mutex_unlock(&self->lock);
+
+    if(written){
+        iov[0] = (struct iovec) {.iov_base = &hdr, .iov_len = sizeof(tier_record_t)};
+        iov[1] = (struct iovec) {.iov_base = key.key_base, .iov_len = key.key_len};
+        iov[2] = (struct iovec) {.iov_base = val.val_base, .iov_len = val.val_len};
+        written = pwritev(self->fd, iov, 3, stub->offset % self->size) == stub->length;
+    }
+
+    // publish the record, unless its stub went away during the write
+    pthread_mutex_lock(&self->lock);
+    if(!self->invalid && (slot = reserved(self, stub)) != NULL){
+        slot->pending = false;
+        if(!written){
+            slot->length = 0;
+        }
+    } else {
+        written = false;
+    }
+    pthread_mutex_unlock(&self->lock);
+    pthread_mutex_unlock(&self->io_lock);
+
+    return written;
+}
+
+map_val_t tier_get(tier_t *self, map_key_t key) {
+    tier_stub_t stub;
+
+    return tier_read(self, key, &stub);
+}
+
+map_val_t tier_read(tier_t *self, map_key_t key, tier_stub_t *found) {
+    map_val_t outval = MAP_VAL(NULL, 0);
+    uint32_t hash = jenkins_one_at_a_time_hash(key);
+    tier_stub_t stub = {.length = 0}, *slots;
+    tier_record_t hdr;
+    struct iovec iov[3];
+    char *keybuf;
+    bool valid;
+
+    // copy the stub out so the read happens unlocked
+    pthread_mutex_lock(&self->lock);
+    slots = bucket(self, hash);
+    for(int i = 0; i < TIER_WAYS && !self->invalid; i++){
+        if(slots[i].length != 0 && !slots[i].pending && slots[i].hash == hash && intact(self, &slots[i])){
+            stub = slots[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    if(stub.length < sizeof(tier_record_t) + key.key_len){
+        return outval;
+    }
+
+    // read the value straight into the buffer handed back to the caller
+    outval.val_len = stub.length - sizeof(tier_record_t) - key.key_len;
+    keybuf = malloc(key.key_len);
+    outval.val_base = malloc(outval.val_len);
+    if(keybuf == NULL || outval.val_base == NULL){
+        free(keybuf);
+        free(outval.val_base);
+        return MAP_VAL(NULL, 0);
+    }
+    iov[0] = (struct iovec) {.iov_base = &hdr, .iov_len = sizeof(tier_record_t)};
+    iov[1] = (struct iovec) {.iov_base = keybuf, .iov_len = key.key_len};
+    iov[2] = (struct iovec) {.iov_base = outval.val_base, .iov_len = outval.val_len};
+    valid = preadv(self->fd, iov, 3, stub.offset % self->size) == stub.length;
+
+    // a spill that lapped the record during the read invalidates it
+    pthread_mutex_lock(&self->lock);
+    valid = valid && intact(self, &stub);
+    pthread_mutex_unlock(&self->lock);
+
+    valid = valid && hdr.key_size == key.key_len && hdr.value_size == outval.val_len &&
+        memcmp(keybuf, key.key_base, key.key_len) == 0;
+    free(keybuf);
+
+    if(!valid){
+        free(outval.val_base);
+        return MAP_VAL(NULL, 0);
+    }
+    *found = stub;
+    return outval;
+}
+
+bool tier_holds(tier_t *self, tier_stub_t *stub) {
+    bool held;
+
+    pthread_mutex_lock(&self->lock);
+    held = !self->invalid && reserved(self, stub) != NULL;
+    pthread_mutex_unlock(&self->lock);
+
+    return held;
+}
+
+bool tier_delete(tier_t *self, map_key_t key) {
+    uint32_t hash = jenkins_one_at_a_time_hash(key);
+    tier_stub_t *slots;
+    bool removed = false;
+
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+    slots = bucket(self, hash);
+    for(int i = 0; i < TIER_WAYS; i++){
+        if(slots[i].length != 0 && slots[i].hash == hash){
+            slots[i].length = 0;
+            removed = true;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return removed;
+}
+
+bool clear_tier(tier_t *self) {
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+    memset(self->stubs, 0, self->num_stubs * sizeof(tier_stub_t));
+    pthread_mutex_unlock(&self->lock);
+
+    return true;
+}
+
+bool invalidate_tier(tier_t *self) {
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+    self->invalid = true;
+    close(self->fd);
+    free(self->stubs);
+    self->stubs = NULL;
+    pthread_mutex_unlock(&self->lock);
+
+    return true;
+}
@@ -0,0 +1,207 @@
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool write_all(int fd, const void *buf, size_t len){
+    ssize_t n;
+
+    while(len > 0){
+        if((n = write(fd, buf, len)) < 0){
+            if(errno == EINTR){ continue; }
+            return false;
+        }
+        buf = (const char *)buf + n;
+        len -= n;
+    }
+    return true;
+}
+
+// copies what ring has published since the last drain into the drain buffer.
+// called with the trace lock held
+static size_t drain_ring(trace_t *self, trace_ring_t *ring){
+    uint64_t head, from, after, valid_from, lost, size = (uint64_t)ring->mask + 1;
+    size_t n, first, skip = 0;
+    struct timespec ts;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    from = ring->tail;
+    if(head - from > size){
+        from = head - size;
+    }
+    n = head - from;
+
+    // one slot past the end keeps room for a LOST record
+    first = size - (from & ring->mask);
+    first = first < n ? first : n;
+    memcpy(self->drainbuf + 1, ring->records + (from & ring->mask), first * sizeof(trace_record_t));
+    memcpy(self->drainbuf + 1 + first, ring->records, (n - first) * sizeof(trace_record_t));
+
+    // the owner may have lapped the copy. it may be filling the slot for
+    // record after, which held record after - size
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    valid_from = after + 1 > size ? after + 1 - size : 0;
+    if(from < valid_from){
+        skip = valid_from - from < n ? valid_from - from : n;
+    }
+
+    lost = from - ring->tail + skip;
+    ring->tail = head;
+    if(lost == 0){
+        memmove(self->drainbuf, self->drainbuf + 1, n * sizeof(trace_record_t));
+        return n;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    self->drainbuf[skip] = (trace_record_t) {.ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec,
+        .seq = lost > UINT32_MAX ? UINT32_MAX : lost, .event = TRACE_LOST, .thread = ring->thread};
+    memmove(self->drainbuf, self->drainbuf + skip, (n - skip + 1) * sizeof(trace_record_t));
+    return n - skip + 1;
+}
+
+// called with the trace lock held
+static bool flush_locked(trace_t *self){
+    size_t n;
+
+    for(int i = 0; i < self->num_rings; i++){
+        if((n = drain_ring(self, &self->rings[i])) > 0 &&
+            !write_all(self->fd, self->drainbuf, n * sizeof(trace_record_t))){
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *trace_streamer(void *arg){
+    trace_t *self = arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&self->lock);
+    while(!self->invalid){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += self->interval / 1000;
+        deadline.tv_nsec += (long)(self->interval % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&self->stop_cond, &self->lock, &deadline);
+        flush_locked(self);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+trace_t *create_trace(const char *path, int num_rings, uint32_t ring_size, int interval) {
+    trace_t *new_trace;
+    trace_file_header_t header = {.magic = TRACE_MAGIC, .version = TRACE_VERSION,
+        .record_size = sizeof(trace_record_t)};
+
+    if(path == NULL || num_rings < 1 || num_rings > UINT16_MAX || ring_size < 2 ||
+        (ring_size & (ring_size - 1)) != 0 || interval < 0){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_trace = calloc(1, sizeof(trace_t))) == NULL){
+        return NULL;
+    }
+    new_trace->num_rings = num_rings;
+    new_trace->interval = interval;
+    new_trace->fd = -1;
+    if((new_trace->rings = aligned_alloc(64, num_rings * sizeof(trace_ring_t))) == NULL){
+        goto fail;
+    }
+    memset(new_trace->rings, 0, num_rings * sizeof(trace_ring_t));
+    for(int i = 0; i < num_rings; i++){
+        new_trace->rings[i].thread = i;
+        new_trace->rings[i].mask = ring_size - 1;
+        if((new_trace->rings[i].records = calloc(ring_size, sizeof(trace_record_t))) == NULL){
+            goto fail;
+        }
+    }
+    if((new_trace->drainbuf = calloc(ring_size + 1, sizeof(trace_record_t))) == NULL){
+        goto fail;
+    }
+
+    if((new_trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+        !write_all(new_trace->fd, &header, sizeof(header))){
+        goto fail;
+    }
+
+    pthread_mutex_init(&new_trace->lock, NULL);
+    pthread_cond_init(&new_trace->stop_cond, NULL);
+    if(interval > 0 && pthread_create(&new_trace->streamer, NULL, trace_streamer, new_trace) != 0){
+        pthread_mutex_destroy(&new_trace->lock);
+        pthread_cond_destroy(&new_trace->stop_cond);
+        goto fail;
+    }
+
+    return new_trace;
+
+    fail:
+    if(new_trace->fd >= 0){
+        close(new_trace->fd);
+    }
+    for(int i = 0; new_trace->rings != NULL && i < num_rings; i++){
+        free(new_trace->rings[i].records);
+    }
+    free(new_trace->rings);
+    free(new_trace->drainbuf);
+    free(new_trace);
+    return NULL;
+}
+
+trace_ring_t *trace_ring(trace_t *self, int index) {
+    if(self == NULL || index < 0 || index >= self->num_rings){
+        return NULL;
+    }
+    return &self->rings[index];
+}
+
+bool trace_flush(trace_t *self) {
+    bool flushed;
+
+    if(self == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    flushed = !self->invalid && flush_locked(self);
+    pthread_mutex_unlock(&self->lock);
+
+    return flushed;
+}
+
+bool invalidate_trace(trace_t *self) {
+    bool flushed;
+
+    pthread_mutex_lock(&self->lock);
+    if(self->invalid){
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return false;
+    }
+    self->invalid = true;
+    pthread_cond_signal(&self->stop_cond);
+    pthread_mutex_unlock(&self->lock);
+
+    if(self->interval > 0){
+        pthread_join(self->streamer, NULL);
+    }
+    flushed = flush_locked(self);
+    close(self->fd);
+
+    for(int i = 0; i < self->num_rings; i++){
+        free(self->rings[i].records);
+    }
+    free(self->rings);
+    free(self->drainbuf);
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->stop_cond);
+
+    return flushed;
+}
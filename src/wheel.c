@@ -0,0 +1,110 @@
+#include "wheel.h"
+#include <errno.h>
+#include <string.h>
+
+static void link_tail(wheel_timer_t *head, wheel_timer_t *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void unlink_timer(wheel_timer_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+wheel_t *create_wheel(uint32_t slots, uint64_t tick, uint64_t now) {
+    wheel_t *new_wheel;
+
+    if(slots < 2 || (slots & (slots - 1)) != 0 || tick == 0){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_wheel = calloc(1, sizeof(wheel_t))) == NULL){
+        return NULL;
+    }
+    if((new_wheel->slots = calloc(slots, sizeof(wheel_timer_t))) == NULL){
+        free(new_wheel);
+        return NULL;
+    }
+    for(uint32_t i = 0; i < slots; i++){
+        new_wheel->slots[i].next = new_wheel->slots[i].prev = &new_wheel->slots[i];
+    }
+    new_wheel->due.next = new_wheel->due.prev = &new_wheel->due;
+    new_wheel->mask = slots - 1;
+    new_wheel->tick = tick;
+    new_wheel->current = now / tick;
+
+    return new_wheel;
+}
+
+bool invalidate_wheel(wheel_t *self) {
+    if(self == NULL || self->slots == NULL){
+        errno = EINVAL;
+        return false;
+    }
+
+    free(self->slots);
+    self->slots = NULL;
+    return true;
+}
+
+void wheel_arm(wheel_t *self, wheel_timer_t *timer, uint64_t expires) {
+    uint64_t tick = expires / self->tick;
+
+    if(wheel_armed(timer)){
+        unlink_timer(timer);
+        self->armed--;
+    }
+    // a tick already advanced past won't be visited again until the wheel
+    // comes around, so a late timer goes in the next one
+    if(tick < self->current){
+        tick = self->current;
+    }
+    timer->expires = expires;
+    link_tail(&self->slots[tick & self->mask], timer);
+    self->armed++;
+}
+
+void wheel_disarm(wheel_t *self, wheel_timer_t *timer) {
+    if(wheel_armed(timer)){
+        unlink_timer(timer);
+        self->armed--;
+    }
+}
+
+wheel_timer_t *wheel_expire(wheel_t *self, uint64_t now) {
+    wheel_timer_t *head, *timer, *next;
+    uint64_t target = now / self->tick, steps;
+
+    // only ticks that have wholly passed are visited, so everything in
+    // their slots from this turn of the wheel is due. after a long gap each
+    // slot is visited once
+    if(self->due.next == &self->due && target > self->current){
+        steps = target - self->current;
+        if(steps > self->mask + 1){
+            steps = self->mask + 1;
+        }
+        for(uint64_t i = 0; i < steps; i++){
+            head = &self->slots[(self->current + i) & self->mask];
+            for(timer = head->next; timer != head; timer = next){
+                next = timer->next;
+                if(timer->expires / self->tick < target){
+                    unlink_timer(timer);
+                    link_tail(&self->due, timer);
+                }
+            }
+        }
+        self->current = target;
+    }
+
+    if((timer = self->due.next) == &self->due){
+        return NULL;
+    }
+    unlink_timer(timer);
+    self->armed--;
+    return timer;
+}
@@ -0,0 +1,105 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "utils.h"
+
+#define ARENA_SIZE (1 << 20)
+
+arena_t *global_arena;
+
+void arena_init(void) {
+    global_arena = create_arena(ARENA_SIZE, ARENA_SHARED);
+}
+
+void arena_fini(void) {
+    invalidate_arena(global_arena);
+}
+
+void arena_free_function(map_key_t key, map_val_t val) {
+    arena_free(global_arena, key.key_base);
+    arena_free(global_arena, val.val_base);
+}
+
+Test(arena_suite, 00_reuse, .timeout = 2, .init = arena_init, .fini = arena_fini) {
+    cr_assert_not_null(global_arena, "Arena returned was NULL");
+
+    char *first = arena_alloc(global_arena, 100);
+    cr_assert_not_null(first, "Allocation failed");
+    arena_free(global_arena, first);
+
+    // a chunk of the same size class comes back from the free list
+    char *second = arena_alloc(global_arena, 120);
+    cr_assert_eq(first, second, "Freed chunk was not reused");
+}
+
+Test(arena_suite, 01_full, .timeout = 2, .init = arena_init, .fini = arena_fini) {
+    cr_assert_null(arena_alloc(global_arena, ARENA_SIZE), "Oversized allocation succeeded");
+    cr_assert_eq(errno, ENOMEM);
+}
+
+Test(arena_suite, 02_attach, .timeout = 2, .init = arena_init, .fini = arena_fini) {
+    char *value = arena_alloc(global_arena, 16);
+    strcpy(value, "cream");
+    global_arena->header->nodes = arena_offset(global_arena, value);
+    detach_arena(global_arena);
+    cr_assert_null(arena_alloc(global_arena, 16), "Detached arena still allocates");
+
+    // a second mapping of the same memfd sees the same data at another address
+    arena_t *attached = attach_arena(dup(global_arena->fd));
+    cr_assert_not_null(attached, "Attach failed");
+    cr_assert_neq(attached->delta, 0, "Second mapping landed at the same address");
+    cr_assert_str_eq(value + attached->delta, "cream");
+    cr_assert_str_eq(arena_ptr(attached, attached->header->nodes), "cream");
+    invalidate_arena(attached);
+}
+
+Test(arena_suite, 03_huge, .timeout = 5) {
+    // rounded up to a whole huge page, whichever kind of page backs it
+    arena_t *huge = create_arena(ARENA_HUGE_PAGE + 1, ARENA_HUGE);
+    cr_assert_not_null(huge, "Huge arena returned was NULL");
+    cr_assert_eq(huge->size, 2 * ARENA_HUGE_PAGE, "Size was not rounded up to a huge page");
+    cr_assert_eq((uintptr_t)huge->base % ARENA_HUGE_PAGE, 0, "Mapping is not aligned to a huge page");
+
+    cr_assert(arena_prefault(huge, 3), "Prefault failed");
+    char *value = arena_alloc(huge, 16);
+    cr_assert_not_null(value, "Allocation failed");
+    strcpy(value, "cream");
+    cr_assert_str_eq(value, "cream");
+    invalidate_arena(huge);
+
+    huge = create_arena(ARENA_SIZE, ARENA_HUGE | ARENA_SHARED);
+    cr_assert_not_null(huge, "Shared huge arena returned was NULL");
+    cr_assert_geq(huge->fd, 0, "Shared huge arena has no memfd");
+    cr_assert(arena_prefault(huge, 64), "Prefault with more threads than pages failed");
+    invalidate_arena(huge);
+}
+
+Test(arena_suite, 04_map_churn, .timeout = 5, .init = arena_init, .fini = arena_fini) {
+    map_node_t *nodes = arena_calloc(global_arena, 64 * sizeof(map_node_t));
+    hashmap_t *map = create_map_over(64, nodes, jenkins_one_at_a_time_hash, arena_free_function);
+    cr_assert_not_null(map, "Map returned was NULL");
+
+    // deleted entries go back to the arena, so churn never runs it dry
+    for(int i = 0; i < 4 * ARENA_SIZE / 1024; i++) {
+        int *key = arena_alloc(global_arena, sizeof(int));
+        char *val = arena_alloc(global_arena, 1024);
+        cr_assert(key != NULL && val != NULL, "Arena ran out after %d puts", i);
+        *key = i;
+        cr_assert(put(map, MAP_KEY(key, sizeof(int)), MAP_VAL(val, 1024), false), "Put %d failed", i);
+        cr_assert_not_null(delete(map, MAP_KEY(&i, sizeof(int))).key.key_base, "Delete %d failed", i);
+    }
+
+    // a clear after the churn only destroys what is still live
+    int *key = arena_alloc(global_arena, sizeof(int));
+    char *val = arena_alloc(global_arena, 1024);
+    *key = -1;
+    put(map, MAP_KEY(key, sizeof(int)), MAP_VAL(val, 1024), false);
+    cr_assert(clear_map(map), "Clear failed");
+    invalidate_map(map);
+}
@@ -0,0 +1,129 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chan.h"
+
+#define CHAN_ITEMS 100000
+
+chan_t *global_chan;
+
+void chan_init(void) {
+    global_chan = create_chan(4096);
+}
+
+void chan_fini(void) {
+    invalidate_chan(global_chan);
+    free(global_chan);
+}
+
+// records of 1 to 1000 bytes, each filled with its own number
+void *chan_producer(void *arg) {
+    chan_t *self = arg;
+    uint32_t len;
+    char *record;
+
+    for(uint32_t i = 0; i < CHAN_ITEMS; i++){
+        len = 1 + (i * 7919) % 1000;
+        while((record = chan_reserve(self, CHAN_REQUESTS, len)) == NULL){
+            chan_wait(self, CHAN_REQUESTS, true, 100);
+        }
+        memset(record, i & 0xff, len);
+        chan_commit(self, CHAN_REQUESTS, len);
+    }
+    return NULL;
+}
+
+Test(chan_suite, 00_creation, .timeout = 2) {
+    errno = 0;
+    cr_assert_null(create_chan(6000), "Size not a power of two accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+    errno = 0;
+    cr_assert_null(create_chan(1024), "Size under a page accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+}
+
+Test(chan_suite, 01_records, .timeout = 2, .init = chan_init, .fini = chan_fini) {
+    char *record;
+    uint32_t len;
+
+    cr_assert_not_null(global_chan, "Channel returned was NULL");
+    errno = 0;
+    cr_assert_null(chan_peek(global_chan, CHAN_REQUESTS, &len), "Empty ring returned a record");
+    cr_assert_eq(errno, EAGAIN, "errno was not EAGAIN");
+    errno = 0;
+    cr_assert_null(chan_reserve(global_chan, CHAN_REQUESTS, 4000), "Record over half the ring reserved");
+    cr_assert_eq(errno, EMSGSIZE, "errno was not EMSGSIZE");
+
+    // a third record of 1512 bytes with its length doesn't fit in 4096 after two
+    for(int i = 0; i < 2; i++){
+        cr_assert_not_null(record = chan_reserve(global_chan, CHAN_REQUESTS, 1500), "Reserve %d failed", i);
+        memset(record, 'a' + i, 1500);
+        chan_commit(global_chan, CHAN_REQUESTS, 1500);
+    }
+    errno = 0;
+    cr_assert_null(chan_reserve(global_chan, CHAN_REQUESTS, 1500), "Full ring took a record");
+    cr_assert_eq(errno, EAGAIN, "errno was not EAGAIN");
+    cr_assert(!chan_wait(global_chan, CHAN_REQUESTS, true, 10), "Room appeared in a full ring");
+
+    // once one is consumed the third wraps past the 1072 bytes left at the end
+    cr_assert_not_null(record = chan_peek(global_chan, CHAN_REQUESTS, &len));
+    cr_assert(len == 1500 && record[0] == 'a' && record[1499] == 'a', "First record garbled");
+    chan_consume(global_chan, CHAN_REQUESTS);
+    cr_assert(chan_wait(global_chan, CHAN_REQUESTS, true, 10), "Consumed room not seen");
+    cr_assert_not_null(record = chan_reserve(global_chan, CHAN_REQUESTS, 1500), "Wrapping reserve failed");
+    cr_assert_eq(record, global_chan->data[CHAN_REQUESTS] + 8, "Record didn't wrap to the start");
+    memset(record, 'c', 1500);
+    chan_commit(global_chan, CHAN_REQUESTS, 1000);
+
+    cr_assert_not_null(record = chan_peek(global_chan, CHAN_REQUESTS, &len));
+    cr_assert(len == 1500 && record[0] == 'b', "Second record garbled");
+    chan_consume(global_chan, CHAN_REQUESTS);
+    cr_assert_not_null(record = chan_peek(global_chan, CHAN_REQUESTS, &len), "Wrapped record lost");
+    cr_assert(len == 1000 && record[0] == 'c', "Wrapped record garbled");
+    chan_consume(global_chan, CHAN_REQUESTS);
+    cr_assert(!chan_wait(global_chan, CHAN_REQUESTS, false, 10), "Drained ring has a record");
+}
+
+Test(chan_suite, 02_attach, .timeout = 2, .init = chan_init, .fini = chan_fini) {
+    chan_t *other;
+    char *record;
+    uint32_t len;
+
+    cr_assert_not_null(other = attach_chan(dup(global_chan->fd)), "Attach failed");
+    cr_assert_not_null(record = chan_reserve(global_chan, CHAN_RESPONSES, 5));
+    memcpy(record, "hello", 5);
+    chan_commit(global_chan, CHAN_RESPONSES, 5);
+    cr_assert_not_null(record = chan_peek(other, CHAN_RESPONSES, &len), "Record not shared");
+    cr_assert(len == 5 && memcmp(record, "hello", 5) == 0, "Shared record garbled");
+    chan_consume(other, CHAN_RESPONSES);
+    invalidate_chan(other);
+    free(other);
+
+    // anything but a channel is refused
+    errno = 0;
+    cr_assert_null(attach_chan(fileno(tmpfile())), "Empty file attached");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+}
+
+Test(chan_suite, 03_threads, .timeout = 20, .init = chan_init, .fini = chan_fini) {
+    pthread_t tid;
+    char *record;
+    uint32_t len;
+
+    pthread_create(&tid, NULL, chan_producer, global_chan);
+    for(uint32_t i = 0; i < CHAN_ITEMS; i++){
+        while((record = chan_peek(global_chan, CHAN_REQUESTS, &len)) == NULL){
+            cr_assert_eq(errno, EAGAIN, "Record %u corrupt", i);
+            chan_wait(global_chan, CHAN_REQUESTS, false, 100);
+        }
+        cr_assert_eq(len, 1 + (i * 7919) % 1000, "Record %u has the wrong length", i);
+        cr_assert(record[0] == (char)(i & 0xff) && record[len - 1] == (char)(i & 0xff), "Record %u garbled", i);
+        chan_consume(global_chan, CHAN_REQUESTS);
+    }
+    pthread_join(tid, NULL);
+}
@@ -0,0 +1,42 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+
+#include "codel.h"
+
+#define MS 1000000ULL
+
+codel_t global_codel;
+
+void codel_setup(void) {
+    codel_init(&global_codel, 5 * MS, 100 * MS);
+}
+
+Test(codel_suite, 00_burst, .timeout = 2, .init = codel_setup) {
+    // a delay over target that clears within an interval drops nothing
+    for(uint64_t now = 0; now < 90 * MS; now += MS){
+        cr_assert(!codel_drop(&global_codel, 20 * MS, now), "Dropped during a burst at %lu", now);
+    }
+    cr_assert(!codel_drop(&global_codel, MS, 90 * MS), "Dropped below target");
+    cr_assert(!codel_drop(&global_codel, 20 * MS, 150 * MS), "Dropped after the burst cleared");
+}
+
+Test(codel_suite, 01_overload, .timeout = 2, .init = codel_setup) {
+    int drops = 0, first = 0;
+
+    // a standing delay drops one item after an interval, then ever faster
+    for(uint64_t now = MS; now <= 1000 * MS; now += MS){
+        if(codel_drop(&global_codel, 20 * MS, now)){
+            if(drops++ == 0){
+                first = now / MS;
+            }
+        }
+    }
+    cr_assert_eq(first, 101, "First drop at %d ms", first);
+    cr_assert(global_codel.dropping, "Not dropping under a standing delay");
+    // 100 / isqrt(n) ms apart: 101, 201, 301, 401, 451, ..., 684, 717, ...
+    cr_assert_eq(drops, 20, "%d drops", drops);
+
+    // once the delay is back under target, dropping stops
+    cr_assert(!codel_drop(&global_codel, MS, 1001 * MS), "Dropped below target");
+    cr_assert(!global_codel.dropping, "Still dropping below target");
+}
@@ -0,0 +1,127 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "conn.h"
+
+int peer_fd;
+conn_t *global_conn;
+
+void conn_init(void) {
+    int fds[2];
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    global_conn = create_conn(fds[0]);
+    peer_fd = fds[1];
+}
+
+void conn_fini(void) {
+    close(peer_fd);
+}
+
+Test(conn_suite, 00_send_and_read, .timeout = 2, .init = conn_init, .fini = conn_fini) {
+    char buf[8];
+    struct iovec iov[2] = {{.iov_base = "abc", .iov_len = 3}, {.iov_base = "defg", .iov_len = 4}};
+
+    cr_assert_not_null(global_conn, "Connection returned was NULL");
+    cr_assert(conn_send(global_conn, iov, 2), "Send failed");
+    cr_assert_eq(read(peer_fd, buf, sizeof(buf)), 7);
+    cr_assert_arr_eq(buf, "abcdefg", 7);
+
+    cr_assert_eq(write(peer_fd, "hi", 2), 2);
+    cr_assert(conn_read(global_conn, buf, 2), "Read failed");
+    cr_assert_arr_eq(buf, "hi", 2);
+
+    // a short read at EOF fails
+    close(peer_fd);
+    cr_assert_not(conn_read(global_conn, buf, 1), "Read past EOF succeeded");
+    conn_release(global_conn);
+}
+
+Test(conn_suite, 01_refcount, .timeout = 2, .init = conn_init, .fini = conn_fini) {
+    int fd = global_conn->fd;
+
+    conn_hold(global_conn);
+    conn_release(global_conn);
+    cr_assert_neq(fcntl(fd, F_GETFD), -1, "Socket closed while still referenced");
+
+    conn_release(global_conn);
+    cr_assert_eq(fcntl(fd, F_GETFD), -1, "Socket still open after the last release");
+    cr_assert_eq(errno, EBADF);
+}
+
+Test(conn_suite, 02_fill_and_consume, .timeout = 2, .init = conn_init, .fini = conn_fini) {
+    char big[CONN_BUFSIZE * 3];
+
+    // an empty socket doesn't block, and partial input is kept
+    cr_assert(conn_fill(global_conn, sizeof(big)), "Fill of an empty socket failed");
+    cr_assert_eq(global_conn->in_len, 0);
+    cr_assert_eq(write(peer_fd, "hel", 3), 3);
+    cr_assert(conn_fill(global_conn, sizeof(big)), "Fill failed");
+    cr_assert_eq(write(peer_fd, "lo", 2), 2);
+    cr_assert(conn_fill(global_conn, sizeof(big)), "Fill failed");
+    cr_assert_eq(global_conn->in_len, 5);
+    cr_assert_arr_eq(global_conn->in, "hello", 5);
+    conn_consume(global_conn, 2);
+    cr_assert_eq(global_conn->in_len, 3);
+    cr_assert_arr_eq(global_conn->in, "llo", 3);
+    conn_consume(global_conn, 3);
+
+    // the buffer grows up to max and leaves the rest in the socket
+    memset(big, 'x', sizeof(big));
+    cr_assert_eq(write(peer_fd, big, sizeof(big)), sizeof(big));
+    cr_assert(conn_fill(global_conn, CONN_BUFSIZE * 2), "Fill failed");
+    cr_assert_eq(global_conn->in_len, CONN_BUFSIZE * 2);
+    conn_consume(global_conn, CONN_BUFSIZE * 2);
+    cr_assert(conn_fill(global_conn, CONN_BUFSIZE * 2), "Fill failed");
+    cr_assert_eq(global_conn->in_len, CONN_BUFSIZE);
+
+    close(peer_fd);
+    cr_assert_not(conn_fill(global_conn, sizeof(big)), "Fill at EOF succeeded");
+    conn_release(global_conn);
+}
+
+Test(conn_suite, 03_queue_and_flush, .timeout = 2, .init = conn_init, .fini = conn_fini) {
+    struct iovec iov[2] = {{.iov_base = "abc", .iov_len = 3}, {.iov_base = "defg", .iov_len = 4}};
+    char buf[CONN_BUFSIZE];
+    size_t sent = 0, got = 0;
+    ssize_t n;
+    int i;
+
+    global_conn->io_ms = 1000;
+    cr_assert(conn_queue(global_conn, iov, 2), "Queue failed");
+    cr_assert(conn_flush(global_conn), "Flush failed");
+    cr_assert_eq(global_conn->out_len, 0);
+    cr_assert_eq(global_conn->write_deadline, 0);
+    cr_assert_eq(read(peer_fd, buf, sizeof(buf)), 7);
+    cr_assert_arr_eq(buf, "abcdefg", 7);
+
+    // a peer that stops reading leaves the rest queued, under the deadline
+    iov[0].iov_base = buf;
+    iov[0].iov_len = sizeof(buf);
+    memset(buf, 'y', sizeof(buf));
+    for(i = 0; i < 1024; i++){
+        cr_assert(conn_queue(global_conn, iov, 1), "Queue failed");
+        sent += sizeof(buf);
+    }
+    cr_assert(conn_flush(global_conn), "Flush failed");
+    cr_assert_gt(global_conn->out_len, 0);
+    cr_assert_neq(global_conn->write_deadline, 0);
+
+    while(global_conn->out_len > 0){
+        cr_assert_gt(n = read(peer_fd, buf, sizeof(buf)), 0);
+        got += n;
+        cr_assert(conn_flush(global_conn), "Flush failed");
+    }
+    while(got < sent && (n = read(peer_fd, buf, sizeof(buf))) > 0){
+        got += n;
+    }
+    cr_assert_eq(got, sent);
+    cr_assert_eq(global_conn->write_deadline, 0);
+    conn_release(global_conn);
+}
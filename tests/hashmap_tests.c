@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "hashmap.h"
 #define NUM_THREADS 100
@@ -85,4 +86,82 @@ Test(map_suite, 02_multithreaded, .timeout = 2, .init = map_init, .fini = map_fi
     int num_items = global_map->size;
     cr_assert_eq(num_items, NUM_THREADS, "Had %d items in map. Expected %d", num_items, NUM_THREADS);
 }
-*/
\ No newline at end of file
+*/
+bool append_updater(map_key_t key, map_val_t *val, void *arg) {
+    char *joined = malloc(val->val_len + 1);
+
+    memcpy(joined, val->val_base, val->val_len);
+    joined[val->val_len] = *(char *)arg;
+    free(val->val_base);
+    *val = MAP_VAL(joined, val->val_len + 1);
+    return true;
+}
+
+Test(map_suite, 03_update, .timeout = 2, .init = map_init, .fini = map_fini) {
+    char *key = strdup("key"), *val = strdup("ab");
+
+    put(global_map, MAP_KEY(key, 3), MAP_VAL(val, 2), false);
+    cr_assert(update(global_map, MAP_KEY("key", 3), append_updater, "c"), "Update failed");
+
+    map_val_t got = get(global_map, MAP_KEY("key", 3));
+    cr_assert_eq(got.val_len, 3, "Value had length %zu. Expected 3", got.val_len);
+    cr_assert_arr_eq(got.val_base, "abc", 3);
+    free(got.val_base);
+
+    cr_assert_not(update(global_map, MAP_KEY("kez", 3), append_updater, "c"), "Missing key was updated");
+    cr_assert_eq(errno, ENOENT);
+}
+
+Test(map_suite, 04_cas, .timeout = 2, .init = map_init, .fini = map_fini) {
+    uint64_t version, stale;
+
+    put(global_map, MAP_KEY(strdup("key"), 3), MAP_VAL(strdup("one"), 3), false);
+    map_val_t got = get_versioned(global_map, MAP_KEY("key", 3), &version);
+    cr_assert_neq(version, 0, "Entry had no version");
+    free(got.val_base);
+
+    stale = version;
+    cr_assert(cas(global_map, MAP_KEY(strdup("key"), 3), MAP_VAL(strdup("two"), 3), &version), "CAS failed");
+    cr_assert_gt(version, stale, "Version did not grow");
+
+    // the old version no longer matches
+    char *key = strdup("key"), *val = strdup("three");
+    cr_assert_not(cas(global_map, MAP_KEY(key, 3), MAP_VAL(val, 5), &stale), "Stale CAS succeeded");
+    cr_assert_eq(errno, ESTALE);
+    cr_assert_eq(stale, version, "Current version was not returned");
+    free(key);
+    free(val);
+
+    got = get(global_map, MAP_KEY("key", 3));
+    cr_assert_arr_eq(got.val_base, "two", 3);
+    free(got.val_base);
+}
+
+bool allow_put(map_key_t key, void *arg) {
+    return *(bool *)arg;
+}
+
+Test(map_suite, 05_put_absent, .timeout = 2, .init = map_init, .fini = map_fini) {
+    bool allow = false;
+    char *key = strdup("key"), *val = strdup("one");
+
+    // a failed check leaves the map alone
+    cr_assert_not(put_absent(global_map, MAP_KEY(key, 3), MAP_VAL(val, 3), false, allow_put, &allow), "Vetoed put succeeded");
+    cr_assert_eq(errno, ESTALE);
+    cr_assert_null(get(global_map, MAP_KEY("key", 3)).val_base, "Vetoed put was stored");
+
+    allow = true;
+    cr_assert(put_absent(global_map, MAP_KEY(key, 3), MAP_VAL(val, 3), false, allow_put, &allow), "Put failed");
+
+    // a key already there is never overwritten
+    key = strdup("key");
+    val = strdup("two");
+    cr_assert_not(put_absent(global_map, MAP_KEY(key, 3), MAP_VAL(val, 3), false, allow_put, &allow), "Present key was overwritten");
+    cr_assert_eq(errno, EEXIST);
+    free(key);
+    free(val);
+
+    map_val_t got = get(global_map, MAP_KEY("key", 3));
+    cr_assert_arr_eq(got.val_base, "one", 3);
+    free(got.val_base);
+}
@@ -0,0 +1,113 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cream.h"
+#include "journal.h"
+
+#define JOURNAL_PATH "/tmp/cream_journal_test.log"
+#define NUM_RECORDS 100
+
+hashmap_t *journal_map;
+int replayed_puts, replayed_evicts, replayed_clears;
+
+void journal_free_function(map_key_t key, map_val_t val) {
+    free(key.key_base);
+    free(val.val_base);
+}
+
+void count_record(uint8_t op, map_key_t key, map_val_t val) {
+    if(op == PUT) { __sync_fetch_and_add(&replayed_puts, 1); }
+    if(op == EVICT) { __sync_fetch_and_add(&replayed_evicts, 1); }
+    if(op == CLEAR) { __sync_fetch_and_add(&replayed_clears, 1); }
+}
+
+void journal_init(void) {
+    unlink(JOURNAL_PATH);
+    journal_map = create_map(NUM_RECORDS, jenkins_one_at_a_time_hash, journal_free_function);
+    replayed_puts = replayed_evicts = replayed_clears = 0;
+}
+
+void journal_fini(void) {
+    invalidate_map(journal_map);
+    unlink(JOURNAL_PATH);
+}
+
+void append_records(journal_t *jnl, uint8_t op, int count) {
+    uint64_t lsn = 0;
+
+    for(int i = 0; i < count; i++) {
+        journal_lock(jnl);
+        lsn = journal_append(jnl, op, MAP_KEY(&i, op == CLEAR ? 0 : sizeof(int)), MAP_VAL(&i, op == PUT ? sizeof(int) : 0));
+        journal_unlock(jnl);
+    }
+    cr_assert(journal_wait(jnl, lsn), "Records were not made durable");
+}
+
+Test(journal_suite, 00_replay, .timeout = 5, .init = journal_init, .fini = journal_fini) {
+    journal_t *jnl = create_journal(JOURNAL_PATH, 0, journal_map);
+    cr_assert_not_null(jnl, "Journal returned was NULL");
+
+    append_records(jnl, PUT, NUM_RECORDS);
+    append_records(jnl, EVICT, 10);
+    invalidate_journal(jnl);
+
+    jnl = create_journal(JOURNAL_PATH, 0, journal_map);
+    cr_assert(replay_journal(jnl, count_record, 4), "Replay failed");
+    cr_assert_eq(replayed_puts, NUM_RECORDS, "Replayed %d puts. Expected %d", replayed_puts, NUM_RECORDS);
+    cr_assert_eq(replayed_evicts, 10, "Replayed %d evicts. Expected %d", replayed_evicts, 10);
+    invalidate_journal(jnl);
+}
+
+Test(journal_suite, 01_clear_and_torn_tail, .timeout = 5, .init = journal_init, .fini = journal_fini) {
+    journal_t *jnl = create_journal(JOURNAL_PATH, 0, journal_map);
+
+    append_records(jnl, PUT, NUM_RECORDS);
+    append_records(jnl, CLEAR, 1);
+    append_records(jnl, PUT, 5);
+    invalidate_journal(jnl);
+
+    // simulate a crash in the middle of a write
+    int fd = open(JOURNAL_PATH, O_WRONLY | O_APPEND);
+    cr_assert_eq(write(fd, "\x01\x04\x00", 3), 3);
+    close(fd);
+
+    jnl = create_journal(JOURNAL_PATH, 0, journal_map);
+    cr_assert(replay_journal(jnl, count_record, 2), "Replay failed");
+    cr_assert_eq(replayed_puts, 5, "Replayed %d puts. Expected %d", replayed_puts, 5);
+    cr_assert_eq(replayed_clears, 0, "Records before the last CLEAR were replayed");
+    cr_assert_eq(jnl->file_size, (NUM_RECORDS + 5) * (sizeof(journal_record_t) + 2 * sizeof(int)) + sizeof(journal_record_t),
+        "Torn record was not truncated");
+    invalidate_journal(jnl);
+}
+
+Test(journal_suite, 02_rollback, .timeout = 5, .init = journal_init, .fini = journal_fini) {
+    journal_t *jnl = create_journal(JOURNAL_PATH, 0, journal_map);
+    journal_mark_t mark;
+    uint64_t lsn;
+
+    append_records(jnl, PUT, 5);
+
+    // a batch that fails partway leaves nothing in the log
+    journal_lock(jnl);
+    mark = journal_mark(jnl);
+    for(int i = 0; i < 3; i++) {
+        cr_assert_neq(journal_append(jnl, PUT, MAP_KEY(&i, sizeof(int)), MAP_VAL(&i, sizeof(int))), 0);
+    }
+    journal_rollback(jnl, mark);
+    lsn = journal_append(jnl, EVICT, MAP_KEY(&lsn, sizeof(lsn)), MAP_VAL(NULL, 0));
+    journal_unlock(jnl);
+    cr_assert_eq(lsn, 6, "Rolled back records kept their sequence numbers");
+    cr_assert(journal_wait(jnl, lsn), "Record after a rollback not made durable");
+    invalidate_journal(jnl);
+
+    jnl = create_journal(JOURNAL_PATH, 0, journal_map);
+    cr_assert(replay_journal(jnl, count_record, 2), "Replay failed");
+    cr_assert_eq(replayed_puts, 5, "Replayed %d puts. Expected 5", replayed_puts);
+    cr_assert_eq(replayed_evicts, 1, "Replayed %d evicts. Expected 1", replayed_evicts);
+    invalidate_journal(jnl);
+}
@@ -0,0 +1,68 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <errno.h>
+
+#include "lanes.h"
+
+lanes_t *global_lanes;
+int items[16];
+
+void lanes_init(void) {
+    int weights[] = {3, 1};
+
+    global_lanes = create_lanes(2, weights, 4);
+}
+
+void lanes_fini(void) {
+    invalidate_lanes(global_lanes);
+    free(global_lanes);
+}
+
+Test(lanes_suite, 00_creation, .timeout = 2) {
+    int weights[] = {1, 0};
+
+    errno = 0;
+    cr_assert_null(create_lanes(2, weights, 0), "Lane of weight 0 accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+    cr_assert_null(create_lanes(LANES_MAX + 1, weights, 0), "Too many lanes accepted");
+}
+
+Test(lanes_suite, 01_weighted, .timeout = 2, .init = lanes_init, .fini = lanes_fini) {
+    lanes_cursor_t cursor = {0};
+
+    // four items on each lane come out three from lane 0 to one from lane 1
+    for(int i = 0; i < 4; i++){
+        cr_assert(lanes_push(global_lanes, 0, &items[i]), "Push to lane 0 failed");
+        cr_assert(lanes_push(global_lanes, 1, &items[8 + i]), "Push to lane 1 failed");
+    }
+    errno = 0;
+    cr_assert(!lanes_push(global_lanes, 1, &items[12]), "Full lane took an item");
+    cr_assert_eq(errno, EAGAIN, "errno was not EAGAIN");
+    cr_assert_eq(lanes_length(global_lanes), 8, "Length was %d", lanes_length(global_lanes));
+
+    int *order[] = {&items[0], &items[1], &items[2], &items[8], &items[3], &items[9], &items[10], &items[11]};
+    for(int i = 0; i < 8; i++){
+        cr_assert_eq(lanes_pop(global_lanes, &cursor, 0, NULL), order[i], "Item %d out of order", i);
+    }
+    cr_assert_null(lanes_pop(global_lanes, &cursor, 10, NULL), "Empty lanes returned an item");
+    cr_assert_eq(errno, ETIMEDOUT, "errno was not ETIMEDOUT");
+}
+
+Test(lanes_suite, 02_reserved, .timeout = 2, .init = lanes_init, .fini = lanes_fini) {
+    lanes_cursor_t cursor = {0};
+    struct timespec oldest;
+
+    cr_assert(!lanes_oldest(global_lanes, &oldest), "Empty lanes have an oldest item");
+    cr_assert(lanes_push(global_lanes, 1, &items[0]), "Push to lane 1 failed");
+    cr_assert(lanes_push(global_lanes, 0, &items[1]), "Push to lane 0 failed");
+    cr_assert(lanes_oldest(global_lanes, &oldest), "Lanes have no oldest item");
+
+    // a reserved worker only sees its lane, and the post it leaves behind
+    // wakes a shared worker that finds the other lane's item, then nothing
+    cr_assert_eq(lanes_pop_lane(global_lanes, 0, 0, NULL), &items[1], "Reserved pop took the wrong item");
+    cr_assert_null(lanes_pop_lane(global_lanes, 0, 0, NULL), "Reserved pop saw another lane");
+    cr_assert_eq(lanes_pop(global_lanes, &cursor, 0, NULL), &items[0], "Shared pop missed lane 1");
+    errno = 0;
+    cr_assert_null(lanes_pop(global_lanes, &cursor, 0, NULL), "Stale post returned an item");
+    cr_assert_eq(errno, EAGAIN, "errno was not EAGAIN");
+}
@@ -0,0 +1,48 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lease.h"
+
+#define LEASE_TTL_MS 50
+
+lease_table_t *global_leases;
+
+void lease_init(void) {
+    global_leases = create_lease_table(64, LEASE_TTL_MS);
+}
+
+void lease_fini(void) {
+    invalidate_lease_table(global_leases);
+}
+
+Test(lease_suite, 00_one_holder, .timeout = 2, .init = lease_init, .fini = lease_fini) {
+    cr_assert_not_null(global_leases, "Lease table returned was NULL");
+
+    uint64_t token = lease_acquire(global_leases, MAP_KEY("key", 3));
+    cr_assert_neq(token, 0, "First miss got no lease");
+    cr_assert_eq(lease_acquire(global_leases, MAP_KEY("key", 3)), 0, "Second miss got a lease");
+    cr_assert_neq(lease_acquire(global_leases, MAP_KEY("kez", 3)), 0, "Other key got no lease");
+
+    cr_assert_not(lease_release(global_leases, MAP_KEY("key", 3), token + 100), "Wrong token released the lease");
+    cr_assert(lease_release(global_leases, MAP_KEY("key", 3), token), "Holder could not release the lease");
+    cr_assert_not(lease_release(global_leases, MAP_KEY("key", 3), token), "Lease was released twice");
+}
+
+Test(lease_suite, 01_expiry, .timeout = 2, .init = lease_init, .fini = lease_fini) {
+    uint64_t token = lease_acquire(global_leases, MAP_KEY("key", 3));
+
+    usleep(2 * LEASE_TTL_MS * 1000);
+    cr_assert_not(lease_release(global_leases, MAP_KEY("key", 3), token), "Expired lease was released");
+    cr_assert_neq(lease_acquire(global_leases, MAP_KEY("key", 3)), 0, "Expired lease blocked a new one");
+}
+
+Test(lease_suite, 02_revoke, .timeout = 2, .init = lease_init, .fini = lease_fini) {
+    uint64_t token = lease_acquire(global_leases, MAP_KEY("key", 3));
+
+    cr_assert(lease_revoke(global_leases, MAP_KEY("key", 3)), "Live lease was not revoked");
+    cr_assert_not(lease_release(global_leases, MAP_KEY("key", 3), token), "Revoked lease was released");
+}
@@ -0,0 +1,77 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOCKSTAT
+#include "lockstat.h"
+
+lockstat_t global_stat;
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void lockstat_init(void) {
+    lockstat_register(&global_stat, "test");
+}
+
+void lockstat_fini(void) {
+    lockstat_unregister(&global_stat);
+}
+
+void *holder(void *arg) {
+    lockstat_mutex_lock(&global_lock, &global_stat);
+    usleep(20000);
+    lockstat_mutex_unlock(&global_lock, &global_stat);
+    return NULL;
+}
+
+Test(lockstat_suite, 00_uncontended, .timeout = 2, .init = lockstat_init, .fini = lockstat_fini) {
+    for(int i = 0; i < 10; i++){
+        cr_assert_eq(lockstat_mutex_lock(&global_lock, &global_stat), 0, "Lock failed");
+        cr_assert_eq(lockstat_mutex_unlock(&global_lock, &global_stat), 0, "Unlock failed");
+    }
+    cr_assert_eq(global_stat.acquired, 10, "Acquired was %lu", global_stat.acquired);
+    cr_assert_eq(global_stat.contended, 0, "Uncontended lock was counted as contended");
+    cr_assert_eq(global_stat.wait_cycles, 0, "Uncontended lock was counted as waited on");
+}
+
+Test(lockstat_suite, 01_contended, .timeout = 2, .init = lockstat_init, .fini = lockstat_fini) {
+    pthread_t tid;
+
+    // a second thread takes the lock first and holds it for a while
+    lockstat_mutex_lock(&global_lock, &global_stat);
+    pthread_create(&tid, NULL, holder, NULL);
+    lockstat_mutex_unlock(&global_lock, &global_stat);
+    usleep(5000);
+    lockstat_mutex_lock(&global_lock, &global_stat);
+    lockstat_mutex_unlock(&global_lock, &global_stat);
+    pthread_join(tid, NULL);
+
+    cr_assert_eq(global_stat.acquired, 3, "Acquired was %lu", global_stat.acquired);
+    cr_assert_eq(global_stat.contended, 1, "Contended was %lu", global_stat.contended);
+    cr_assert_gt(global_stat.wait_cycles, 0, "Wait was not timed");
+    cr_assert_geq(global_stat.hold_cycles, global_stat.wait_cycles, "Hold shorter than the wait it caused");
+}
+
+Test(lockstat_suite, 02_print, .timeout = 2, .init = lockstat_init, .fini = lockstat_fini) {
+    lockstat_t other;
+    sem_t sem;
+    char buf[1024];
+
+    sem_init(&sem, 0, 1);
+    lockstat_register(&other, "test");
+    lockstat_mutex_lock(&global_lock, &global_stat);
+    lockstat_mutex_unlock(&global_lock, &global_stat);
+    lockstat_sem_wait(&sem, &other);
+    lockstat_sem_post(&sem, &other);
+
+    // locks of one name are summed into one set of lines
+    cr_assert_gt(lockstat_print(buf, sizeof(buf)), 0, "Nothing was printed");
+    cr_assert_not_null(strstr(buf, "lock_test_acquired 2\n"), "Missing acquired in:\n%s", buf);
+    cr_assert_not_null(strstr(buf, "lock_test_contended 0\n"), "Missing contended in:\n%s", buf);
+    cr_assert_not_null(strstr(buf, "lock_test_wait_ns "), "Missing wait in:\n%s", buf);
+    cr_assert_null(strstr(strstr(buf, "lock_test_acquired") + 1, "lock_test_acquired"), "Name printed twice");
+
+    lockstat_unregister(&other);
+    sem_destroy(&sem);
+}
@@ -0,0 +1,83 @@
+#include <arpa/inet.h>
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <errno.h>
+
+#include "peers.h"
+
+peers_t *global_peers;
+
+void peers_init(void) {
+    global_peers = create_peers(16, 2);
+}
+
+void peers_fini(void) {
+    invalidate_peers(global_peers);
+    free(global_peers);
+}
+
+void peers_ipv4(uint32_t ip, uint8_t *addr) {
+    struct sockaddr_in sa = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(ip)};
+
+    peers_addr((struct sockaddr *)&sa, addr);
+}
+
+Test(peers_suite, 00_creation, .timeout = 2) {
+    errno = 0;
+    cr_assert_null(create_peers(12, 2), "Capacity not a power of two accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+    errno = 0;
+    cr_assert_null(create_peers(16, 0), "Zero limit accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+}
+
+Test(peers_suite, 01_limit, .timeout = 2, .init = peers_init, .fini = peers_fini) {
+    uint8_t a[PEERS_ADDR_LEN], b[PEERS_ADDR_LEN];
+
+    cr_assert_not_null(global_peers, "Table returned was NULL");
+    peers_ipv4(0x7f000001, a);
+    peers_ipv4(0x0a000001, b);
+    cr_assert_eq(a[10], 0xff, "IPv4 address wasn't mapped");
+
+    cr_assert(peers_add(global_peers, a), "First connection refused");
+    cr_assert(peers_add(global_peers, a), "Second connection refused");
+    errno = 0;
+    cr_assert(!peers_add(global_peers, a), "Connection over the limit counted");
+    cr_assert_eq(errno, EBUSY, "errno was not EBUSY");
+    cr_assert(peers_add(global_peers, b), "Other address refused");
+
+    // closing one makes room for another
+    peers_remove(global_peers, a);
+    cr_assert_eq(peers_count(global_peers, a), 1);
+    cr_assert(peers_add(global_peers, a), "Connection refused after a close");
+    peers_remove(global_peers, a);
+    peers_remove(global_peers, a);
+    cr_assert_eq(peers_count(global_peers, a), 0);
+    cr_assert_eq(global_peers->used, 1, "Freed address still holds a slot");
+}
+
+Test(peers_suite, 02_full, .timeout = 2, .init = peers_init, .fini = peers_fini) {
+    uint8_t addr[PEERS_ADDR_LEN];
+
+    // three quarters of 16 slots hold distinct addresses
+    for(uint32_t ip = 1; ip <= 12; ip++){
+        peers_ipv4(ip, addr);
+        cr_assert(peers_add(global_peers, addr), "Address %u refused", ip);
+    }
+    peers_ipv4(13, addr);
+    errno = 0;
+    cr_assert(!peers_add(global_peers, addr), "Full table took an address");
+    cr_assert_eq(errno, ENOSPC, "errno was not ENOSPC");
+
+    // removals in any order leave every other address findable
+    for(uint32_t ip = 1; ip <= 12; ip += 2){
+        peers_ipv4(ip, addr);
+        peers_remove(global_peers, addr);
+    }
+    for(uint32_t ip = 1; ip <= 12; ip++){
+        peers_ipv4(ip, addr);
+        cr_assert_eq(peers_count(global_peers, addr), ip % 2 == 0, "Address %u miscounted", ip);
+    }
+    peers_ipv4(13, addr);
+    cr_assert(peers_add(global_peers, addr), "Address refused after removals");
+}
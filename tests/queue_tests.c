@@ -57,4 +57,43 @@ Test(queue_suite, 01_multithreaded, .timeout = 2, .init = queue_init, .fini = qu
     cr_assert_eq(num_items, NUM_THREADS, "Had %d items. Expected: %d", num_items, NUM_THREADS);
 }
 
-*/
\ No newline at end of file
+*/
+Test(queue_suite, 02_timed, .timeout = 2, .init = queue_init, .fini = queue_fini) {
+    struct timespec before, queued, oldest;
+    int item = 7;
+
+    // an empty queue gives up after the timeout
+    errno = 0;
+    cr_assert_null(dequeue_timed(global_queue, 50, NULL), "Empty queue returned an item");
+    cr_assert_eq(errno, ETIMEDOUT, "errno was not ETIMEDOUT");
+    cr_assert(!queue_oldest(global_queue, &oldest), "Empty queue has an oldest item");
+
+    // the head's enqueue time is reported by both
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    cr_assert(enqueue(global_queue, &item), "Enqueue failed");
+    cr_assert(queue_oldest(global_queue, &oldest), "Queue has no oldest item");
+    cr_assert(oldest.tv_sec > before.tv_sec || (oldest.tv_sec == before.tv_sec && oldest.tv_nsec >= before.tv_nsec),
+        "Enqueue time is before the enqueue");
+    cr_assert_eq(dequeue_timed(global_queue, 50, &queued), &item, "Wrong item dequeued");
+    cr_assert(queued.tv_sec == oldest.tv_sec && queued.tv_nsec == oldest.tv_nsec, "Enqueue times differ");
+}
+
+Test(queue_suite, 03_bounded, .timeout = 2) {
+    queue_t *bounded = create_bounded_queue(2);
+    int items[3];
+
+    cr_assert_not_null(bounded, "Queue returned was null");
+    cr_assert(enqueue(bounded, &items[0]), "First enqueue failed");
+    cr_assert(enqueue(bounded, &items[1]), "Second enqueue failed");
+    errno = 0;
+    cr_assert(!enqueue(bounded, &items[2]), "Full queue took an item");
+    cr_assert_eq(errno, EAGAIN, "errno was not EAGAIN");
+
+    // a dequeue makes room again
+    cr_assert_eq(dequeue(bounded), &items[0], "Wrong item dequeued");
+    cr_assert(enqueue(bounded, &items[2]), "Enqueue after dequeue failed");
+    cr_assert_eq(bounded->length, 2, "Length was %d", bounded->length);
+    dequeue(bounded);
+    dequeue(bounded);
+    invalidate_queue(bounded, queue_free_function);
+}
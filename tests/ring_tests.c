@@ -0,0 +1,68 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ring.h"
+
+#define RING_ITEMS 100000
+
+ring_t *global_ring;
+
+void ring_init(void) {
+    global_ring = create_ring(8);
+}
+
+void ring_fini(void) {
+    invalidate_ring(global_ring);
+    free(global_ring);
+}
+
+void *ring_producer(void *arg) {
+    for(uintptr_t i = 1; i <= RING_ITEMS; i++){
+        while(!ring_push(global_ring, (void *)i)){
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+Test(ring_suite, 00_creation, .timeout = 2) {
+    errno = 0;
+    cr_assert_null(create_ring(6), "Capacity not a power of two accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+}
+
+Test(ring_suite, 01_full_and_empty, .timeout = 2, .init = ring_init, .fini = ring_fini) {
+    cr_assert_not_null(global_ring, "Ring returned was NULL");
+    cr_assert_null(ring_pop(global_ring), "Empty ring returned an item");
+
+    for(uintptr_t i = 1; i <= 8; i++){
+        cr_assert(ring_push(global_ring, (void *)i), "Push %lu failed", i);
+    }
+    cr_assert(!ring_push(global_ring, (void *)9), "Full ring took an item");
+
+    // items come back in order, and a pop makes room for one more
+    cr_assert_eq(ring_pop(global_ring), (void *)1);
+    cr_assert(ring_push(global_ring, (void *)9), "Push after pop failed");
+    for(uintptr_t i = 2; i <= 9; i++){
+        cr_assert_eq(ring_pop(global_ring), (void *)i, "Item %lu out of order", i);
+    }
+    cr_assert_null(ring_pop(global_ring), "Drained ring returned an item");
+}
+
+Test(ring_suite, 02_threads, .timeout = 10, .init = ring_init, .fini = ring_fini) {
+    pthread_t tid;
+    void *item;
+
+    pthread_create(&tid, NULL, ring_producer, NULL);
+    for(uintptr_t i = 1; i <= RING_ITEMS; i++){
+        while((item = ring_pop(global_ring)) == NULL){
+            sched_yield();
+        }
+        cr_assert_eq(item, (void *)i, "Got %p for item %lu", item, i);
+    }
+    pthread_join(tid, NULL);
+    cr_assert_null(ring_pop(global_ring), "Drained ring returned an item");
+}
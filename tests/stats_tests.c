@@ -0,0 +1,86 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+stats_t *global_stats;
+
+void stats_init(void) {
+    global_stats = create_stats(2);
+}
+
+void stats_fini(void) {
+    invalidate_stats(global_stats);
+    free(global_stats);
+}
+
+Test(stats_suite, 00_buckets, .timeout = 2) {
+    int last = 0;
+
+    // small values are exact, and buckets never go backwards
+    for(uint64_t v = 0; v < STATS_SUB_BUCKETS; v++){
+        cr_assert_eq(stats_bucket(v), v, "Small value %lu not in its own bucket", v);
+    }
+    for(uint64_t v = 1; v < 1 << 20; v += 7){
+        cr_assert_geq(stats_bucket(v), last, "Bucket went backwards at %lu", v);
+        last = stats_bucket(v);
+    }
+    cr_assert_eq(stats_bucket(UINT64_MAX), STATS_BUCKETS - 1, "Huge value not in the last bucket");
+}
+
+Test(stats_suite, 01_percentile, .timeout = 2, .init = stats_init, .fini = stats_fini) {
+    stats_block_t *block = stats_block(global_stats, 0);
+    uint64_t p50, p99;
+
+    cr_assert_not_null(block, "Block returned was NULL");
+    cr_assert_null(stats_block(global_stats, 2), "Block past the end was returned");
+    cr_assert_eq((uintptr_t)block % STATS_LINE, 0, "Block not cache line aligned");
+    cr_assert_eq((uintptr_t)stats_block(global_stats, 1) % STATS_LINE, 0, "Block not cache line aligned");
+
+    for(uint64_t v = 1; v <= 10000; v++){
+        stats_record(&block->latency[STATS_GET], v);
+    }
+    p50 = stats_percentile(&block->latency[STATS_GET], 0.5);
+    p99 = stats_percentile(&block->latency[STATS_GET], 0.99);
+
+    // a bucket is at most 1/16th wide
+    cr_assert(p50 >= 5000 && p50 <= 5000 + 5000 / 16, "p50 was %lu", p50);
+    cr_assert(p99 >= 9900 && p99 <= 10000, "p99 was %lu", p99);
+    cr_assert_eq(stats_percentile(&block->latency[STATS_GET], 1.0), 10000);
+    cr_assert_eq(stats_percentile(&block->latency[STATS_PUT], 0.5), 0, "Empty histogram had a percentile");
+}
+
+Test(stats_suite, 02_merge_and_print, .timeout = 2, .init = stats_init, .fini = stats_fini) {
+    stats_block_t *total = aligned_alloc(STATS_LINE, sizeof(stats_block_t));
+    char buf[4096];
+
+    stats_block(global_stats, 0)->ops[STATS_GET] = 2;
+    stats_block(global_stats, 1)->ops[STATS_GET] = 3;
+    stats_block(global_stats, 0)->hits = 4;
+    stats_block(global_stats, 1)->misses = 1;
+    stats_block(global_stats, 1)->expired = 2;
+    stats_record(&stats_block(global_stats, 0)->probes, 1);
+    stats_record(&stats_block(global_stats, 1)->probes, 3);
+    stats_record(&stats_block(global_stats, 1)->latency[STATS_GET], 700);
+    stats_record(&stats_block(global_stats, 0)->queue_wait, 2000);
+
+    stats_merge(global_stats, total);
+    cr_assert_eq(total->ops[STATS_GET], 5);
+    cr_assert_eq(total->probes.count, 2);
+    cr_assert_eq(total->probes.max, 3);
+
+    cr_assert_gt(stats_print(total, buf, sizeof(buf)), 0, "Nothing was printed");
+    cr_assert_not_null(strstr(buf, "ops_get 5\n"), "Missing op count in:\n%s", buf);
+    cr_assert_null(strstr(buf, "ops_put"), "Unseen op printed");
+    cr_assert_not_null(strstr(buf, "hits 4\nmisses 1\nexpired 2\n"), "Missing hits in:\n%s", buf);
+    cr_assert_not_null(strstr(buf, "probes_3 1\n"), "Missing probe bucket in:\n%s", buf);
+    cr_assert_not_null(strstr(buf, "latency_get_max_ns 700\n"), "Missing latency in:\n%s", buf);
+    cr_assert_not_null(strstr(buf, "queue_wait_max_ns 2000\n"), "Missing queue wait in:\n%s", buf);
+
+    // output is cut short rather than overrun
+    cr_assert_eq(stats_print(total, buf, 8), 7);
+    cr_assert_eq(strlen(buf), 7);
+    free(total);
+}
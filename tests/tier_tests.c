@@ -0,0 +1,96 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tier.h"
+
+#define TIER_PATH "/tmp/cream_tier_test.dat"
+#define TIER_SIZE (64 * 1024)
+
+tier_t *global_tier;
+
+void tier_init(void) {
+    global_tier = create_tier(TIER_PATH, TIER_SIZE);
+}
+
+void tier_fini(void) {
+    invalidate_tier(global_tier);
+    unlink(TIER_PATH);
+}
+
+Test(tier_suite, 00_spill_and_read, .timeout = 2, .init = tier_init, .fini = tier_fini) {
+    cr_assert_not_null(global_tier, "Tier returned was NULL");
+    cr_assert(tier_put(global_tier, MAP_KEY("key", 3), MAP_VAL("value", 5)), "Spill failed");
+
+    map_val_t val = tier_get(global_tier, MAP_KEY("key", 3));
+    cr_assert_eq(val.val_len, 5, "Value had length %zu. Expected 5", val.val_len);
+    cr_assert_arr_eq(val.val_base, "value", 5);
+    free(val.val_base);
+
+    cr_assert_null(tier_get(global_tier, MAP_KEY("kez", 3)).val_base, "Missing key was found");
+}
+
+Test(tier_suite, 01_delete, .timeout = 2, .init = tier_init, .fini = tier_fini) {
+    tier_put(global_tier, MAP_KEY("key", 3), MAP_VAL("value", 5));
+    cr_assert(tier_delete(global_tier, MAP_KEY("key", 3)), "Stub was not removed");
+    cr_assert_null(tier_get(global_tier, MAP_KEY("key", 3)).val_base, "Deleted key was found");
+}
+
+Test(tier_suite, 02_lapped, .timeout = 2, .init = tier_init, .fini = tier_fini) {
+    char filler[1024];
+    int i;
+
+    memset(filler, 'x', sizeof(filler));
+    tier_put(global_tier, MAP_KEY("first", 5), MAP_VAL("value", 5));
+
+    // wrap the log until the first record is overwritten
+    for(i = 0; i < 2 * TIER_SIZE / sizeof(filler); i++) {
+        tier_put(global_tier, MAP_KEY(&i, sizeof(int)), MAP_VAL(filler, sizeof(filler)));
+    }
+
+    cr_assert_null(tier_get(global_tier, MAP_KEY("first", 5)).val_base, "Lapped record was read back");
+    i--;
+    map_val_t val = tier_get(global_tier, MAP_KEY(&i, sizeof(int)));
+    cr_assert_eq(val.val_len, sizeof(filler), "Newest record was not readable");
+    free(val.val_base);
+}
+
+Test(tier_suite, 03_reserved, .timeout = 2, .init = tier_init, .fini = tier_fini) {
+    tier_stub_t stub;
+
+    cr_assert(tier_reserve(global_tier, MAP_KEY("key", 3), 5, &stub), "Reserve failed");
+    cr_assert_null(tier_get(global_tier, MAP_KEY("key", 3)).val_base, "Unwritten record was read");
+    cr_assert(tier_write(global_tier, &stub, MAP_KEY("key", 3), MAP_VAL("value", 5)), "Write failed");
+
+    map_val_t val = tier_get(global_tier, MAP_KEY("key", 3));
+    cr_assert_eq(val.val_len, 5, "Value had length %zu. Expected 5", val.val_len);
+    free(val.val_base);
+
+    // a key deleted between the reserve and the write stays deleted
+    cr_assert(tier_reserve(global_tier, MAP_KEY("kez", 3), 5, &stub), "Reserve failed");
+    tier_delete(global_tier, MAP_KEY("kez", 3));
+    cr_assert_not(tier_write(global_tier, &stub, MAP_KEY("kez", 3), MAP_VAL("value", 5)), "Deleted stub was written");
+    cr_assert_null(tier_get(global_tier, MAP_KEY("kez", 3)).val_base, "Deleted key was found");
+}
+
+Test(tier_suite, 04_holds, .timeout = 2, .init = tier_init, .fini = tier_fini) {
+    tier_stub_t stub, newer;
+
+    tier_put(global_tier, MAP_KEY("key", 3), MAP_VAL("value", 5));
+    map_val_t val = tier_read(global_tier, MAP_KEY("key", 3), &stub);
+    cr_assert_not_null(val.val_base, "Spilled key was not read");
+    free(val.val_base);
+    cr_assert(tier_holds(global_tier, &stub), "Untouched stub was not held");
+
+    // spilling the key again replaces the stub read earlier
+    tier_put(global_tier, MAP_KEY("key", 3), MAP_VAL("newer", 5));
+    cr_assert_not(tier_holds(global_tier, &stub), "Replaced stub was held");
+
+    val = tier_read(global_tier, MAP_KEY("key", 3), &newer);
+    free(val.val_base);
+    tier_delete(global_tier, MAP_KEY("key", 3));
+    cr_assert_not(tier_holds(global_tier, &newer), "Deleted stub was held");
+}
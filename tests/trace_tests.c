@@ -0,0 +1,88 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_TEST_PATH "/tmp/cream_trace_test.trc"
+
+trace_t *global_trace;
+
+void trace_init(void) {
+    global_trace = create_trace(TRACE_TEST_PATH, 2, 8, 0);
+}
+
+void trace_fini(void) {
+    invalidate_trace(global_trace);
+    free(global_trace);
+    unlink(TRACE_TEST_PATH);
+}
+
+// reads back every record in the trace file
+static size_t read_trace(trace_record_t *records, size_t max) {
+    trace_file_header_t header;
+    FILE *file = fopen(TRACE_TEST_PATH, "r");
+    size_t n;
+
+    cr_assert_not_null(file, "Trace file was not created");
+    cr_assert_eq(fread(&header, sizeof(header), 1, file), 1, "Header missing");
+    cr_assert_eq(memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)), 0, "Bad magic");
+    cr_assert_eq(header.record_size, sizeof(trace_record_t), "Bad record size");
+    n = fread(records, sizeof(trace_record_t), max, file);
+    fclose(file);
+    return n;
+}
+
+Test(trace_suite, 00_creation, .timeout = 2) {
+    errno = 0;
+    cr_assert_null(create_trace(TRACE_TEST_PATH, 1, 6, 0), "Ring size not a power of two accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+    cr_assert_null(create_trace(TRACE_TEST_PATH, 0, 8, 0), "No rings accepted");
+}
+
+Test(trace_suite, 01_flush, .timeout = 2, .init = trace_init, .fini = trace_fini) {
+    trace_record_t records[16];
+    size_t n;
+
+    cr_assert_not_null(global_trace, "Trace returned was NULL");
+    cr_assert_null(trace_ring(global_trace, 2), "Ring past the end was returned");
+    trace_record(trace_ring(global_trace, 0), TRACE_ENQUEUE, 7, 1, 0, 0);
+    trace_record(trace_ring(global_trace, 1), TRACE_DEQUEUE, 7, 1, 0, 0);
+    trace_record(trace_ring(global_trace, 1), TRACE_DONE, 7, 1, 0x01, 200);
+    cr_assert(trace_flush(global_trace), "Flush failed");
+    // a second flush only writes what is new
+    cr_assert(trace_flush(global_trace), "Flush failed");
+
+    n = read_trace(records, 16);
+    cr_assert_eq(n, 3, "%zu records were written", n);
+    cr_assert_eq(records[0].event, TRACE_ENQUEUE);
+    cr_assert_eq(records[0].thread, 0);
+    cr_assert_eq(records[2].event, TRACE_DONE);
+    cr_assert_eq(records[2].thread, 1);
+    cr_assert_eq(records[2].conn, 7);
+    cr_assert_eq(records[2].status, 200);
+    cr_assert_leq(records[1].ns, records[2].ns, "Time went backwards");
+}
+
+Test(trace_suite, 02_lapped, .timeout = 2, .init = trace_init, .fini = trace_fini) {
+    trace_record_t records[16];
+    size_t n;
+
+    // the slot after the last record may be mid-write, so a full ring of 8
+    // keeps the last 7 of 20 and says how many it dropped
+    for(uint32_t i = 1; i <= 20; i++){
+        trace_record(trace_ring(global_trace, 0), TRACE_SENT, 1, i, 0, 0);
+    }
+    cr_assert(trace_flush(global_trace), "Flush failed");
+
+    n = read_trace(records, 16);
+    cr_assert_eq(n, 8, "%zu records were written", n);
+    cr_assert_eq(records[0].event, TRACE_LOST);
+    cr_assert_eq(records[0].seq, 13, "Lost was %u", records[0].seq);
+    for(int i = 1; i < 8; i++){
+        cr_assert_eq(records[i].seq, 13 + i, "Record %d was frame %u", i, records[i].seq);
+    }
+}
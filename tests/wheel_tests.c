@@ -0,0 +1,84 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <errno.h>
+
+#include "wheel.h"
+
+#define WHEEL_TIMERS 1000
+
+wheel_t *global_wheel;
+
+void wheel_init(void) {
+    global_wheel = create_wheel(8, 10, 1000);
+}
+
+void wheel_fini(void) {
+    invalidate_wheel(global_wheel);
+    free(global_wheel);
+}
+
+Test(wheel_suite, 00_creation, .timeout = 2) {
+    errno = 0;
+    cr_assert_null(create_wheel(6, 10, 0), "Slots not a power of two accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+    errno = 0;
+    cr_assert_null(create_wheel(8, 0, 0), "Zero tick accepted");
+    cr_assert_eq(errno, EINVAL, "errno was not EINVAL");
+}
+
+Test(wheel_suite, 01_expiry, .timeout = 2, .init = wheel_init, .fini = wheel_fini) {
+    wheel_timer_t early = {0}, late = {0}, moved = {0}, dropped = {0};
+
+    cr_assert_not_null(global_wheel, "Wheel returned was NULL");
+    wheel_arm(global_wheel, &early, 1025);
+    wheel_arm(global_wheel, &late, 1055);
+    wheel_arm(global_wheel, &moved, 1025);
+    wheel_arm(global_wheel, &dropped, 1030);
+    wheel_arm(global_wheel, &moved, 1045);
+    wheel_disarm(global_wheel, &dropped);
+    cr_assert(!wheel_armed(&dropped), "Disarmed timer still armed");
+    cr_assert_eq(global_wheel->armed, 3, "Armed %zu timers, not 3", global_wheel->armed);
+
+    // a timer fires once its tick has passed, not before
+    cr_assert_null(wheel_expire(global_wheel, 1029), "Fired inside the timer's tick");
+    cr_assert_eq(wheel_expire(global_wheel, 1030), &early, "Early timer didn't fire");
+    cr_assert_null(wheel_expire(global_wheel, 1030), "Fired a timer twice");
+    cr_assert_eq(wheel_expire(global_wheel, 1050), &moved, "Moved timer fired at its old time");
+    cr_assert_null(wheel_expire(global_wheel, 1059), "Late timer fired early");
+    cr_assert_eq(wheel_expire(global_wheel, 1060), &late, "Late timer didn't fire");
+    cr_assert_eq(global_wheel->armed, 0, "Timers left armed");
+
+    // a time already passed fires on the next tick
+    wheel_arm(global_wheel, &early, 900);
+    cr_assert_null(wheel_expire(global_wheel, 1069), "Fired before the next tick");
+    cr_assert_eq(wheel_expire(global_wheel, 1070), &early, "Past timer didn't fire");
+}
+
+Test(wheel_suite, 02_rounds, .timeout = 2, .init = wheel_init, .fini = wheel_fini) {
+    wheel_timer_t timers[WHEEL_TIMERS] = {{0}}, *timer;
+    uint64_t now, last = 0;
+    int fired = 0;
+
+    // the wheel spans 80 time units, so most timers share slots with ones
+    // due several turns later
+    for(int i = 0; i < WHEEL_TIMERS; i++){
+        wheel_arm(global_wheel, &timers[i], 1000 + (i * 7919) % 2000);
+    }
+    for(now = 1000; now <= 3010; now += 3){
+        while((timer = wheel_expire(global_wheel, now)) != NULL){
+            cr_assert_leq(timer->expires, now, "Timer due at %lu fired at %lu", timer->expires, now);
+            cr_assert_gt(timer->expires + 10 + 3, now, "Timer due at %lu fired late at %lu", timer->expires, now);
+            cr_assert_geq(timer->expires / 10, last / 10, "Timers fired out of tick order");
+            last = timer->expires;
+            fired++;
+        }
+    }
+    cr_assert_eq(fired, WHEEL_TIMERS, "Fired %d of %d timers", fired, WHEEL_TIMERS);
+
+    // a long gap visits every slot once and still finds everything
+    wheel_arm(global_wheel, &timers[0], 3100);
+    wheel_arm(global_wheel, &timers[1], 5000);
+    cr_assert_eq(wheel_expire(global_wheel, 10000), &timers[0]);
+    cr_assert_eq(wheel_expire(global_wheel, 10000), &timers[1]);
+    cr_assert_null(wheel_expire(global_wheel, 10000));
+}